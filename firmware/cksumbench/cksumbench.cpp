@@ -0,0 +1,111 @@
+// cksumbench.cpp : Checks firmware checksum kernel against the old routine
+// and compares their speed.
+//
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Firmware checksum code is built for the host */
+#define PACKED
+#include "../src/config.h"
+#undef FASTCODE
+#define FASTCODE
+#include "../src/net/chksum.c"
+
+#define BUF_SIZE		2048
+#define CHECK_COUNT		200000
+#define BENCH_BYTES		(256 * 1024 * 1024)
+
+static unsigned char buf[BUF_SIZE + 8];
+
+/* Old routine, one 16-bit word per iteration */
+static uint16 old_chksum(uint16 csum, uint8 *data, int num)
+{
+	int chksum, ichksum;
+	uint16 temp;
+
+	chksum = csum;
+	for (; num > 0; num-=2, data+=2)
+	{
+		temp = (*data << 8) | *(data+1);
+		if (num == 1) temp &= 0xFF00;	/* Zero last byte if odd */
+		ichksum = chksum + temp;
+		ichksum = ichksum & 0x0000FFFF;
+		if ((ichksum < temp) || (ichksum < chksum))
+		{
+			ichksum += 1;
+			ichksum = ichksum & 0x0000FFFF;
+		}
+		chksum = ichksum;
+	}
+	return (uint16)~chksum;
+}
+
+/* Compares results on random data, lengths, alignments and initial sums */
+static int Check()
+{
+	int i, offset, len, errors;
+	uint16 csum, a, b;
+
+	errors = 0;
+	for (i = 0; i < CHECK_COUNT; i++) {
+		offset = rand() & 7;
+		len = rand() % (BUF_SIZE - 8);
+		csum = (rand() & 1) ? (uint16)rand() : 0;
+
+		/* Runs of 0xFF exercise the carries */
+		if (i & 1) memset(&buf[offset], 0xFF, len);
+
+		a = old_chksum(csum, &buf[offset], len);
+		b = ip_chksum(csum, &buf[offset], len);
+		if (a != b) {
+			if (errors < 10) printf("Mismatch: offset %d, length %d, csum %04X: %04X != %04X\n", offset, len, csum, a, b);
+			errors++;
+		}
+
+		b = ~ip_chksum_partial(&buf[offset], len);
+		if (b != old_chksum(0, &buf[offset], len)) errors++;
+
+		if (i & 1) for (len = 0; len < BUF_SIZE + 8; len++) buf[len] = rand();
+	}
+
+	return errors;
+}
+
+/* Returns throughput in MB/s */
+static double Bench(uint16 (*fn)(uint16, uint8 *, int), int offset, int len)
+{
+	clock_t start, ticks;
+	volatile uint16 sink;
+	int i, n;
+
+	n = BENCH_BYTES / len;
+	start = clock();
+	for (i = 0; i < n; i++) sink = fn(0, &buf[offset], len);
+	ticks = clock() - start;
+	if (!ticks) ticks = 1;
+
+	return (double)n * len / (1024 * 1024) / ((double)ticks / CLOCKS_PER_SEC);
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 20, 64, 576, 1500 };
+	int i, errors;
+
+	srand((unsigned int)time(NULL));
+	for (i = 0; i < sizeof(buf); i++) buf[i] = rand();
+
+	errors = Check();
+	printf("%d cases checked, %d mismatches\n\n", CHECK_COUNT, errors);
+
+	printf("Size  Offset  Old, MB/s  New, MB/s\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		printf("%4d  %6d  %9.1f  %9.1f\n", sizes[i], 0, Bench(old_chksum, 0, sizes[i]), Bench(ip_chksum, 0, sizes[i]));
+		printf("%4d  %6d  %9.1f  %9.1f\n", sizes[i], 1, Bench(old_chksum, 1, sizes[i]), Bench(ip_chksum, 1, sizes[i]));
+	}
+
+	return errors ? 1 : 0;
+}
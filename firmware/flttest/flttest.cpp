@@ -0,0 +1,191 @@
+// flttest.cpp : Checks firmware capture filter compiler and matcher on
+// built frames.
+//
+
+#include "stdafx.h"
+#include <string.h>
+
+/* Firmware filter code is built for the host */
+#define PACKED
+#include "../src/config.h"
+#include "../src/net/filter.c"
+
+/* Test frames */
+#define FRM_UDP			0			/* 10.0.0.1:1234 -> 10.0.0.2:53 */
+#define FRM_TCP_VLAN	1			/* VLAN 100, 192.168.1.5:80 -> 10.0.0.1:40000 */
+#define FRM_ARP			2
+#define FRM_ICMP		3			/* 10.0.0.2 -> 10.0.0.1 */
+#define FRM_FRAG		4			/* UDP, not first fragment */
+#define FRM_COUNT		5
+
+static unsigned char frames[FRM_COUNT][80];
+static unsigned short sizes[FRM_COUNT];
+
+static const unsigned char mac1[6] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 };
+static const unsigned char mac2[6] = { 0x02, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE };
+
+typedef struct {
+	const char *	text;
+	int				valid;
+	const char *	match;			/* Expected result by frame */
+} flt_case;
+
+static const flt_case cases[] = {
+	{ "", 1, "11111" },
+	{ "ip", 1, "11011" },
+	{ "arp", 1, "00100" },
+	{ "not ip", 1, "00100" },
+	{ "udp", 1, "10001" },
+	{ "tcp", 1, "01000" },
+	{ "icmp", 1, "00010" },
+	{ "vlan", 1, "01000" },
+	{ "vlan 100", 1, "01000" },
+	{ "vlan 101", 1, "00000" },
+	{ "port 53", 1, "10000" },
+	{ "udp dst port 53", 1, "10000" },
+	{ "udp src port 53", 1, "00000" },
+	{ "tcp port 80", 1, "01000" },
+	{ "src port 80 or dst port 53", 1, "11000" },
+	{ "host 10.0.0.1", 1, "11011" },
+	{ "src host 10.0.0.1", 1, "10001" },
+	{ "dst host 10.0.0.1", 1, "01010" },
+	{ "net 192.168.0.0/16", 1, "01000" },
+	{ "net 10.0.0.0/8 and not udp", 1, "01010" },
+	{ "ether src 00:11:22:33:44:55", 1, "10101" },
+	{ "ether host 02:AA:BB:CC:DD:EE", 1, "11111" },
+	{ "ether proto 0x0806", 1, "00100" },
+	{ "proto 1", 1, "00010" },
+	{ "ip proto 17", 1, "10001" },
+	{ "!(udp || tcp)", 1, "00110" },
+	{ "not (ip and not icmp)", 1, "00110" },
+	{ "not not not arp", 1, "11011" },
+	{ "udp and (port 53 or port 80)", 1, "10000" },
+	{ "(udp or tcp) and (port 53 or port 80)", 0, "" },		/* 16 conjunctions */
+	{ "udp and not udp", 1, "00000" },
+	{ "((((((((((((((((arp))))))))))))))))", 1, "00100" },
+	{ "not not not not not not not not not not not not not not not not arp", 1, "00100" },
+	{ "(((((((((((((((((arp)))))))))))))))))", 0, "" },
+	{ "not not not not not not not not not not not not not not not not not arp", 0, "" },
+	{ "proto 1 or proto 2 or proto 3 or proto 4 or proto 5 or proto 6 or "
+	  "proto 7 or proto 8 or proto 9 or proto 10 or proto 11 or proto 12", 1, "01010" },
+	{ "proto 1 or proto 2 or proto 3 or proto 4 or proto 5 or proto 6 or "
+	  "proto 7 or proto 8 or proto 9 or proto 10 or proto 11 or proto 12 or proto 13", 0, "" },
+	{ "(arp or udp) and (arp or tcp) and (arp or icmp)", 1, "00100" },
+	{ "(arp or udp) and (arp or tcp) and (arp or icmp) and (arp or vlan)", 0, "" },
+	{ "udp and", 0, "" },
+	{ "(udp", 0, "" },
+	{ "host 10.0.0.256", 0, "" },
+	{ "port 65536", 0, "" },
+	{ "bogus", 0, "" },
+};
+
+static void SetIP(unsigned char *ip, unsigned char proto, unsigned int from, unsigned int to)
+{
+	memset(ip, 0, 20);
+	ip[0] = 0x45;
+	ip[9] = proto;
+	ip[12] = from >> 24; ip[13] = from >> 16; ip[14] = from >> 8; ip[15] = from;
+	ip[16] = to >> 24; ip[17] = to >> 16; ip[18] = to >> 8; ip[19] = to;
+}
+
+static void SetPorts(unsigned char *p, unsigned short from, unsigned short to)
+{
+	p[0] = from >> 8; p[1] = from & 0xFF;
+	p[2] = to >> 8; p[3] = to & 0xFF;
+}
+
+static void BuildFrames()
+{
+	unsigned char *f;
+	int i;
+
+	memset(frames, 0, sizeof(frames));
+	for (i = 0; i < FRM_COUNT; i++) {
+		f = frames[i];
+		memcpy(f, (i & 1) ? mac1 : mac2, 6);
+		memcpy(&f[6], (i & 1) ? mac2 : mac1, 6);
+		f[12] = 0x08;
+		sizes[i] = 60;
+	}
+
+	f = frames[FRM_UDP];
+	SetIP(&f[14], IP_PROTO_UDP, 0x0A000001, 0x0A000002);
+	SetPorts(&f[34], 1234, 53);
+
+	f = frames[FRM_TCP_VLAN];
+	f[12] = 0x81;
+	f[13] = 0x00;
+	f[14] = 0x00;
+	f[15] = 100;
+	f[16] = 0x08;
+	SetIP(&f[18], IP_PROTO_TCP, 0xC0A80105, 0x0A000001);
+	SetPorts(&f[38], 80, 40000);
+	sizes[FRM_TCP_VLAN] = 64;
+
+	f = frames[FRM_ARP];
+	f[13] = 0x06;
+
+	f = frames[FRM_ICMP];
+	SetIP(&f[14], IP_PROTO_ICMP, 0x0A000002, 0x0A000001);
+	f[34] = 8;
+
+	/* Ports of the first fragment are not checked in later ones */
+	f = frames[FRM_FRAG];
+	SetIP(&f[14], IP_PROTO_UDP, 0x0A000001, 0x0A000002);
+	f[20] = 0x00;
+	f[21] = 0xB9;
+	SetPorts(&f[34], 1234, 53);
+}
+
+/* Match frame passed whole and split in chunks across the headers */
+static int Match(flt_program *prog, int frame, int split)
+{
+	pktbuf a, b;
+
+	a.data = frames[frame];
+	a.len = split ? split : sizes[frame];
+	a.flags = 0;
+	a.next = NULL;
+	if (split) {
+		a.next = &b;
+		b.data = &frames[frame][split];
+		b.len = sizes[frame] - split;
+		b.flags = 0;
+		b.next = NULL;
+	}
+
+	return fltMatch(prog, &a);
+}
+
+int main(int argc, char **argv)
+{
+	static flt_program prog;
+	int i, j, split, valid, m, errors;
+
+	BuildFrames();
+
+	errors = 0;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		valid = fltCompile(&prog, cases[i].text);
+		if (valid != cases[i].valid) {
+			printf("Compile: '%s' %s\n", cases[i].text, valid ? "accepted" : "rejected");
+			errors++;
+			continue;
+		}
+		if (!valid) continue;
+
+		for (j = 0; j < FRM_COUNT; j++) {
+			for (split = 0; split < 40; split += 13) {
+				m = Match(&prog, j, split);
+				if (m != (cases[i].match[j] == '1')) {
+					printf("Match: '%s' frame %d split %d: %d\n", cases[i].text, j, split, m);
+					errors++;
+				}
+			}
+		}
+	}
+
+	printf("%d filters checked, %d errors\n", i, errors);
+
+	return errors ? 1 : 0;
+}
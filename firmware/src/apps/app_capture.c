@@ -0,0 +1,116 @@
+#include <config.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <grlib/grlib.h>
+#include <grlib/window.h>
+#include <net/capture.h>
+#include <os/messages.h>
+#include <os/timer.h>
+
+
+static cap_stats stats;
+static char buf[50];
+
+
+static void capRedraw(void *window, rect_t *rect)
+{
+	void *font;
+
+	if (!rect) return;
+
+	wndDrawWindowFrame(window);
+
+	font = grLoadFont(GR_FONT_NORMAL);
+
+	capGetStats(&stats);
+	switch (stats.state) {
+		case CAP_STATE_IDLE:
+			grTextOut(rect, font, 10, 20, GR_COLOR_BLACK, " ''");
+			break;
+		case CAP_STATE_RUNNING:
+			grTextOut(rect, font, 10, 20, GR_COLOR_BLACK, " ...");
+			break;
+		case CAP_STATE_FULL:
+			grTextOut(rect, font, 10, 20, GR_COLOR_RED, " ");
+			break;
+		case CAP_STATE_NOFILE:
+			grTextOut(rect, font, 10, 20, GR_COLOR_RED, "  " CAP_FILE_NAME);
+			break;
+		case CAP_STATE_ERROR:
+			grTextOut(rect, font, 10, 20, GR_COLOR_RED, " ");
+			break;
+		case CAP_STATE_BADFILTER:
+			grTextOut(rect, font, 10, 20, GR_COLOR_RED, "  " CAP_FILTER_NAME);
+			break;
+	}
+
+	if ( (stats.state != CAP_STATE_NOFILE) && (stats.state != CAP_STATE_BADFILTER) ) {
+		/* Frames saved and lost */
+		grTextOut(rect, font, 10, 35, GR_COLOR_BLACK, ":");
+		sprintf(buf, "%u", stats.frames);
+		grTextOut(rect, font, 90, 35, GR_COLOR_BLUE, buf);
+		grTextOut(rect, font, 10, 47, GR_COLOR_BLACK, ":");
+		sprintf(buf, "%u", stats.drops);
+		grTextOut(rect, font, 90, 47, stats.drops ? GR_COLOR_RED : GR_COLOR_BLUE, buf);
+		/* File usage */
+		grTextOut(rect, font, 10, 59, GR_COLOR_BLACK, ":");
+		sprintf(buf, "%u/%u ", stats.written / 1024, stats.space / 1024);
+		grTextOut(rect, font, 90, 59, GR_COLOR_BLUE, buf);
+		/* Ring usage peak */
+		grTextOut(rect, font, 10, 71, GR_COLOR_BLACK, ":");
+		sprintf(buf, "%u%%", stats.maxused * 100 / CAP_RING_SIZE);
+		grTextOut(rect, font, 90, 71, GR_COLOR_BLUE, buf);
+		/* Frames skipped by the filter */
+		if (stats.filter) {
+			grTextOut(rect, font, 10, 83, GR_COLOR_BLACK, ":");
+			sprintf(buf, "%u", stats.filtered);
+			grTextOut(rect, font, 90, 83, GR_COLOR_BLUE, buf);
+		}
+	}
+
+	wndDrawSoftkey(window, SOFTKEY_LEFT, "Exit");
+	wndDrawSoftkey(window, SOFTKEY_RIGHT, (stats.state == CAP_STATE_RUNNING) ? "Stop" : "Start");
+}
+
+static void capHandler(void *window, unsigned short msgCode, unsigned short msgParam, void *msgPtr, void *p)
+{
+	switch (msgCode) {
+		case MSG_REDRAW:
+			capRedraw(window, (rect_t *)msgPtr);
+			break;
+
+		case MSG_KEY_PRESSED:
+			/* Capture keeps running after the window is closed */
+			if (msgParam == 'C') {
+				tmrDestroyTimer(window, 1);
+				msgUnregisterWindow(window);
+			}
+			if (msgParam == 'R') {
+				capGetStats(&stats);
+				if (stats.state == CAP_STATE_RUNNING) {
+					capStop();
+				} else {
+					capStart();
+				}
+				msgInvalidateWindow(window);
+			}
+			break;
+
+		case MSG_TIMER:
+			msgInvalidateWindow(window);
+			break;
+	}
+}
+
+void app_capture()
+{
+	void *wnd;
+
+	/* Create window */
+	wnd = msgRegisterWindow("Packet Capture", 0, capHandler, NULL);
+	if (!wnd) return;
+
+	/* Create refresh timer */
+	tmrRegisterTimer(wnd, 500, 0, 1);
+}
@@ -1,10 +1,14 @@
 
 #include <config.h>
 #include <string.h>
+#include <stdlib.h>
 #include <board.h>
 #include <stdio.h>
 
+#include <drivers/tstamp.h>
+#include <net/dns.h>
 #include <net/ip.h>
+#include <net/ipfrag.h>
 #include <os/messages.h>
 #include <os/timer.h>
 #include <grlib/grlib.h>
@@ -15,12 +19,20 @@
 
 #define PING_COUNT		7
 
+/* Payload repeats the pattern buffer, replies larger than one frame are
+ * reassembled, so the largest size is bound by the reassembly buffer.
+ */
+#define PING_DATA_SIZE	512
+#define PING_MAX_SIZE	(IP_FRAG_MAX_SIZE - 8)
+#define PING_PIECES		((PING_MAX_SIZE + PING_DATA_SIZE - 1) / PING_DATA_SIZE)
+
 typedef struct {
 	unsigned int		ipad;
 	unsigned short		id;
 	unsigned short		seq;
-	unsigned int		timestamp;
-	unsigned int		replytime;
+	unsigned int		timestamp;		/* Request transmit time, timebase ticks */
+	unsigned int		rtt;			/* Round trip time, us */
+	unsigned char		replied;
 	unsigned short		size;
 } ping_t;
 
@@ -32,33 +44,54 @@ static unsigned int		ping_ip;
 static unsigned int		ping_count;
 static unsigned int		ping_sent;
 static unsigned int		ping_received;
+static unsigned short	ping_size;
 
 static char update_flag;
 static char pause;
-static char buf[50], editbuf[30];
+static char buf[50], editbuf[DNS_MAX_NAME], sizebuf[8];
+
+/* Name resolution */
+#define PING_DNS_NONE		0			/* Address was entered */
+#define PING_DNS_RUNNING	1
+#define PING_DNS_DONE		2
+#define PING_DNS_FAILED		3
+
+static unsigned char	ping_dns;
+static int				ping_dnsresult;
+static unsigned int		ping_dnstime;		/* Resolution latency, us */
 
 #define ID_PING_COUNT		101
 #define ID_PING_YLEVEL		102
 #define ID_PING_RLEVEL		103
+#define ID_PING_SIZE		104
 
 static const MenuItem itemsPing[] = {
 	{ID_PING_COUNT, "  ping"},
 	{ID_PING_YLEVEL, " "},
-	{ID_PING_RLEVEL, " "}
+	{ID_PING_RLEVEL, " "},
+	{ID_PING_SIZE, " "}
 };
 static int handlerPing(unsigned int code, MenuItem *item);
+static void icmpPingHandler(ip_frame_hdr *ip, unsigned char *packet, unsigned short size);
 static Menu menuPing = { itemsPing, sizeof(itemsPing) / sizeof(MenuItem), MENU_TYPE_CONFIG, handlerPing };
 
-static const char ping_data[] = "-=* PingTester Ping Data *=- :: -=* PingTester Ping Data *=-";
+static const char ping_text[] = "-=* PingTester Ping Data *=- :: -=* PingTester Ping Data *=-";
+
+/* Kept in RAM, so EMAC may send it without copying */
+static char ping_data[PING_DATA_SIZE];
+
+/* Payload partial checksum, recounted only when ping size changes */
+static unsigned short ping_dsize;
+static uint16 ping_dsum;
 
 /* ===== Private functions ===== */
 
 static void pingSendRequest(unsigned int ipad, unsigned short size)
 {
-	int i;
+	int i, k;
 	unsigned char icmp[8];
-	pktbuf hdr, data;
-	unsigned short checksum;
+	pktbuf hdr, data[PING_PIECES];
+	unsigned short checksum, n;
 	ip_frame_hdr ip;
 
 	/* Find empty space in ping list */
@@ -71,15 +104,15 @@ static void pingSendRequest(unsigned int ipad, unsigned short size)
 		i = PING_COUNT - 1;
 	}
 
-	if (size == 0) size = sizeof(ping_data);
+	if (size == 0) size = sizeof(ping_text);
 
 	/* Fill structure */
 	pinglist[i].ipad = ipad;
 	pinglist[i].id = ping_id;
 	pinglist[i].seq = ++ping_seq;
 	pinglist[i].size = size;
-	pinglist[i].timestamp = AT91C_BASE_RTTC->RTTC_RTVR;
-	pinglist[i].replytime = 0;
+	pinglist[i].rtt = 0;
+	pinglist[i].replied = 0;
 
 	/* ICMP header */
 	icmp[0] = 8;
@@ -92,7 +125,14 @@ static void pingSendRequest(unsigned int ipad, unsigned short size)
 	icmp[7] = ping_seq & 0xFF;
 
 	/* ICMP checksum */
-	checksum = ip_chksum(~ip_chksum(0xFFFF, (unsigned char *)ping_data, size), icmp, 8);
+	if (size != ping_dsize) {
+		ping_dsum = 0;
+		for (n = 0; n < size; n += PING_DATA_SIZE) {
+			ping_dsum = ~ip_chksum(ping_dsum, (unsigned char *)ping_data, (size - n > PING_DATA_SIZE) ? PING_DATA_SIZE : size - n);
+		}
+		ping_dsize = size;
+	}
+	checksum = ip_chksum(ping_dsum, icmp, 8);
 	icmp[2] = checksum >> 8;
 	icmp[3] = checksum & 0xFF;
 
@@ -100,17 +140,26 @@ static void pingSendRequest(unsigned int ipad, unsigned short size)
 	ipFillHeader(&ip, ipGetAddress(), ipad, IP_PROTO_ICMP);
 
 	/* Send Request */
-	hdr.next = &data;
+	hdr.next = data;
 	hdr.data = icmp;
 	hdr.len = 8;
-	data.next = NULL;
-	data.data = (unsigned char *)ping_data;
-	data.len = size;
+	hdr.flags = 0;
+	hdr.tstamp = tsGetTicks();
+	for (k = 0, n = 0; n < size; k++, n += PING_DATA_SIZE) {
+		data[k].next = &data[k+1];
+		data[k].data = (unsigned char *)ping_data;
+		data[k].len = (size - n > PING_DATA_SIZE) ? PING_DATA_SIZE : size - n;
+		data[k].flags = PKT_FLAG_STATIC;
+	}
+	data[k-1].next = NULL;
 	if (!ipSendPacket(&ip, &hdr)) {
 		pinglist[i].ipad = 0;
 		return;
 	}
 
+	/* Time of descriptor hand-off, if frame went to Ethernet */
+	pinglist[i].timestamp = hdr.tstamp;
+
 	ping_sent++;
 }
 
@@ -119,9 +168,13 @@ static void pingStart(unsigned int ipad)
 	/* Clear old ping results */
 	memset(pinglist, 0, sizeof(pinglist));
 
+	/* Replies are routed by the echo identifier */
+	if (ping_ip) icmpUnregisterHandler(IP_PROTO_ICMP, ping_id);
+	ping_id = AT91C_BASE_RTTC->RTTC_RTVR & 0xFFFF;
+	icmpRegisterHandler(IP_PROTO_ICMP, ping_id, icmpPingHandler);
+
 	ping_ip = ipad;
 	ping_count = 2000;
-	ping_id = AT91C_BASE_RTTC->RTTC_RTVR & 0xFFFF;
 	ping_seq = 0;
 
 	ping_sent = 0;
@@ -129,21 +182,59 @@ static void pingStart(unsigned int ipad)
 	pause = 0;
 }
 
+static void pingDnsCallback(int result, unsigned int ipad, unsigned int latency, void *p)
+{
+	ping_dnsresult = result;
+	ping_dnstime = latency;
+	update_flag = 1;
+
+	if (result != DNS_OK) {
+		ping_dns = PING_DNS_FAILED;
+		return;
+	}
+
+	pingStart(ipad);
+	ping_dns = PING_DNS_DONE;
+}
+
 static int pingEditHandler(int type, char *buffer, void *p)
 {
 	unsigned int ip;
 
 	if (type == DLG_OK) {
-		/* Parse IP address */
-		if (!inet_aton((unsigned char *)&ip, buffer)) return 0;
+		/* Parse IP address, host name otherwise */
+		if (inet_aton((unsigned char *)&ip, buffer)) {
+			dnsCancel(pingDnsCallback);
+			ping_dns = PING_DNS_NONE;
+			pingStart(ntohl(ip));
+			return 1;
+		}
 
-		pingStart(ntohl(ip));
+		/* Cached names are answered right away */
+		dnsCancel(pingDnsCallback);
+		ping_dns = PING_DNS_RUNNING;
+		ping_dnsresult = DNS_FAILED;
+		if (!dnsResolve(buffer, pingDnsCallback, NULL)) ping_dns = PING_DNS_FAILED;
 		return 1;
 	}
 
 	return 0;
 }
 
+static int pingSizeHandler(int type, char *buffer, void *p)
+{
+	unsigned int v;
+	char *s;
+
+	if (type != DLG_OK) return 0;
+
+	v = strtoul(buffer, &s, 10);
+	if ( *s || (v > PING_MAX_SIZE) ) return 0;
+
+	ping_size = v ? v : sizeof(ping_text);
+	return 1;
+}
+
 static int handlerPing(unsigned int code, MenuItem *item)
 {
 	if (code == MENU_GET_VALUE) {
@@ -154,10 +245,17 @@ static int handlerPing(unsigned int code, MenuItem *item)
 				return (int) "15 ";
 			case ID_PING_RLEVEL:
 				return (int) "40 ";
+			case ID_PING_SIZE:
+				sprintf(buf, "%u ", ping_size);
+				return (int) buf;
 		}
 	}
 
 	if (code == MENU_ITEM_CLICK) {
+		if (item->id == ID_PING_SIZE) {
+			sprintf(sizebuf, "%u", ping_size);
+			dlgGetString(" , ", sizebuf, 4, pingSizeHandler, NULL);
+		}
 		return 1;
 	}
 
@@ -180,7 +278,8 @@ static void icmpPingHandler(ip_frame_hdr *ip, unsigned char *packet, unsigned sh
 
 	for (i = 0; i < PING_COUNT; i++) {
 		if ( (pinglist[i].ipad == ipad) && (pinglist[i].id == id) && (pinglist[i].seq == seq) ) {
-			pinglist[i].replytime = AT91C_BASE_RTTC->RTTC_RTVR;
+			pinglist[i].rtt = (ifGetRecvStamp() - pinglist[i].timestamp) / TS_TICKS_PER_US;
+			pinglist[i].replied = 1;
 			ping_received++;
 			update_flag = 1;
 		}
@@ -205,6 +304,26 @@ static void pingRedraw(void *window, rect_t *rect)
 
 	if (pause) grTextOut(rect, font, 10, 24, GR_COLOR_RED, "[PAUSED]");
 
+	/* Name resolution */
+	switch (ping_dns) {
+		case PING_DNS_RUNNING:
+			grTextOut(rect, font, 60, 24, GR_COLOR_BLUE, " ...");
+			break;
+		case PING_DNS_DONE:
+			sprintf(buf, "DNS %u.%u ", ping_dnstime / 1000, (ping_dnstime % 1000) / 100);
+			grTextOut(rect, font, 60, 24, GR_COLOR_BLUE, buf);
+			break;
+		case PING_DNS_FAILED:
+			if (ping_dnsresult == DNS_NOTFOUND) {
+				grTextOut(rect, font, 60, 24, GR_COLOR_RED, "  ");
+			} else if (ping_dnsresult == DNS_TIMEDOUT) {
+				grTextOut(rect, font, 60, 24, GR_COLOR_RED, "DNS  ");
+			} else {
+				grTextOut(rect, font, 60, 24, GR_COLOR_RED, " DNS");
+			}
+			break;
+	}
+
 	font = grLoadFont(GR_FONT_NORMAL);
 
 	/* Ping info */
@@ -230,12 +349,17 @@ static void pingRedraw(void *window, rect_t *rect)
 		x = 40 + i * 20;
 		y = 85;
 		/* Ping time */
-		if (pinglist[i].replytime) {
-			/* Time */
-			time = pinglist[i].replytime - pinglist[i].timestamp;
-			sprintf(buf, "%u", time);
+		if (pinglist[i].replied) {
+			/* Time, tenths of ms below 10 ms */
+			time = pinglist[i].rtt;
+			if (time < 10000) {
+				sprintf(buf, "%u.%u", time / 1000, (time % 1000) / 100);
+			} else {
+				sprintf(buf, "%u", time / 1000);
+			}
 			grTextOut(rect, font, x, y + 2, GR_COLOR_BLACK, buf);
-			/* Line */
+			/* Line, sub-ms times are shown as 1 ms */
+			time = (time + 999) / 1000;
 			if (time > 50) time = 50;
 			color = GR_COLOR_GREEN;
 			if (time > 15) color = GR_COLOR_YELLOW;
@@ -252,8 +376,6 @@ static void pingHandler(void *window, unsigned short msgCode, unsigned short msg
 {
 	switch (msgCode) {
 		case MSG_INIT:
-			/* Set icmp packet handler */
-			icmpRegisterHandler(icmpPingHandler);
 			/* Register timers */
 			tmrRegisterTimer(window, 500, 0, 1);		/* Ping timer */
 			tmrRegisterTimer(window, 100, 0, 2);		/* Update timer */
@@ -264,7 +386,8 @@ static void pingHandler(void *window, unsigned short msgCode, unsigned short msg
 			tmrDestroyTimer(window, 1);
 			tmrDestroyTimer(window, 2);
 			/* Unregister icmp packet handler */
-			icmpRegisterHandler(NULL);
+			if (ping_ip) icmpUnregisterHandler(IP_PROTO_ICMP, ping_id);
+			dnsCancel(pingDnsCallback);
 			break;
 
 		case MSG_REDRAW:
@@ -275,7 +398,7 @@ static void pingHandler(void *window, unsigned short msgCode, unsigned short msg
 			if (msgParam == 'C') msgUnregisterWindow(window);
 			if (msgParam == 'M') menuShow(&menuPing, window);
 			if (msgParam == 'R') {
-				dlgGetString(" IP ", editbuf, 20, pingEditHandler, NULL);
+				dlgGetString(" IP   ", editbuf, DNS_MAX_NAME, pingEditHandler, NULL);
 			}
 			if (msgParam == '0') {
 				pause = 1 - pause;
@@ -287,7 +410,7 @@ static void pingHandler(void *window, unsigned short msgCode, unsigned short msg
 			/* Send ping request if any */
 			if ( (msgParam == 1) && ping_count && !pause) {
 				ping_count--;
-				pingSendRequest(ping_ip, 0);
+				pingSendRequest(ping_ip, ping_size);
 			}
 			/* Redraw window if updated */
 			if ( (msgParam == 2) && update_flag) {
@@ -300,9 +423,16 @@ static void pingHandler(void *window, unsigned short msgCode, unsigned short msg
 
 void app_ping()
 {
+	int i;
+
+	/* Payload pattern */
+	for (i = 0; i < PING_DATA_SIZE; i++) ping_data[i] = ping_text[i % (sizeof(ping_text) - 1)];
+	if (!ping_size) ping_size = sizeof(ping_text);
+
 	/* Initial address */
 	sprintf(editbuf, "172.21.96.1");
 	ping_ip = 0;
+	ping_dns = PING_DNS_NONE;
 	ping_count = 0;
 	pause = 0;
 
@@ -0,0 +1,288 @@
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <grlib/grlib.h>
+#include <grlib/dialogs.h>
+#include <grlib/window.h>
+#include <grlib/menus.h>
+#include <net/bridge.h>
+#include <net/ip.h>
+#include <net/trafgen.h>
+#include <net/rfc2544.h>
+#include <os/messages.h>
+#include <os/timer.h>
+
+
+static rfc_config config = { 0, 7, TG_MAX_RATE, 10, RFC_TEST_ALL };
+static rfc_status status;
+static char page;
+static char buf[50], editbuf[30];
+
+#define ID_RFC_DEST			101
+#define ID_RFC_PORT			102
+#define ID_RFC_RATE			103
+#define ID_RFC_DURATION		104
+#define ID_RFC_TESTS		105
+
+static const MenuItem itemsRfc[] = {
+	{ID_RFC_DEST, " "},
+	{ID_RFC_PORT, " UDP"},
+	{ID_RFC_RATE, ", /"},
+	{ID_RFC_DURATION, ", "},
+	{ID_RFC_TESTS, ""}
+};
+static int handlerRfc(unsigned int code, MenuItem *item);
+static Menu menuRfc = { itemsRfc, sizeof(itemsRfc) / sizeof(MenuItem), MENU_TYPE_CONFIG, handlerRfc };
+
+/* Test sets selected by the menu, in order of selection */
+static const unsigned char testSets[] = {
+	RFC_TEST_ALL, RFC_TEST_THROUGHPUT, RFC_TEST_THROUGHPUT | RFC_TEST_LATENCY, RFC_TEST_LOSS, RFC_TEST_BURST
+};
+static const char * const testSetNames[] = {
+	"", " ", " .  ", " ", " "
+};
+
+static const char * const testNames[] = {
+	" ", "", " ", " "
+};
+
+/* ===== Private functions ===== */
+
+static char *rfcFormatDest(char *buffer)
+{
+	unsigned int ip;
+
+	if (!config.dest) return strcpy(buffer, " ");
+
+	ip = htonl(config.dest);
+	return inet_ntoa(buffer, (unsigned char *)&ip);
+}
+
+static int rfcTestSet()
+{
+	int i;
+
+	for (i = 0; i < sizeof(testSets); i++) {
+		if (testSets[i] == config.tests) return i;
+	}
+
+	return 0;
+}
+
+static int rfcEditHandler(int type, char *buffer, void *p)
+{
+	unsigned int ip, v;
+	char *s;
+
+	if (type != DLG_OK) return 0;
+
+	if ((unsigned int)p == ID_RFC_DEST) {
+		if (!inet_aton((unsigned char *)&ip, buffer)) return 0;
+		config.dest = ntohl(ip);
+		return 1;
+	}
+
+	v = strtoul(buffer, &s, 10);
+	if (*s) return 0;
+
+	switch ((unsigned int)p) {
+		case ID_RFC_PORT:
+			if ( (!v) || (v > 65535) ) return 0;
+			config.port = v;
+			return 1;
+		case ID_RFC_RATE:
+			if ( (!v) || (v > TG_MAX_RATE / 1000) ) return 0;
+			config.rate = v * 1000;
+			return 1;
+		case ID_RFC_DURATION:
+			if ( (!v) || (v > 600) ) return 0;
+			config.duration = v;
+			return 1;
+	}
+
+	return 0;
+}
+
+static int handlerRfc(unsigned int code, MenuItem *item)
+{
+	if (code == MENU_GET_VALUE) {
+		switch (item->id) {
+			case ID_RFC_DEST:
+				return (int) rfcFormatDest(buf);
+			case ID_RFC_PORT:
+				sprintf(buf, "%u", config.port);
+				return (int) buf;
+			case ID_RFC_RATE:
+				sprintf(buf, "%u", config.rate / 1000);
+				return (int) buf;
+			case ID_RFC_DURATION:
+				sprintf(buf, "%u", config.duration);
+				return (int) buf;
+			case ID_RFC_TESTS:
+				return (int) testSetNames[rfcTestSet()];
+		}
+	}
+
+	if (code == MENU_ITEM_CLICK) {
+		switch (item->id) {
+			case ID_RFC_DEST:
+				if (config.dest) rfcFormatDest(editbuf); else editbuf[0] = 0;
+				dlgGetString(" ", editbuf, 20, rfcEditHandler, (void *)ID_RFC_DEST);
+				break;
+			case ID_RFC_PORT:
+				sprintf(editbuf, "%u", config.port);
+				dlgGetString(" UDP", editbuf, 5, rfcEditHandler, (void *)ID_RFC_PORT);
+				break;
+			case ID_RFC_RATE:
+				sprintf(editbuf, "%u", config.rate / 1000);
+				dlgGetString(", /", editbuf, 3, rfcEditHandler, (void *)ID_RFC_RATE);
+				break;
+			case ID_RFC_DURATION:
+				sprintf(editbuf, "%u", config.duration);
+				dlgGetString(", ", editbuf, 3, rfcEditHandler, (void *)ID_RFC_DURATION);
+				break;
+			case ID_RFC_TESTS:
+				config.tests = testSets[(rfcTestSet() + 1) % sizeof(testSets)];
+				break;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static int rfcTestIndex(unsigned char test)
+{
+	int i;
+
+	for (i = 0; test > 1; i++) test >>= 1;
+	return i;
+}
+
+static void rfcRedraw(void *window, rect_t *rect)
+{
+	const rfc_result *res;
+	void *font;
+	int i, j, y;
+
+	if (!rect) return;
+
+	wndDrawWindowFrame(window);
+
+	font = grLoadFont(GR_FONT_NORMAL);
+
+	rfcGetStatus(&status);
+	switch (status.state) {
+		case RFC_STATE_IDLE:
+			grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, ":");
+			grTextOut(rect, font, 80, 12, GR_COLOR_BLUE, rfcFormatDest(buf));
+			break;
+		case RFC_STATE_RUNNING:
+			grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, testNames[rfcTestIndex(status.test)]);
+			sprintf(buf, "%u ,  %u, %u.%u /", rfcSizes[status.size], status.trial,
+					status.rate / 1000, (status.rate % 1000) / 100);
+			grTextOut(rect, font, 10, 22, GR_COLOR_BLUE, buf);
+			break;
+		case RFC_STATE_DONE:
+			grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, " ");
+			break;
+		case RFC_STATE_NOARP:
+			grTextOut(rect, font, 10, 12, GR_COLOR_RED, "  ");
+			break;
+		case RFC_STATE_ERROR:
+			grTextOut(rect, font, 10, 12, GR_COLOR_RED, " ");
+			break;
+	}
+
+	/* Results table, '*' marks rates the generator did not reach */
+	font = grLoadFont(GR_FONT_SMALL);
+	res = rfcGetResults();
+	y = 36;
+	if (!page) {
+		grTextOut(rect, font, 4, y, GR_COLOR_BLACK, "  /  RTT,   ");
+		for (i = 0; i < RFC_SIZES; i++) {
+			y += 9;
+			sprintf(buf, "%4u", rfcSizes[i]);
+			grTextOut(rect, font, 4, y, GR_COLOR_BLACK, buf);
+			if (res[i].done & RFC_TEST_THROUGHPUT) {
+				sprintf(buf, "%3u.%u%s", res[i].throughput / 1000, (res[i].throughput % 1000) / 100,
+						(res[i].limited & RFC_TEST_THROUGHPUT) ? "*" : "");
+				grTextOut(rect, font, 30, y, GR_COLOR_BLUE, buf);
+			}
+			if ( (res[i].done & RFC_TEST_LATENCY) && res[i].throughput ) {
+				sprintf(buf, "%u", res[i].rtt_avg);
+				grTextOut(rect, font, 70, y, GR_COLOR_BLUE, buf);
+			}
+			if (res[i].done & RFC_TEST_BURST) {
+				sprintf(buf, "%u%s", res[i].burst, (res[i].limited & RFC_TEST_BURST) ? "*" : "");
+				grTextOut(rect, font, 112, y, GR_COLOR_BLUE, buf);
+			}
+		}
+	} else {
+		/* Frame loss at the first rate steps, percent */
+		grTextOut(rect, font, 4, y, GR_COLOR_BLACK, ", %  100%  90%  80%  70%  60%");
+		for (i = 0; i < RFC_SIZES; i++) {
+			y += 9;
+			sprintf(buf, "%4u", rfcSizes[i]);
+			grTextOut(rect, font, 4, y, GR_COLOR_BLACK, buf);
+			for (j = 0; j < 5; j++) {
+				if (res[i].loss[j] == RFC_LOSS_NONE) continue;
+				sprintf(buf, "%u.%u", res[i].loss[j] / 100, (res[i].loss[j] % 100) / 10);
+				grTextOut(rect, font, 44 + j * 24, y, res[i].loss[j] ? GR_COLOR_RED : GR_COLOR_BLUE, buf);
+			}
+		}
+	}
+
+	wndDrawSoftkey(window, SOFTKEY_LEFT, "Exit");
+	wndDrawSoftkey(window, SOFTKEY_RIGHT, (status.state == RFC_STATE_RUNNING) ? "Stop" : "Start");
+}
+
+static void rfcHandler(void *window, unsigned short msgCode, unsigned short msgParam, void *msgPtr, void *p)
+{
+	switch (msgCode) {
+		case MSG_REDRAW:
+			rfcRedraw(window, (rect_t *)msgPtr);
+			break;
+
+		case MSG_KEY_PRESSED:
+			/* Benchmark keeps running after the window is closed */
+			if (msgParam == 'C') {
+				tmrDestroyTimer(window, 1);
+				msgUnregisterWindow(window);
+			}
+			rfcGetStatus(&status);
+			if ( (msgParam == 'M') && (status.state != RFC_STATE_RUNNING) ) menuShow(&menuRfc, window);
+			if (msgParam == 'R') {
+				if (status.state == RFC_STATE_RUNNING) {
+					rfcStop();
+				} else {
+					rfcStart(&config);
+				}
+				msgInvalidateWindow(window);
+			}
+			/* Switch results page */
+			if (msgParam == '0') {
+				page = !page;
+				msgInvalidateWindow(window);
+			}
+			break;
+
+		case MSG_TIMER:
+			msgInvalidateWindow(window);
+			break;
+	}
+}
+
+void app_rfc2544()
+{
+	void *wnd;
+
+	/* Create window */
+	wnd = msgRegisterWindow("RFC 2544", 0, rfcHandler, NULL);
+	if (!wnd) return;
+
+	/* Create refresh timer */
+	tmrRegisterTimer(wnd, 500, 0, 1);
+}
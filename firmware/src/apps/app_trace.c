@@ -0,0 +1,416 @@
+
+#include <config.h>
+#include <string.h>
+#include <board.h>
+#include <stdio.h>
+
+#include <drivers/tstamp.h>
+#include <net/ip.h>
+#include <os/messages.h>
+#include <os/timer.h>
+#include <grlib/grlib.h>
+#include <grlib/dialogs.h>
+#include <grlib/window.h>
+#include <grlib/menus.h>
+
+
+/* Probes of all hops are sent at once every round, so the trace takes a
+ * few round trips instead of a timeout per hop.
+ */
+#define TRC_MAX_HOPS		21
+#define TRC_PAGE_HOPS		7			/* Hops shown on a page */
+#define TRC_ROUNDS			3			/* Probes per hop */
+#define TRC_ROUND_TIME		10			/* Between rounds, 100 ms ticks */
+#define TRC_TIMEOUT			20			/* Wait for replies after the last round */
+
+#define TRC_UDP_PORT		33434		/* First probe destination port */
+
+/* Probe types */
+#define TRC_MODE_ICMP		0
+#define TRC_MODE_UDP		1
+
+/* Trace states */
+#define TRC_STATE_IDLE		0
+#define TRC_STATE_RUNNING	1
+#define TRC_STATE_DONE		2
+
+typedef struct {
+	unsigned int		ipad;				/* Replying host, 0 - no reply yet */
+	unsigned int		stamp[TRC_ROUNDS];	/* Probe transmit time, timebase ticks */
+	unsigned int		rtt[TRC_ROUNDS];	/* Round trip time, us */
+	unsigned char		sent;				/* Rounds sent, bit mask */
+	unsigned char		replied;			/* Rounds replied, bit mask */
+	unsigned char		unreach;			/* Unreachable code + 1 from the last hop */
+} trc_hop;
+
+static trc_hop hops[TRC_MAX_HOPS];
+
+static unsigned int		trc_dest;
+static unsigned char	trc_mode;
+static unsigned char	trc_state;
+static unsigned short	trc_id;				/* Echo identifier or UDP source port */
+static unsigned char	trc_round;			/* Round being sent */
+static unsigned char	trc_ticks;			/* Ticks since the round start */
+static unsigned char	trc_hopcount;		/* Hops to the destination */
+
+static unsigned char page;
+static char buf[50], editbuf[30];
+
+#define ID_TRC_DEST			101
+#define ID_TRC_MODE			102
+
+static const MenuItem itemsTrace[] = {
+	{ID_TRC_DEST, " "},
+	{ID_TRC_MODE, ""}
+};
+static int handlerTrace(unsigned int code, MenuItem *item);
+static Menu menuTrace = { itemsTrace, sizeof(itemsTrace) / sizeof(MenuItem), MENU_TYPE_CONFIG, handlerTrace };
+
+static void icmpTraceHandler(ip_frame_hdr *ip, unsigned char *packet, unsigned short size);
+
+/* ===== Private functions ===== */
+
+/* trcSendProbe()
+ *   Sends probe of the round with given TTL, returns 0 if it was dropped
+ */
+static int trcSendProbe(unsigned char ttl, unsigned char round)
+{
+	unsigned char icmp[8];
+	unsigned short seq, checksum;
+	ip_frame_hdr ip;
+	pktbuf pkt;
+	trc_hop *hop;
+	int ok;
+
+	hop = &hops[ttl - 1];
+
+	ipFillHeader(&ip, ipGetAddress(), trc_dest, IP_PROTO_ICMP);
+	ip.ttl = ttl;
+
+	if (trc_mode == TRC_MODE_ICMP) {
+		/* Echo request, sequence carries round and TTL */
+		seq = (round << 8) | ttl;
+		icmp[0] = ICMP_ECHO;
+		icmp[1] = 0;
+		icmp[2] = 0;
+		icmp[3] = 0;
+		icmp[4] = trc_id >> 8;
+		icmp[5] = trc_id & 0xFF;
+		icmp[6] = seq >> 8;
+		icmp[7] = seq & 0xFF;
+		checksum = ip_chksum(0, icmp, 8);
+		icmp[2] = checksum >> 8;
+		icmp[3] = checksum & 0xFF;
+
+		pkt.next = NULL;
+		pkt.data = icmp;
+		pkt.len = 8;
+		pkt.flags = 0;
+		pkt.tstamp = tsGetTicks();
+		ok = ipSendPacket(&ip, &pkt);
+	} else {
+		/* Empty datagram, destination port carries round and TTL. Empty
+		 * buffer only takes the transmit stamp. */
+		pkt.next = NULL;
+		pkt.data = icmp;
+		pkt.len = 0;
+		pkt.flags = 0;
+		pkt.tstamp = tsGetTicks();
+		ok = udpSendPacket(&ip, trc_id, TRC_UDP_PORT + round * TRC_MAX_HOPS + ttl - 1, &pkt);
+	}
+
+	/* Time of descriptor hand-off, as probes queue behind each other */
+	if (ok) {
+		hop->stamp[round] = pkt.tstamp;
+		hop->sent |= 1 << round;
+	}
+
+	return ok;
+}
+
+static void trcStart(unsigned int ipad)
+{
+	unsigned int id;
+
+	/* Replies are routed by the echo identifier or by the source port */
+	if (trc_state == TRC_STATE_RUNNING) icmpUnregisterHandler(trc_mode ? IP_PROTO_UDP : IP_PROTO_ICMP, trc_id);
+
+	memset(hops, 0, sizeof(hops));
+	id = AT91C_BASE_RTTC->RTTC_RTVR;
+	trc_id = (trc_mode == TRC_MODE_ICMP) ? (id & 0xFFFF) : (32768 + (id & 0x7FFF));
+	icmpRegisterHandler(trc_mode ? IP_PROTO_UDP : IP_PROTO_ICMP, trc_id, icmpTraceHandler);
+
+	trc_dest = ipad;
+	trc_round = 0;
+	trc_ticks = 0;
+	trc_hopcount = TRC_MAX_HOPS;
+	trc_state = TRC_STATE_RUNNING;
+	page = 0;
+}
+
+static void trcStop()
+{
+	if (trc_state != TRC_STATE_RUNNING) return;
+
+	icmpUnregisterHandler(trc_mode ? IP_PROTO_UDP : IP_PROTO_ICMP, trc_id);
+	trc_state = TRC_STATE_DONE;
+}
+
+/* trcSendPending()
+ *   Sends probes of the rounds started. Probes are sent up to the first
+ * drop, the rest wait for the next tick.
+ */
+static void trcSendPending()
+{
+	unsigned char ttl, round;
+
+	for (round = 0; round <= trc_round; round++) {
+		for (ttl = 1; ttl <= trc_hopcount; ttl++) {
+			if (hops[ttl - 1].sent & (1 << round)) continue;
+			if (!trcSendProbe(ttl, round)) return;
+		}
+	}
+}
+
+/* trcPoll()
+ *   Sends probes and moves to the next round, called every 100 ms.
+ * Returns 1 if the window should be redrawn.
+ */
+static int trcPoll()
+{
+	unsigned char ttl, all;
+
+	if (trc_state != TRC_STATE_RUNNING) return 0;
+
+	trcSendPending();
+
+	/* Done when every probe is answered or the last one timed out */
+	all = (1 << TRC_ROUNDS) - 1;
+	for (ttl = 1; ttl <= trc_hopcount; ttl++) {
+		if (hops[ttl - 1].replied != all) break;
+	}
+	trc_ticks++;
+	if ( (ttl > trc_hopcount) || ((trc_round == TRC_ROUNDS - 1) && (trc_ticks >= TRC_TIMEOUT)) ) {
+		trcStop();
+		return 1;
+	}
+
+	if ( (trc_round < TRC_ROUNDS - 1) && (trc_ticks >= TRC_ROUND_TIME) ) {
+		trc_round++;
+		trc_ticks = 0;
+	}
+
+	return 0;
+}
+
+static int trcEditHandler(int type, char *buffer, void *p)
+{
+	unsigned int ip;
+
+	if (type == DLG_OK) {
+		/* Parse IP address */
+		if (!inet_aton((unsigned char *)&ip, buffer)) return 0;
+
+		/* Menu only sets the address */
+		if ((unsigned int)p == ID_TRC_DEST) {
+			if (trc_state != TRC_STATE_RUNNING) trc_dest = ntohl(ip);
+		} else {
+			trcStart(ntohl(ip));
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static int handlerTrace(unsigned int code, MenuItem *item)
+{
+	if (code == MENU_GET_VALUE) {
+		switch (item->id) {
+			case ID_TRC_DEST:
+				if (!trc_dest) return (int) " ";
+				return (int) editbuf;
+			case ID_TRC_MODE:
+				return (int) ((trc_mode == TRC_MODE_ICMP) ? "ICMP" : "UDP");
+		}
+	}
+
+	if (code == MENU_ITEM_CLICK) {
+		switch (item->id) {
+			case ID_TRC_DEST:
+				dlgGetString(" IP ", editbuf, 20, trcEditHandler, (void *)ID_TRC_DEST);
+				break;
+			case ID_TRC_MODE:
+				if (trc_state != TRC_STATE_RUNNING) trc_mode = 1 - trc_mode;
+				break;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static void icmpTraceHandler(ip_frame_hdr *ip, unsigned char *packet, unsigned short size)
+{
+	ip_frame_hdr *orig;
+	unsigned char *data;
+	unsigned int n;
+	unsigned char ttl, round;
+	trc_hop *hop;
+
+	if (trc_state != TRC_STATE_RUNNING) return;
+
+	/* Find probe, errors carry its header */
+	if (packet[0] == ICMP_ECHO_REPLY) {
+		n = (packet[6] << 8) | packet[7];
+	} else {
+		orig = (ip_frame_hdr *)&packet[8];
+		if (ntohl(orig->dest_addr) != trc_dest) return;
+		data = IP_DATA(orig);
+		if (trc_mode == TRC_MODE_ICMP) {
+			n = (data[6] << 8) | data[7];
+		} else {
+			n = ((data[2] << 8) | data[3]) - TRC_UDP_PORT;
+			if (n >= TRC_ROUNDS * TRC_MAX_HOPS) return;
+			n = ((n / TRC_MAX_HOPS) << 8) | ((n % TRC_MAX_HOPS) + 1);
+		}
+	}
+	round = n >> 8;
+	ttl = n & 0xFF;
+	if ( (round >= TRC_ROUNDS) || (ttl < 1) || (ttl > TRC_MAX_HOPS) ) return;
+
+	hop = &hops[ttl - 1];
+	if ( !(hop->sent & (1 << round)) || (hop->replied & (1 << round)) ) return;
+
+	hop->ipad = ntohl(ip->source_addr);
+	hop->rtt[round] = (ifGetRecvStamp() - hop->stamp[round]) / TS_TICKS_PER_US;
+	hop->replied |= 1 << round;
+
+	/* Destination or a router refusing to forward ends the path */
+	if ( (packet[0] == ICMP_ECHO_REPLY) || (packet[0] == ICMP_DEST_UNREACH) ) {
+		if ( (packet[0] == ICMP_DEST_UNREACH) && (hop->ipad != trc_dest) ) hop->unreach = packet[1] + 1;
+		if (ttl < trc_hopcount) trc_hopcount = ttl;
+	}
+}
+
+static void trcRedraw(void *window, rect_t *rect)
+{
+	trc_hop *hop;
+	void *font;
+	int i, r, y, time;
+	unsigned int ip;
+
+	if (!rect) return;
+
+	/* Window frame */
+	wndDrawWindowFrame(window);
+	wndDrawSoftkey(window, SOFTKEY_LEFT, "Exit");
+	wndDrawSoftkey(window, SOFTKEY_RIGHT, "Trace");
+
+	font = grLoadFont(GR_FONT_NORMAL);
+
+	/* Trace info */
+	grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, "IP :");
+	if (trc_dest) {
+		ip = htonl(trc_dest);
+		grTextOut(rect, font, 60, 12, GR_COLOR_BLUE, inet_ntoa(buf, (unsigned char *)&ip));
+	} else {
+		grTextOut(rect, font, 60, 12, GR_COLOR_BLUE, " ");
+	}
+	if (trc_state == TRC_STATE_RUNNING) grTextOut(rect, font, 10, 22, GR_COLOR_RED, "...");
+	if ( (trc_state == TRC_STATE_DONE) && !hops[0].sent ) grTextOut(rect, font, 10, 22, GR_COLOR_RED, "  ");
+
+	/* Hops, round trip times in ms */
+	font = grLoadFont(GR_FONT_SMALL);
+	y = 36;
+	grTextOut(rect, font, 4, y, GR_COLOR_BLACK, "            , ");
+	for (i = page * TRC_PAGE_HOPS; (i < (page + 1) * TRC_PAGE_HOPS) && (i < trc_hopcount); i++) {
+		hop = &hops[i];
+		if (!hop->sent) break;
+		y += 9;
+
+		sprintf(buf, "%u", i + 1);
+		grTextOut(rect, font, 4, y, GR_COLOR_BLACK, buf);
+		if (hop->ipad) {
+			ip = htonl(hop->ipad);
+			inet_ntoa(buf, (unsigned char *)&ip);
+			if (hop->unreach) strcat(buf, " !");
+			grTextOut(rect, font, 20, y, hop->unreach ? GR_COLOR_RED : GR_COLOR_BLUE, buf);
+		}
+
+		for (r = 0; r < TRC_ROUNDS; r++) {
+			if (hop->replied & (1 << r)) {
+				/* Tenths of ms below 10 ms */
+				time = hop->rtt[r];
+				if (time < 10000) {
+					sprintf(buf, "%u.%u", time / 1000, (time % 1000) / 100);
+				} else {
+					sprintf(buf, "%u", time / 1000);
+				}
+				grTextOut(rect, font, 90 + r * 24, y, GR_COLOR_BLACK, buf);
+			} else if (hop->sent & (1 << r)) {
+				grTextOut(rect, font, 90 + r * 24, y, GR_COLOR_RED, "*");
+			}
+		}
+	}
+}
+
+static void traceHandler(void *window, unsigned short msgCode, unsigned short msgParam, void *msgPtr, void *p)
+{
+	switch (msgCode) {
+		case MSG_INIT:
+			/* Register timers */
+			tmrRegisterTimer(window, 100, 0, 1);		/* Probe timer */
+			tmrRegisterTimer(window, 500, 0, 2);		/* Update timer */
+			break;
+
+		case MSG_DESTROY:
+			/* Destroy timers */
+			tmrDestroyTimer(window, 1);
+			tmrDestroyTimer(window, 2);
+			/* Unregister icmp packet handler */
+			trcStop();
+			break;
+
+		case MSG_REDRAW:
+			trcRedraw(window, (rect_t *)msgPtr);
+			break;
+
+		case MSG_KEY_PRESSED:
+			if (msgParam == 'C') msgUnregisterWindow(window);
+			if (msgParam == 'M') menuShow(&menuTrace, window);
+			if (msgParam == 'R') {
+				if (trc_state == TRC_STATE_RUNNING) {
+					trcStop();
+					msgInvalidateWindow(window);
+				} else {
+					dlgGetString(" IP ", editbuf, 20, trcEditHandler, NULL);
+				}
+			}
+			/* Next hops page */
+			if (msgParam == '0') {
+				page = (page + 1) % ((TRC_MAX_HOPS + TRC_PAGE_HOPS - 1) / TRC_PAGE_HOPS);
+				if (page * TRC_PAGE_HOPS >= trc_hopcount) page = 0;
+				msgInvalidateWindow(window);
+			}
+			break;
+
+		case MSG_TIMER:
+			if ( (msgParam == 1) && trcPoll() ) msgInvalidateWindow(window);
+			if ( (msgParam == 2) && (trc_state == TRC_STATE_RUNNING) ) msgInvalidateWindow(window);
+			break;
+	}
+}
+
+void app_trace()
+{
+	/* Initial address */
+	sprintf(editbuf, "172.21.96.1");
+	trc_dest = 0;
+	trc_state = TRC_STATE_IDLE;
+	trc_hopcount = 0;
+	page = 0;
+
+	/* Create window */
+	msgRegisterWindow("", 0, traceHandler, NULL);
+}
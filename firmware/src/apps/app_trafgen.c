@@ -0,0 +1,228 @@
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <grlib/grlib.h>
+#include <grlib/dialogs.h>
+#include <grlib/window.h>
+#include <grlib/menus.h>
+#include <net/bridge.h>
+#include <net/ip.h>
+#include <net/trafgen.h>
+#include <os/messages.h>
+#include <os/timer.h>
+
+
+static tg_config config = { 0, TG_DEST_PORT, TG_MAX_SIZE, TG_MAX_RATE, 0 };
+static tg_stats stats;
+static char buf[50], editbuf[30];
+
+#define ID_TG_DEST			101
+#define ID_TG_SIZE			102
+#define ID_TG_RATE			103
+#define ID_TG_COUNT			104
+
+static const MenuItem itemsTrafgen[] = {
+	{ID_TG_DEST, " "},
+	{ID_TG_SIZE, " "},
+	{ID_TG_RATE, ", /"},
+	{ID_TG_COUNT, " "}
+};
+static int handlerTrafgen(unsigned int code, MenuItem *item);
+static Menu menuTrafgen = { itemsTrafgen, sizeof(itemsTrafgen) / sizeof(MenuItem), MENU_TYPE_CONFIG, handlerTrafgen };
+
+/* ===== Private functions ===== */
+
+static char *tgFormatDest(char *buffer)
+{
+	unsigned int ip;
+
+	if (!config.dest) return strcpy(buffer, " ");
+
+	ip = htonl(config.dest);
+	return inet_ntoa(buffer, (unsigned char *)&ip);
+}
+
+static int tgEditHandler(int type, char *buffer, void *p)
+{
+	unsigned int ip, v;
+	char *s;
+
+	if (type != DLG_OK) return 0;
+
+	if ((unsigned int)p == ID_TG_DEST) {
+		if (!inet_aton((unsigned char *)&ip, buffer)) return 0;
+		config.dest = ntohl(ip);
+		return 1;
+	}
+
+	v = strtoul(buffer, &s, 10);
+	if (*s) return 0;
+
+	switch ((unsigned int)p) {
+		case ID_TG_SIZE:
+			if ( (v < TG_MIN_SIZE) || (v > TG_MAX_SIZE) ) return 0;
+			config.size = v;
+			return 1;
+		case ID_TG_RATE:
+			if ( (!v) || (v > TG_MAX_RATE / 1000) ) return 0;
+			config.rate = v * 1000;
+			return 1;
+		case ID_TG_COUNT:
+			config.count = v;
+			return 1;
+	}
+
+	return 0;
+}
+
+static int handlerTrafgen(unsigned int code, MenuItem *item)
+{
+	if (code == MENU_GET_VALUE) {
+		switch (item->id) {
+			case ID_TG_DEST:
+				return (int) tgFormatDest(buf);
+			case ID_TG_SIZE:
+				sprintf(buf, "%u ", config.size);
+				return (int) buf;
+			case ID_TG_RATE:
+				sprintf(buf, "%u", config.rate / 1000);
+				return (int) buf;
+			case ID_TG_COUNT:
+				if (!config.count) return (int) " ";
+				sprintf(buf, "%u", (unsigned int)config.count);
+				return (int) buf;
+		}
+	}
+
+	if (code == MENU_ITEM_CLICK) {
+		switch (item->id) {
+			case ID_TG_DEST:
+				if (config.dest) tgFormatDest(editbuf); else editbuf[0] = 0;
+				dlgGetString(" ", editbuf, 20, tgEditHandler, (void *)ID_TG_DEST);
+				break;
+			case ID_TG_SIZE:
+				sprintf(editbuf, "%u", config.size);
+				dlgGetString(" ", editbuf, 4, tgEditHandler, (void *)ID_TG_SIZE);
+				break;
+			case ID_TG_RATE:
+				sprintf(editbuf, "%u", config.rate / 1000);
+				dlgGetString(", /", editbuf, 3, tgEditHandler, (void *)ID_TG_RATE);
+				break;
+			case ID_TG_COUNT:
+				sprintf(editbuf, "%u", (unsigned int)config.count);
+				dlgGetString(" ", editbuf, 9, tgEditHandler, (void *)ID_TG_COUNT);
+				break;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static void tgRedraw(void *window, rect_t *rect)
+{
+	void *font;
+	unsigned int rate;
+
+	if (!rect) return;
+
+	wndDrawWindowFrame(window);
+
+	font = grLoadFont(GR_FONT_NORMAL);
+
+	tgGetStats(0, &stats);
+	switch (stats.state) {
+		case TG_STATE_IDLE:
+			grTextOut(rect, font, 10, 20, GR_COLOR_BLACK, " ''");
+			break;
+		case TG_STATE_ARP:
+			grTextOut(rect, font, 10, 20, GR_COLOR_BLACK, " ...");
+			break;
+		case TG_STATE_RUNNING:
+			grTextOut(rect, font, 10, 20, GR_COLOR_BLACK, " ...");
+			break;
+		case TG_STATE_DONE:
+			grTextOut(rect, font, 10, 20, GR_COLOR_BLACK, " ");
+			break;
+		case TG_STATE_NOARP:
+			grTextOut(rect, font, 10, 20, GR_COLOR_RED, "  ");
+			break;
+	}
+
+	/* Settings */
+	grTextOut(rect, font, 10, 35, GR_COLOR_BLACK, ":");
+	grTextOut(rect, font, 90, 35, GR_COLOR_BLUE, tgFormatDest(buf));
+	grTextOut(rect, font, 10, 47, GR_COLOR_BLACK, ":");
+	sprintf(buf, "%u , %u /", config.size, config.rate / 1000);
+	grTextOut(rect, font, 90, 47, GR_COLOR_BLUE, buf);
+
+	/* Frames sent and achieved line rate */
+	grTextOut(rect, font, 10, 62, GR_COLOR_BLACK, ":");
+	/* sprintf does not support 64-bit values */
+	if (stats.frames >= 1000000000)
+		sprintf(buf, "%u%09u", (unsigned int)(stats.frames / 1000000000), (unsigned int)(stats.frames % 1000000000));
+	else
+		sprintf(buf, "%u", (unsigned int)stats.frames);
+	grTextOut(rect, font, 90, 62, GR_COLOR_BLUE, buf);
+	grTextOut(rect, font, 10, 74, GR_COLOR_BLACK, ":");
+	rate = 0;
+	if (stats.elapsed) rate = (stats.bytes + stats.frames * TG_WIRE_OVERHEAD) * 8 / stats.elapsed;
+	sprintf(buf, "%u.%u /", rate / 1000, (rate % 1000) / 100);
+	grTextOut(rect, font, 90, 74, GR_COLOR_BLUE, buf);
+	/* TX ring full and pacing resets */
+	grTextOut(rect, font, 10, 86, GR_COLOR_BLACK, ":");
+	sprintf(buf, "%u / %u", stats.full, stats.late);
+	grTextOut(rect, font, 90, 86, (stats.late) ? GR_COLOR_RED : GR_COLOR_BLUE, buf);
+
+	wndDrawSoftkey(window, SOFTKEY_LEFT, "Exit");
+	wndDrawSoftkey(window, SOFTKEY_RIGHT,
+				   ( (stats.state == TG_STATE_RUNNING) || (stats.state == TG_STATE_ARP) ) ? "Stop" : "Start");
+}
+
+static void tgHandler(void *window, unsigned short msgCode, unsigned short msgParam, void *msgPtr, void *p)
+{
+	switch (msgCode) {
+		case MSG_REDRAW:
+			tgRedraw(window, (rect_t *)msgPtr);
+			break;
+
+		case MSG_KEY_PRESSED:
+			if (msgParam == 'C') {
+				tgStop();
+				tmrDestroyTimer(window, 1);
+				msgUnregisterWindow(window);
+			}
+			if (msgParam == 'M') {
+				tgGetStats(0, &stats);
+				if ( (stats.state != TG_STATE_RUNNING) && (stats.state != TG_STATE_ARP) ) menuShow(&menuTrafgen, window);
+			}
+			if (msgParam == 'R') {
+				tgGetStats(0, &stats);
+				if ( (stats.state == TG_STATE_RUNNING) || (stats.state == TG_STATE_ARP) ) {
+					tgStop();
+				} else {
+					tgStart(&config, 1);
+				}
+				msgInvalidateWindow(window);
+			}
+			break;
+
+		case MSG_TIMER:
+			msgInvalidateWindow(window);
+			break;
+	}
+}
+
+void app_trafgen()
+{
+	void *wnd;
+
+	/* Create window */
+	wnd = msgRegisterWindow(" ", 0, tgHandler, NULL);
+	if (!wnd) return;
+
+	/* Create refresh timer */
+	tmrRegisterTimer(wnd, 500, 0, 1);
+}
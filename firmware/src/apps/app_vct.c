@@ -19,32 +19,61 @@ static char state;
 static unsigned short save_r0;
 static unsigned short reg0;
 static unsigned short reg1;
+static char pending;
+static void *vct_window;
 static char buf[50];
 
 
+static void vctSaveReg0(unsigned char reg, unsigned short val, void *arg)
+{
+	save_r0 = val;
+}
+
 static void vctInit()
 {
 	/* Save Reg0, Force 100mbit */
-	save_r0 = EthPHYRead(0);
-	EthPHYWrite(0, 0xA100);
+	EthPHYReadAsync(0, vctSaveReg0, NULL);
+	EthPHYWriteAsync(0, 0xA100, NULL, NULL);
 
 	/* Enable workaround */
-	EthPHYWrite(29, 0x000C);
-	EthPHYWrite(30, 0x4100);
-	EthPHYWrite(29, 0x000F);
-	EthPHYWrite(30, 0x9893);
+	EthPHYWriteAsync(29, 0x000C, NULL, NULL);
+	EthPHYWriteAsync(30, 0x4100, NULL, NULL);
+	EthPHYWriteAsync(29, 0x000F, NULL, NULL);
+	EthPHYWriteAsync(30, 0x9893, NULL, NULL);
 }
 
 static void vctDone()
 {
 	/* Undo workaround */
-	EthPHYWrite(29, 0x000C);
-	EthPHYWrite(30, 0x0000);
-	EthPHYWrite(29, 0x000F);
-	EthPHYWrite(30, 0x9899);
+	EthPHYWriteAsync(29, 0x000C, NULL, NULL);
+	EthPHYWriteAsync(30, 0x0000, NULL, NULL);
+	EthPHYWriteAsync(29, 0x000F, NULL, NULL);
+	EthPHYWriteAsync(30, 0x9899, NULL, NULL);
 
 	/* Restore Reg0 */
-	EthPHYWrite(0, 0x8000 | save_r0);
+	EthPHYWriteAsync(0, 0x8000 | save_r0, NULL, NULL);
+}
+
+/* vctStatus()
+ *   Handles VCT status registers read, 26 is read first
+ */
+static void vctStatus(unsigned char reg, unsigned short val, void *arg)
+{
+	if (reg == 26) {
+		reg0 = val;
+		return;
+	}
+
+	reg1 = val;
+	pending = 0;
+
+	/* Window is closed or test restarted */
+	if ( !vct_window || (state != VCT_STATE_TESTING) ) return;
+
+	if ( !(reg0 & 0x8000) ) {
+		state = VCT_STATE_READY;
+		msgInvalidateWindow(vct_window);
+	}
 }
 
 static void vctResult(char *str, unsigned short reg)
@@ -128,25 +157,22 @@ static void vctHandler(void *window, unsigned short msgCode, unsigned short msgP
 
 		case MSG_KEY_PRESSED:
 			if (msgParam == 'C') {
+				vct_window = NULL;
 				vctDone();
 				tmrDestroyTimer(window, 1);
 				msgUnregisterWindow(window);
 			}
 			if (msgParam == 'R') {
-				EthPHYWrite(26, 0x8000);
+				EthPHYWriteAsync(26, 0x8000, NULL, NULL);
 				state = VCT_STATE_TESTING;
 				msgInvalidateWindow(window);
 			}
 			break;
 
 		case MSG_TIMER:
-			if (state == VCT_STATE_TESTING) {
-				reg0 = EthPHYRead(26);
-				reg1 = EthPHYRead(27);
-				if ( !(reg0 & 0x8000) ) {
-					state = VCT_STATE_READY;
-					msgInvalidateWindow(window);
-				}
+			if ( (state == VCT_STATE_TESTING) && !pending ) {
+				pending = 1;
+				if ( !EthPHYReadAsync(26, vctStatus, NULL) || !EthPHYReadAsync(27, vctStatus, NULL) ) pending = 0;
 			}
 			break;
 	}
@@ -157,11 +183,13 @@ void app_vct()
 	void *wnd;
 
 	state = VCT_STATE_IDLE;
+	pending = 0;
 	vctInit();
 
 	/* Create window */
 	wnd = msgRegisterWindow("Virtual Cable Tester", 0, vctHandler, NULL);
 	if (!wnd) return;
+	vct_window = wnd;
 
 	/* Create refresh timer */
 	tmrRegisterTimer(wnd, 500, 0, 1);
@@ -0,0 +1,385 @@
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <grlib/grlib.h>
+#include <grlib/dialogs.h>
+#include <grlib/window.h>
+#include <grlib/menus.h>
+#include <net/bridge.h>
+#include <net/ip.h>
+#include <net/y1564.h>
+#include <os/messages.h>
+#include <os/timer.h>
+
+
+/* 512-byte frames at 10 Mbit/s, 10 ms delay, 5 ms variation, 0.1% loss */
+#define DEFAULT_SERVICE(enabled)	{ enabled, 0, 512, 10000, 0, 10000, 5000, 10 }
+
+static sat_config config = {
+	0, 7, 5, 1, { DEFAULT_SERVICE(1), DEFAULT_SERVICE(0), DEFAULT_SERVICE(0), DEFAULT_SERVICE(0) }
+};
+static sat_status status;
+static unsigned char service;		/* Service edited in the menu */
+static unsigned char page;			/* 0 - summary, service details otherwise */
+static char buf[50], editbuf[30];
+
+#define ID_SAT_DEST			101
+#define ID_SAT_PORT			102
+#define ID_SAT_STEPTIME		103
+#define ID_SAT_PERFTIME		104
+#define ID_SAT_SERVICE		105
+#define ID_SAT_ENABLED		106
+#define ID_SAT_SIZE			107
+#define ID_SAT_DSCP			108
+#define ID_SAT_CIR			109
+#define ID_SAT_EIR			110
+#define ID_SAT_FTD			111
+#define ID_SAT_FDV			112
+#define ID_SAT_FLR			113
+
+static const MenuItem itemsSat[] = {
+	{ID_SAT_DEST, " "},
+	{ID_SAT_PORT, " UDP"},
+	{ID_SAT_STEPTIME, " , "},
+	{ID_SAT_PERFTIME, " ., "},
+	{ID_SAT_SERVICE, ""},
+	{ID_SAT_ENABLED, "  "},
+	{ID_SAT_SIZE, "   "},
+	{ID_SAT_DSCP, "  DSCP"},
+	{ID_SAT_CIR, "  CIR, /"},
+	{ID_SAT_EIR, "  EIR, /"},
+	{ID_SAT_FTD, "  , "},
+	{ID_SAT_FDV, "  , "},
+	{ID_SAT_FLR, "  , %"}
+};
+static int handlerSat(unsigned int code, MenuItem *item);
+static Menu menuSat = { itemsSat, sizeof(itemsSat) / sizeof(MenuItem), MENU_TYPE_CONFIG, handlerSat };
+
+static const char * const stepNames[SAT_STEPS] = {
+	"25% CIR", "50% CIR", "75% CIR", "CIR", "CIR+EIR", ""
+};
+
+/* ===== Private functions ===== */
+
+/* parseFixed()
+ *   Parses decimal number with optional fraction, scaled by 10, 100 or
+ * 1000. Returns 0 on error.
+ */
+static int parseFixed(char *buffer, unsigned int scale, unsigned int *value)
+{
+	unsigned int v, unit;
+	char *s;
+
+	v = strtoul(buffer, &s, 10) * scale;
+	if (*s == '.') {
+		for (s++, unit = scale / 10; (*s >= '0') && (*s <= '9'); s++, unit /= 10) v += (*s - '0') * unit;
+	}
+
+	*value = v;
+	return (*s == 0) && (s != buffer);
+}
+
+/* formatFixed()
+ *   Prints value scaled by 1000 with one decimal, or by 100 with two
+ */
+static char *formatFixed(char *buffer, unsigned int value, unsigned int scale)
+{
+	if (scale == 100) {
+		sprintf(buffer, "%u.%02u", value / 100, value % 100);
+	} else {
+		sprintf(buffer, "%u.%u", value / 1000, (value % 1000) / 100);
+	}
+	return buffer;
+}
+
+static char *satFormatDest(char *buffer)
+{
+	unsigned int ip;
+
+	if (!config.dest) return strcpy(buffer, " ");
+
+	ip = htonl(config.dest);
+	return inet_ntoa(buffer, (unsigned char *)&ip);
+}
+
+static int satEditHandler(int type, char *buffer, void *p)
+{
+	sat_service *sv;
+	unsigned int ip, v;
+
+	if (type != DLG_OK) return 0;
+
+	sv = &config.service[service];
+
+	switch ((unsigned int)p) {
+		case ID_SAT_DEST:
+			if (!inet_aton((unsigned char *)&ip, buffer)) return 0;
+			config.dest = ntohl(ip);
+			return 1;
+		case ID_SAT_CIR:
+			if ( (!parseFixed(buffer, 1000, &v)) || (v < 4) || (v > TG_MAX_RATE) ) return 0;
+			sv->cir = v;
+			return 1;
+		case ID_SAT_EIR:
+			if ( (!parseFixed(buffer, 1000, &v)) || (v > TG_MAX_RATE) ) return 0;
+			sv->eir = v;
+			return 1;
+		case ID_SAT_FTD:
+			if (!parseFixed(buffer, 1000, &v)) return 0;
+			sv->ftd = v;
+			return 1;
+		case ID_SAT_FDV:
+			if (!parseFixed(buffer, 1000, &v)) return 0;
+			sv->fdv = v;
+			return 1;
+		case ID_SAT_FLR:
+			if ( (!parseFixed(buffer, 100, &v)) || (v > 10000) ) return 0;
+			sv->flr = v;
+			return 1;
+	}
+
+	/* Integer values */
+	if (!parseFixed(buffer, 1, &v)) return 0;
+
+	switch ((unsigned int)p) {
+		case ID_SAT_PORT:
+			if ( (!v) || (v > 65535) ) return 0;
+			config.port = v;
+			return 1;
+		case ID_SAT_STEPTIME:
+			if ( (!v) || (v > 600) ) return 0;
+			config.steptime = v;
+			return 1;
+		case ID_SAT_PERFTIME:
+			if (v > 1440) return 0;
+			config.perftime = v;
+			return 1;
+		case ID_SAT_SIZE:
+			if ( (v < TG_MIN_SIZE) || (v > TG_MAX_SIZE) ) return 0;
+			sv->size = v;
+			return 1;
+		case ID_SAT_DSCP:
+			if (v > 63) return 0;
+			sv->dscp = v;
+			return 1;
+	}
+
+	return 0;
+}
+
+static int handlerSat(unsigned int code, MenuItem *item)
+{
+	sat_service *sv;
+
+	sv = &config.service[service];
+
+	if (code == MENU_GET_VALUE) {
+		switch (item->id) {
+			case ID_SAT_DEST:
+				return (int) satFormatDest(buf);
+			case ID_SAT_PORT:
+				sprintf(buf, "%u", config.port);
+				return (int) buf;
+			case ID_SAT_STEPTIME:
+				sprintf(buf, "%u", config.steptime);
+				return (int) buf;
+			case ID_SAT_PERFTIME:
+				if (!config.perftime) return (int) "";
+				sprintf(buf, "%u", config.perftime);
+				return (int) buf;
+			case ID_SAT_SERVICE:
+				sprintf(buf, "%u", service + 1);
+				return (int) buf;
+			case ID_SAT_ENABLED:
+				return (int) (sv->enabled ? "" : "");
+			case ID_SAT_SIZE:
+				sprintf(buf, "%u", sv->size);
+				return (int) buf;
+			case ID_SAT_DSCP:
+				sprintf(buf, "%u", sv->dscp);
+				return (int) buf;
+			case ID_SAT_CIR:
+				return (int) formatFixed(buf, sv->cir, 1000);
+			case ID_SAT_EIR:
+				return (int) formatFixed(buf, sv->eir, 1000);
+			case ID_SAT_FTD:
+				return (int) formatFixed(buf, sv->ftd, 1000);
+			case ID_SAT_FDV:
+				return (int) formatFixed(buf, sv->fdv, 1000);
+			case ID_SAT_FLR:
+				return (int) formatFixed(buf, sv->flr, 100);
+		}
+	}
+
+	if (code == MENU_ITEM_CLICK) {
+		switch (item->id) {
+			case ID_SAT_DEST:
+				if (config.dest) satFormatDest(editbuf); else editbuf[0] = 0;
+				dlgGetString(" ", editbuf, 20, satEditHandler, (void *)ID_SAT_DEST);
+				break;
+			case ID_SAT_SERVICE:
+				service = (service + 1) % SAT_MAX_SERVICES;
+				break;
+			case ID_SAT_ENABLED:
+				sv->enabled = !sv->enabled;
+				break;
+			default:
+				/* Edit current value */
+				strcpy(editbuf, (char *)handlerSat(MENU_GET_VALUE, item));
+				if (item->id == ID_SAT_PERFTIME) sprintf(editbuf, "%u", config.perftime);
+				dlgGetString(item->name + strspn(item->name, " "), editbuf, 10, satEditHandler, (void *)item->id);
+				break;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static void satDrawResult(rect_t *rect, void *font, int x, int y, unsigned char result)
+{
+	switch (result) {
+		case SAT_RESULT_PASS:
+			grTextOut(rect, font, x, y, GR_COLOR_GREEN, "OK");
+			break;
+		case SAT_RESULT_FAIL:
+			grTextOut(rect, font, x, y, GR_COLOR_RED, "FAIL");
+			break;
+		default:
+			grTextOut(rect, font, x, y, GR_COLOR_GRAY, "-");
+			break;
+	}
+}
+
+static void satRedraw(void *window, rect_t *rect)
+{
+	const sat_result *res, *r;
+	const sat_measure *m;
+	void *font;
+	int i, y;
+
+	if (!rect) return;
+
+	wndDrawWindowFrame(window);
+
+	font = grLoadFont(GR_FONT_NORMAL);
+
+	satGetStatus(&status);
+	switch (status.state) {
+		case SAT_STATE_IDLE:
+			grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, ":");
+			grTextOut(rect, font, 80, 12, GR_COLOR_BLUE, satFormatDest(buf));
+			break;
+		case SAT_STATE_RUNNING:
+			if (status.phase == SAT_PHASE_CONFIG) {
+				sprintf(buf, ":  %u", status.service + 1);
+				grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, buf);
+				sprintf(buf, "%s, %u.%u /", stepNames[status.step], status.rate / 1000, (status.rate % 1000) / 100);
+				grTextOut(rect, font, 10, 22, GR_COLOR_BLUE, buf);
+			} else {
+				grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, " ");
+			}
+			break;
+		case SAT_STATE_DONE:
+			grTextOut(rect, font, 10, 12, GR_COLOR_BLACK, ":");
+			satDrawResult(rect, font, 80, 12, status.result);
+			break;
+		case SAT_STATE_NOARP:
+			grTextOut(rect, font, 10, 12, GR_COLOR_RED, "  ");
+			break;
+		case SAT_STATE_ERROR:
+			grTextOut(rect, font, 10, 12, GR_COLOR_RED, " ");
+			break;
+	}
+
+	font = grLoadFont(GR_FONT_SMALL);
+	res = satGetResults();
+	y = 36;
+
+	if (!page) {
+		/* Summary, service results of both tests */
+		grTextOut(rect, font, 4, y, GR_COLOR_BLACK, "  CIR    .  .");
+		for (i = 0; i < SAT_MAX_SERVICES; i++) {
+			if (!config.service[i].enabled) continue;
+			y += 9;
+			sprintf(buf, "%u", i + 1);
+			grTextOut(rect, font, 4, y, GR_COLOR_BLACK, buf);
+			grTextOut(rect, font, 34, y, GR_COLOR_BLUE, formatFixed(buf, config.service[i].cir, 1000));
+			satDrawResult(rect, font, 74, y, res[i].config);
+			satDrawResult(rect, font, 114, y, res[i].perf.result);
+		}
+	} else {
+		/* Service steps: received rate, loss, delay and its variation */
+		r = &res[page - 1];
+		sprintf(buf, " %u  IR     FLR%%   FTD   FDV, ", page);
+		grTextOut(rect, font, 4, y, GR_COLOR_BLACK, buf);
+		for (i = 0; i <= SAT_STEPS; i++) {
+			m = (i < SAT_STEPS) ? &r->step[i] : &r->perf;
+			y += 9;
+			grTextOut(rect, font, 4, y, GR_COLOR_BLACK, (i < SAT_STEPS) ? stepNames[i] : ".");
+			if (m->result == SAT_RESULT_NONE) continue;
+			grTextOut(rect, font, 50, y, (m->result == SAT_RESULT_PASS) ? GR_COLOR_BLUE : GR_COLOR_RED,
+					  formatFixed(buf, m->ir, 1000));
+			grTextOut(rect, font, 80, y, GR_COLOR_BLUE, formatFixed(buf, m->flr, 100));
+			sprintf(buf, "%u", m->ftd);
+			grTextOut(rect, font, 110, y, GR_COLOR_BLUE, buf);
+			sprintf(buf, "%u", m->fdv);
+			grTextOut(rect, font, 140, y, GR_COLOR_BLUE, buf);
+		}
+	}
+
+	wndDrawSoftkey(window, SOFTKEY_LEFT, "Exit");
+	wndDrawSoftkey(window, SOFTKEY_RIGHT, (status.state == SAT_STATE_RUNNING) ? "Stop" : "Start");
+}
+
+static void satHandler(void *window, unsigned short msgCode, unsigned short msgParam, void *msgPtr, void *p)
+{
+	switch (msgCode) {
+		case MSG_REDRAW:
+			satRedraw(window, (rect_t *)msgPtr);
+			break;
+
+		case MSG_KEY_PRESSED:
+			/* Test keeps running after the window is closed */
+			if (msgParam == 'C') {
+				tmrDestroyTimer(window, 1);
+				msgUnregisterWindow(window);
+			}
+			satGetStatus(&status);
+			if ( (msgParam == 'M') && (status.state != SAT_STATE_RUNNING) ) menuShow(&menuSat, window);
+			if (msgParam == 'R') {
+				if (status.state == SAT_STATE_RUNNING) {
+					satStop();
+				} else {
+					satStart(&config);
+				}
+				msgInvalidateWindow(window);
+			}
+			/* Next results page, services without results are skipped */
+			if (msgParam == '0') {
+				do {
+					page = (page + 1) % (SAT_MAX_SERVICES + 1);
+				} while (page && !config.service[page - 1].enabled);
+				msgInvalidateWindow(window);
+			}
+			break;
+
+		case MSG_TIMER:
+			msgInvalidateWindow(window);
+			break;
+	}
+}
+
+void app_y1564()
+{
+	void *wnd;
+
+	/* Create window */
+	wnd = msgRegisterWindow("Y.1564", 0, satHandler, NULL);
+	if (!wnd) return;
+
+	/* Create refresh timer */
+	tmrRegisterTimer(wnd, 500, 0, 1);
+}
@@ -5,7 +5,10 @@
 #include <aic/aic.h>
 
 #include <drivers/display.h>
+#include <drivers/tstamp.h>
 #include <net/bridge.h>
+#include <net/pktpool.h>
+#include <os/irq.h>
 #include <registry.h>
 
 #include "ethernet.h"
@@ -15,14 +18,45 @@
 #define ETH_PHY_ADDR		16
 
 /* PHY interface pins */
-#define ETH_PIN_MII			0x3FFFF;		/* Port B */
-#define ETH_PIN_IRQ			(1 << 14);		/* Port A */
-#define ETH_PIN_RESET		(1 << 15);		/* Port A */
+#define ETH_PIN_MII			0x3FFFF			/* Port B */
+#define ETH_PIN_IRQ			(1 << 14)		/* Port A */
+#define ETH_PIN_RESET		(1 << 15)		/* Port A */
 
+/* PHY interrupts: speed, duplex, autonegotiation, link and MDI crossover changes */
+#define ETH_PHY_INTMASK		0x6C40
+
+#define ETH_LINK_HANDLERS	4
+
+/* Queued PHY register operations */
+#define ETH_MDIO_QUEUE		16
+
+#define MDIO_OP_READ		0x01
+#define MDIO_OP_DONE		0x02
+
+/* Receive ring size, ring length may be reduced in the registry. EMAC
+ * receive buffer size is fixed. */
+#ifndef ETH_RX_BUFCOUNT
 #define ETH_RX_BUFCOUNT		32
+#endif
 #define ETH_RX_BUFSIZE		128
-#define ETH_TX_BUFCOUNT		2
-#define ETH_TX_BUFSIZE		1536
+#define ETH_RX_MINCOUNT		16
+
+#if (ETH_RX_BUFCOUNT < ETH_RX_MINCOUNT) || (ETH_RX_BUFCOUNT > 255)
+#error "ETH_RX_BUFCOUNT is out of range"
+#endif
+
+/* Tail of a wrapped frame is copied after the ring end */
+#define ETH_RX_SPILLSIZE	1536
+
+#define ETH_TX_BUFCOUNT		16
+#define ETH_TX_STAGESIZE	3072
+
+/* Max frames processed by one EthPoll() call */
+#define ETH_POLL_BUDGET		8
+
+/* Statistics registers are harvested every 100 ms into 64-bit totals, which
+ * wrap. 8-bit error registers may still saturate under heavy error rates. */
+#define ETH_STAT_PERIOD		(TS_TICKS_PER_SEC / 10)
 
 #define RXBUF_OWNERSHIP     0x00000001
 #define RXBUF_WRAP          0x00000002
@@ -64,14 +98,79 @@ typedef struct bufdescr {
 
 /* Receive buffers */
 static EthBuffer rxlist[ETH_RX_BUFCOUNT];
-static unsigned char rxbuf[ETH_RX_BUFCOUNT * ETH_RX_BUFSIZE] __attribute__ ((aligned(8)));
+static unsigned char rxbuf[ETH_RX_BUFCOUNT * ETH_RX_BUFSIZE + ETH_RX_SPILLSIZE] __attribute__ ((aligned(8)));
+static unsigned char rxcount;							/* Descriptors in use */
 static unsigned char rxindex;
-static pktbuf rxchunk[2];
+static unsigned char rxspill;							/* First descriptor + 1 of the loaned spilled frame */
+static volatile unsigned char rxpoll;					/* Receive interrupt is masked, poll is scheduled */
+static volatile unsigned char rxstamped;				/* rxstamp holds time of the receive interrupt */
+static volatile unsigned int rxstamp;
+
+/* Link state */
+static volatile unsigned char phyirq;					/* PHY interrupt pending */
+static eth_link link;
+static ethLinkHandler linkhandlers[ETH_LINK_HANDLERS];
+
+/* PHY register operations queue. Entries from mdiocur to mdiohead wait for
+ * the bus, ones from mdiotail to mdiocur wait for completion handlers. */
+struct mdioop {
+	ethMdioHandler	handler;
+	void *			arg;
+	unsigned short	val;
+	unsigned char	reg;
+	volatile unsigned char flags;
+};
+
+static struct mdioop mdioq[ETH_MDIO_QUEUE];
+static unsigned char mdiohead;							/* Next free entry */
+static unsigned char mdiotail;							/* Oldest entry */
+static volatile unsigned char mdiocur;					/* Operation on the bus */
+static volatile unsigned char mdiobusy;
+
+#define mdioNext(index) ( (index >= (ETH_MDIO_QUEUE-1)) ? 0 : index + 1 )
+
+/* Multicast hash reference counters */
+static unsigned char mcref[64];
+
+/* Frames loaned to the bridge, indexed by the first descriptor of the frame.
+ * Non-zero length marks descriptors which are not returned to EMAC yet.
+ * rxwrap is used for wrapped frames while the spill area is loaned. */
+static pktbuf rxchunk[ETH_RX_BUFCOUNT];
+static pktbuf rxwrap[2];
 
 /* Transmit buffers */
 static EthBuffer txlist[ETH_TX_BUFCOUNT];
-static unsigned char txbuf[ETH_TX_BUFCOUNT * ETH_TX_BUFSIZE] __attribute__ ((aligned(8)));
-static unsigned char txindex;
+static unsigned char txhead;							/* Next free descriptor */
+static unsigned char txtail;							/* First descriptor in flight */
+static unsigned char txcount[ETH_TX_BUFCOUNT];			/* Frame descriptors, by first descriptor */
+static pktbuf *txref[ETH_TX_BUFCOUNT];					/* Pool buffers sent by reference, by descriptor */
+
+/* Staging area for segments which can not be sent by reference */
+static unsigned char txstage[ETH_TX_STAGESIZE] __attribute__ ((aligned(8)));
+static unsigned short txstagehead;
+static unsigned short txstagetail;
+static unsigned short txstageend[ETH_TX_BUFCOUNT];		/* Staging head after frame, by first descriptor */
+
+static unsigned short txsize[ETH_TX_BUFCOUNT];			/* Frame size, by first descriptor */
+static volatile unsigned int txbytes;					/* Bytes of transmitted frames, updated by ISR */
+static volatile unsigned char txerror;					/* Transmit error, reset is pending */
+
+#define txNext(index) ( (index >= (ETH_TX_BUFCOUNT-1)) ? 0 : index + 1 )
+
+/* Statistics */
+static eth_stats stats;
+static unsigned long long statmark[ETH_STAT_COUNT];		/* Totals at the start of the rate interval */
+static unsigned int statharvest;						/* Time of the last harvest */
+static unsigned int statsecond;							/* Start of the rate interval */
+static unsigned int rxbytes;
+static unsigned int rxbytesmark, txbytesmark;
+
+static const char * const statnames[ETH_STAT_COUNT] = {
+	"RxFrames", "RxBytes", "TxFrames", "TxBytes", "RxPause", "TxPause",
+	"FCS", "Align", "Symbol", "Undersize", "Oversize", "Jabber", "Length",
+	"RxResource", "RxOverrun", "SingleCol", "MultiCol", "LateCol",
+	"ExcessCol", "Deferred", "TxUnderrun", "Carrier", "SQE", "PhyRxErr"
+};
 
 /* ===== Internal functions ===== */
 
@@ -80,16 +179,22 @@ static unsigned char txindex;
  */
 static int ethGetRecvFrame()
 {
-	unsigned char i;
-	unsigned short flen;
+	unsigned char i, first;
+	unsigned short flen, head;
+	unsigned int stamp;
+	pktbuf *frame;
+	int loaned, spilled;
 
 	/* Search next frame start marker */
 	while ((rxlist[rxindex].addr & RXBUF_OWNERSHIP) != 0 && (rxlist[rxindex].stat & RXS_SOF) == 0) {
 		rxlist[rxindex].addr &= ~(RXBUF_OWNERSHIP);
 		rxindex++;
-		if (rxindex >= ETH_RX_BUFCOUNT) rxindex = 0;
+		if (rxindex >= rxcount) rxindex = 0;
 	}
 
+	/* Frame is still loaned to the bridge */
+	if (rxchunk[rxindex].len) return 0;
+
 	/* Walk to end of the frame */
 	i = rxindex;
 	flen = 0;
@@ -99,7 +204,7 @@ static int ethGetRecvFrame()
 			do {
 				rxlist[rxindex].addr &= ~(RXBUF_OWNERSHIP);
 				rxindex++;
-				if (rxindex >= ETH_RX_BUFCOUNT) rxindex = 0;
+				if (rxindex >= rxcount) rxindex = 0;
 			} while ((rxlist[rxindex].addr & RXBUF_OWNERSHIP) != 0 && (rxlist[rxindex].stat & RXS_SOF) == 0);
 			break;
 		}
@@ -108,42 +213,425 @@ static int ethGetRecvFrame()
 		if ((flen = rxlist[i].stat & RXS_LENGTH_FRAME) != 0) break;
 
 		i++;
-		if (i >= ETH_RX_BUFCOUNT) i = 0;
+		if (i >= rxcount) i = 0;
 	}
 
 	/* No valid frame found */
 	if (!flen) return 0;
 
-	if (i < rxindex) {
-		/* Buffers wrapped */
-		rxchunk[0].next = &rxchunk[1];
-		rxchunk[0].data = &rxbuf[rxindex * ETH_RX_BUFSIZE];
-		rxchunk[0].len = (ETH_RX_BUFCOUNT - rxindex) * ETH_RX_BUFSIZE;
-		rxchunk[1].next = NULL;
-		rxchunk[1].data = rxbuf;
-		rxchunk[1].len = flen - rxchunk[0].len;
-		briPacketRecv(BRI_IF_ETHERNET, rxchunk);
+	/* First frame after interrupt is stamped with interrupt time */
+	if (rxstamped) {
+		stamp = rxstamp;
+		rxstamped = 0;
 	} else {
-		/* Unwrapped buffers */
-		rxchunk[0].next = NULL;
-		rxchunk[0].data = &rxbuf[rxindex * ETH_RX_BUFSIZE];
-		rxchunk[0].len = flen;
-		briPacketRecv(BRI_IF_ETHERNET, rxchunk);
+		stamp = tsGetTicks();
 	}
 
-	/* Free frame buffers */
+	first = rxindex;
+	spilled = 0;
+	if ( (i < rxindex) && rxspill ) {
+		/* Buffers wrapped and spill area is busy, frame is passed in two chunks and can not be loaned */
+		rxwrap[0].next = &rxwrap[1];
+		rxwrap[0].data = &rxbuf[rxindex * ETH_RX_BUFSIZE];
+		rxwrap[0].len = (rxcount - rxindex) * ETH_RX_BUFSIZE;
+		rxwrap[1].next = NULL;
+		rxwrap[1].data = rxbuf;
+		rxwrap[1].len = flen - rxwrap[0].len;
+		rxwrap[0].tstamp = stamp;
+		frame = rxwrap;
+	} else {
+		/* Buffers wrapped, copy the tail after the ring end */
+		if (i < rxindex) {
+			head = (rxcount - rxindex) * ETH_RX_BUFSIZE;
+			memcpy(&rxbuf[rxcount * ETH_RX_BUFSIZE], rxbuf, flen - head);
+			spilled = 1;
+		}
+
+		/* Frame is passed by reference */
+		rxchunk[first].next = NULL;
+		rxchunk[first].data = &rxbuf[rxindex * ETH_RX_BUFSIZE];
+		rxchunk[first].len = flen;
+		rxchunk[first].tstamp = stamp;
+		frame = &rxchunk[first];
+	}
+
+	rxbytes += flen;
+
+	loaned = briPacketRecv(BRI_IF_ETHERNET, frame) & BRI_RECV_LOANED;
+
+	/* Free frame buffers, loaned buffers are returned by ethReleaseFrame().
+	 * Spilled tail is not needed after the copy. */
 	while (1) {
 		i = rxindex;
-		rxlist[rxindex].addr &= ~(RXBUF_OWNERSHIP);
+		if ( !loaned || (spilled && (i < first)) ) rxlist[rxindex].addr &= ~(RXBUF_OWNERSHIP);
 		rxindex++;
-		if (rxindex >= ETH_RX_BUFCOUNT) rxindex = 0;
+		if (rxindex >= rxcount) rxindex = 0;
 
 		if (rxlist[i].stat & RXS_EOF) break;
 	}
+	if (!loaned) rxchunk[first].len = 0;
+	if (loaned && spilled) rxspill = first + 1;
 
 	return 1;
 }
 
+/* ethReleaseFrame()
+ *   Returns buffers of the frame loaned to the bridge back to EMAC
+ */
+static void ethReleaseFrame(pktbuf *packet)
+{
+	unsigned char i, n;
+	unsigned int stat;
+
+	i = packet - rxchunk;
+	if (i >= rxcount) return;
+
+	packet->len = 0;
+
+	/* Spilled frame, buffers at the ring start are already returned */
+	if (rxspill == i + 1) {
+		rxspill = 0;
+		for (; i < rxcount; i++) rxlist[i].addr &= ~(RXBUF_OWNERSHIP);
+		rxpoll = 1;
+		return;
+	}
+
+	for (n = 0; n < rxcount; n++) {
+		stat = rxlist[i].stat;
+		rxlist[i].addr &= ~(RXBUF_OWNERSHIP);
+		if (stat & RXS_EOF) break;
+
+		i++;
+		if (i >= rxcount) i = 0;
+	}
+
+	/* Frames may wait behind the returned buffers */
+	rxpoll = 1;
+}
+
+/* ethSetAddress()
+ *   Programs specific address register, first byte goes to the low bits
+ */
+static void ethSetAddress(int index, unsigned char *mac)
+{
+	AT91_REG *sa = &AT91C_BASE_EMAC->EMAC_SA1L + (index - 1) * 2;
+
+	/* Bottom register disables the address until top one is written */
+	sa[0] = mac[0] | (mac[1] << 8) | (mac[2] << 16) | (mac[3] << 24);
+	sa[1] = mac[4] | (mac[5] << 8);
+}
+
+/* ethHashIndex()
+ *   Calculates multicast hash index, every index bit is XOR of each sixth
+ * destination address bit
+ */
+static unsigned char ethHashIndex(unsigned char *mac)
+{
+	int i;
+	unsigned char index;
+
+	index = 0;
+	for (i = 0; i < 48; i++) {
+		if (mac[i >> 3] & (1 << (i & 7))) index ^= 1 << (i % 6);
+	}
+
+	return index;
+}
+
+/* ethUpdateHash()
+ *   Loads multicast hash from reference counters
+ */
+static void ethUpdateHash()
+{
+	int i;
+	unsigned int hash[2];
+
+	hash[0] = hash[1] = 0;
+	for (i = 0; i < 64; i++) {
+		if (mcref[i]) hash[i >> 5] |= 1 << (i & 31);
+	}
+
+	AT91C_BASE_EMAC->EMAC_HRB = hash[0];
+	AT91C_BASE_EMAC->EMAC_HRT = hash[1];
+
+	if (hash[0] | hash[1]) {
+		AT91C_BASE_EMAC->EMAC_NCFGR |= AT91C_EMAC_MTI;
+	} else {
+		AT91C_BASE_EMAC->EMAC_NCFGR &= ~AT91C_EMAC_MTI;
+	}
+}
+
+/* ethMdioStart()
+ *   Starts PHY register operation, EMAC signals completion with MFD
+ */
+static void ethMdioStart(struct mdioop *op)
+{
+	if (op->flags & MDIO_OP_READ) {
+		AT91C_BASE_EMAC->EMAC_MAN = (1 << 30) | (1 << 17) | (1 << 29) |
+			(ETH_PHY_ADDR << 23) | ((op->reg & 0x1F) << 18);
+	} else {
+		AT91C_BASE_EMAC->EMAC_MAN = (1 << 30) | (1 << 17) | (1 << 28) |
+			(ETH_PHY_ADDR << 23) | ((op->reg & 0x1F) << 18) | op->val;
+	}
+}
+
+/* ethMdioDone()
+ *   Completes current operation and starts the next one, called from ISR
+ */
+static void ethMdioDone()
+{
+	struct mdioop *op;
+
+	if (!mdiobusy) return;
+
+	op = &mdioq[mdiocur];
+	if (op->flags & MDIO_OP_READ) op->val = AT91C_BASE_EMAC->EMAC_MAN;
+	op->flags |= MDIO_OP_DONE;
+
+	mdiocur = mdioNext(mdiocur);
+	if (mdiocur != mdiohead) {
+		ethMdioStart(&mdioq[mdiocur]);
+	} else {
+		mdiobusy = 0;
+	}
+}
+
+/* ethMdioQueue()
+ *   Adds operation to the queue, returns 0 if queue is full
+ */
+static int ethMdioQueue(unsigned char reg, unsigned short val, unsigned char flags,
+						ethMdioHandler handler, void *arg)
+{
+	unsigned char next;
+	struct mdioop *op;
+
+	next = mdioNext(mdiohead);
+	if (next == mdiotail) return 0;
+
+	op = &mdioq[mdiohead];
+	op->handler = handler;
+	op->arg = arg;
+	op->val = val;
+	op->reg = reg;
+	op->flags = flags;
+
+	/* Keep ISR away while the queue is updated */
+	AT91C_BASE_EMAC->EMAC_IDR = AT91C_EMAC_MFD;
+	mdiohead = next;
+	if (!mdiobusy) {
+		mdiobusy = 1;
+		ethMdioStart(&mdioq[mdiocur]);
+	}
+	AT91C_BASE_EMAC->EMAC_IER = AT91C_EMAC_MFD;
+
+	return 1;
+}
+
+/* ethMdioComplete()
+ *   Calls handlers of completed operations in the queue order
+ */
+static void ethMdioComplete()
+{
+	struct mdioop op;
+
+	while ( (mdiotail != mdiohead) && (mdioq[mdiotail].flags & MDIO_OP_DONE) ) {
+		/* Free entry first, handler may queue next operation */
+		op = mdioq[mdiotail];
+		mdiotail = mdioNext(mdiotail);
+
+		if (op.handler) op.handler(op.reg, op.val, op.arg);
+	}
+}
+
+/* ISR_Phy()
+ *   PHY interrupt line changed, status is read by EthPoll()
+ */
+static void ISR_Phy()
+{
+	unsigned int status = AT91C_BASE_PIOA->PIO_ISR;
+
+	if (status & ETH_PIN_IRQ) phyirq = 1;
+}
+
+/* ethLinkStatus()
+ *   Updates link state from PHY status, notifies link handlers on change
+ */
+static void ethLinkStatus(unsigned char reg, unsigned short status, void *arg)
+{
+	unsigned char flags;
+	int i;
+
+	flags = 0;
+	if ( (status & PHY_REG17_LINK) && (status & PHY_REG17_RESOLVED) ) {
+		flags |= ETH_LINK_UP;
+		if (status & PHY_REG17_100) flags |= ETH_LINK_100;
+		if (status & PHY_REG17_FD) flags |= ETH_LINK_FD;
+		if (status & PHY_REG17_MDIX) flags |= ETH_LINK_MDIX;
+	}
+	if (flags == link.flags) return;
+
+	if ((flags ^ link.flags) & ETH_LINK_UP) link.flaps++;
+	link.flags = flags;
+	link.stamp = tsGetTicks64();
+
+	/* Follow resolved duplex mode */
+	if (flags & ETH_LINK_FD) {
+		AT91C_BASE_EMAC->EMAC_NCFGR |= AT91C_EMAC_FD;
+	} else {
+		AT91C_BASE_EMAC->EMAC_NCFGR &= ~AT91C_EMAC_FD;
+	}
+	if (flags & ETH_LINK_100) {
+		AT91C_BASE_EMAC->EMAC_NCFGR |= AT91C_EMAC_SPD;
+	} else {
+		AT91C_BASE_EMAC->EMAC_NCFGR &= ~AT91C_EMAC_SPD;
+	}
+
+	for (i = 0; i < ETH_LINK_HANDLERS; i++) {
+		if (linkhandlers[i]) linkhandlers[i](&link);
+	}
+}
+
+/* ethLinkUpdate()
+ *   Queues PHY status read after interrupt
+ */
+static void ethLinkUpdate()
+{
+	if (!phyirq) return;
+	phyirq = 0;
+
+	/* Reading interrupt status releases the line, retry if queue is full */
+	if ( !EthPHYReadAsync(19, NULL, NULL) || !EthPHYReadAsync(17, ethLinkStatus, NULL) ) phyirq = 1;
+}
+
+/* ethPhyErrors()
+ *   Adds PHY receive error counter to the totals
+ */
+static void ethPhyErrors(unsigned char reg, unsigned short val, void *arg)
+{
+	stats.count[ETH_STAT_PHY_RXERR] += val;
+}
+
+/* ethStatHarvest()
+ *   Adds clear-on-read statistics registers to the totals, updates rates
+ * once a second
+ */
+static void ethStatHarvest()
+{
+	AT91PS_EMAC emac = AT91C_BASE_EMAC;
+	unsigned long long *c = stats.count;
+	unsigned int now, elapsed, v;
+	int i;
+
+	now = tsGetTicks();
+	if ((now - statharvest) < ETH_STAT_PERIOD) return;
+	statharvest = now;
+
+	c[ETH_STAT_RX_FRAMES] += emac->EMAC_FRO;
+	c[ETH_STAT_TX_FRAMES] += emac->EMAC_FTO;
+	c[ETH_STAT_RX_PAUSE] += emac->EMAC_PFR;
+	c[ETH_STAT_TX_PAUSE] += emac->EMAC_TPF;
+	c[ETH_STAT_FCS] += emac->EMAC_FCSE;
+	c[ETH_STAT_ALIGN] += emac->EMAC_ALE;
+	c[ETH_STAT_SYMBOL] += emac->EMAC_RSE;
+	c[ETH_STAT_UNDERSIZE] += emac->EMAC_USF;
+	c[ETH_STAT_OVERSIZE] += emac->EMAC_ELE;
+	c[ETH_STAT_JABBER] += emac->EMAC_RJA;
+	c[ETH_STAT_LENGTH] += emac->EMAC_RLE;
+	c[ETH_STAT_RX_RESOURCE] += emac->EMAC_RRE;
+	c[ETH_STAT_RX_OVERRUN] += emac->EMAC_ROV;
+	c[ETH_STAT_SINGLE_COL] += emac->EMAC_SCF;
+	c[ETH_STAT_MULTI_COL] += emac->EMAC_MCF;
+	c[ETH_STAT_LATE_COL] += emac->EMAC_LCOL;
+	c[ETH_STAT_EXCESS_COL] += emac->EMAC_ECOL;
+	c[ETH_STAT_DEFERRED] += emac->EMAC_DTF;
+	c[ETH_STAT_TX_UNDERRUN] += emac->EMAC_TUND;
+	c[ETH_STAT_CARRIER] += emac->EMAC_CSE;
+	c[ETH_STAT_SQE] += emac->EMAC_STE;
+
+	/* Byte counters are free running, take the difference */
+	c[ETH_STAT_RX_BYTES] += rxbytes - rxbytesmark;
+	rxbytesmark = rxbytes;
+	v = txbytes;
+	c[ETH_STAT_TX_BYTES] += v - txbytesmark;
+	txbytesmark = v;
+
+	/* Rates */
+	elapsed = now - statsecond;
+	if (elapsed < TS_TICKS_PER_SEC) return;
+	statsecond = now;
+
+	/* PHY counter is read with rates only, so it lags one second */
+	EthPHYReadAsync(21, ethPhyErrors, NULL);
+
+	for (i = 0; i < ETH_STAT_COUNT; i++) {
+		stats.rate[i] = (c[i] - statmark[i]) * TS_TICKS_PER_SEC / elapsed;
+		statmark[i] = c[i];
+	}
+}
+
+/* ethTxReap()
+ *   Reclaims descriptors of transmitted frames
+ */
+static void ethTxReap()
+{
+	unsigned char i, n;
+
+	while (txtail != txhead) {
+		/* EMAC marks only the first descriptor of the frame as used */
+		if ( !(txlist[txtail].stat & TXS_USED) ) break;
+
+		/* Mark all frame descriptors as used, release pool buffers */
+		i = txtail;
+		for (n = 0; n < txcount[txtail]; n++) {
+			txlist[i].stat = TXS_USED | ((i == (ETH_TX_BUFCOUNT-1)) ? TXS_WRAP : 0);
+			if (txref[i]) {
+				pktFree(txref[i]);
+				txref[i] = NULL;
+			}
+			i = txNext(i);
+		}
+
+		/* Free staged data */
+		txstagetail = txstageend[txtail];
+		txbytes += txsize[txtail];
+		txtail = i;
+	}
+}
+
+/* ethTxClear()
+ *   Drops all queued frames, releases pool buffers they hold
+ */
+static void ethTxClear()
+{
+	int i;
+
+	for (i = 0; i < ETH_TX_BUFCOUNT; i++) {
+		txlist[i].addr = (unsigned int)txstage;
+		txlist[i].stat = TXS_USED | ((i == (ETH_TX_BUFCOUNT-1)) ? TXS_WRAP : 0);
+		if (txref[i]) {
+			pktFree(txref[i]);
+			txref[i] = NULL;
+		}
+	}
+	txhead = txtail = 0;
+	txstagehead = txstagetail = 0;
+	txerror = 0;
+}
+
+/* ethTxReset()
+ *   Drops all frames in flight and restarts transmitter. Called with IRQ
+ * locked, as the ring is shared with senders from interrupt handlers.
+ */
+static void ethTxReset()
+{
+	AT91C_BASE_EMAC->EMAC_NCR &= ~AT91C_EMAC_TE;
+
+	ethTxClear();
+
+	AT91C_BASE_EMAC->EMAC_TBQP = (unsigned int) txlist;
+	AT91C_BASE_EMAC->EMAC_NCR |= AT91C_EMAC_TE;
+}
+
 /* ISR_Ethernet()
  *   EMAC interrupt handler
  */
@@ -151,56 +639,189 @@ static void ISR_Ethernet()
 {
 	unsigned int status = AT91C_BASE_EMAC->EMAC_ISR;
 
-	/* Frame received */
-	if (status & AT91C_EMAC_RCOMP) {
+	/* Transmit error -- transmitter is restarted by the next send or poll */
+	if (status & (AT91C_EMAC_TUNDR | AT91C_EMAC_RLEX | AT91C_EMAC_TXERR)) {
+		txerror = 1;
+		AT91C_BASE_EMAC->EMAC_TSR = AT91C_EMAC_UND | AT91C_EMAC_RLES | AT91C_EMAC_BEX | AT91C_EMAC_COMP;
+	}
 
-		/* Get all received frames */
-		while (ethGetRecvFrame());
+	/* PHY register operation done */
+	if (status & AT91C_EMAC_MFD) ethMdioDone();
 
-		AT91C_BASE_EMAC->EMAC_RSR = AT91C_EMAC_REC;
-		return;
+	/* Frame transmitted */
+	if (status & AT91C_EMAC_TCOMP) {
+		ethTxReap();
+		AT91C_BASE_EMAC->EMAC_TSR = AT91C_EMAC_COMP;
+	}
+
+	/* Frame received or buffers exhausted -- mask interrupt and schedule poll */
+	if (status & (AT91C_EMAC_RCOMP | AT91C_EMAC_RXUBR)) {
+		AT91C_BASE_EMAC->EMAC_IDR = AT91C_EMAC_RCOMP | AT91C_EMAC_RXUBR;
+		if (!rxpoll) {
+			rxstamp = tsGetTicks();
+			rxstamped = 1;
+		}
+		rxpoll = 1;
 	}
+}
 
-	/* Frame received */
-	if (status & AT91C_EMAC_RXUBR) {
+/* ethTxStage()
+ *   Allocates contiguous space in the staging area
+ */
+static unsigned char *ethTxStage(unsigned short size)
+{
+	unsigned short head, tail;
 
-		/* Get all received frames */
-		while (ethGetRecvFrame());
+	head = txstagehead;
+	tail = txstagetail;
 
-		AT91C_BASE_EMAC->EMAC_RSR = AT91C_EMAC_BNA;
-		return;
+	if (head >= tail) {
+		/* Free space up to the end of area */
+		if ( (head + size) <= ETH_TX_STAGESIZE ) {
+			txstagehead = head + size;
+			return &txstage[head];
+		}
+		/* Wrap to the start of area */
+		if (size < tail) {
+			txstagehead = size;
+			return txstage;
+		}
+		return NULL;
+	}
+
+	/* Free space up to the tail */
+	if ( (head + size) < tail ) {
+		txstagehead = head + size;
+		return &txstage[head];
 	}
+
+	return NULL;
 }
 
-static void ethSendFrame(pktbuf *packet)
+/* ethSendFrame()
+ *   Queues frame to EMAC. Every static or pool segment gets own descriptor,
+ * pool buffers are referenced until sent. Other segments are copied to the
+ * staging area, adjacent ones share a descriptor. Frames come both from the
+ * main loop and from the USB interrupt, so the ring is filled with IRQ locked.
+ */
+static int ethSendFrame(pktbuf *packet)
 {
-	unsigned char *data;
-	unsigned int size;
+	unsigned char first, next, i, n, run, busy;
+	unsigned int stamp, cpsr;
+	unsigned char *stage;
+	unsigned short size, copysize, len;
 	pktbuf *buf;
 
-	data = &txbuf[txindex * ETH_TX_BUFSIZE];
+	/* Count descriptors and staging space */
 	size = 0;
+	copysize = 0;
+	n = 0;
+	run = 0;
+	for (buf = packet; buf; buf = buf->next) {
+		if (!buf->len) continue;
+		size += buf->len;
+
+		if (buf->flags & (PKT_FLAG_STATIC | PKT_FLAG_POOL)) {
+			n++;
+			run = 0;
+		} else {
+			if (!run) n++;
+			run = 1;
+			copysize += buf->len;
+		}
+	}
+
+	/* Check frame size */
+	if (!size) return IF_SEND_OK;
+	if (size > ETH_MTU) return IF_SEND_OVERSIZE;
+
+	cpsr = irqLock();
+	if (txerror) ethTxReset();
 
-	/* Copy packet to send buffer */
+	/* Check free descriptors, one is always left unused */
+	busy = (txhead >= txtail) ? (txhead - txtail) : (ETH_TX_BUFCOUNT - txtail + txhead);
+	if ( (busy + n) >= ETH_TX_BUFCOUNT ) {
+		irqUnlock(cpsr);
+		return IF_SEND_FULL;
+	}
+
+	/* Allocate staging space */
+	stage = NULL;
+	if (copysize) {
+		stage = ethTxStage(copysize);
+		if (!stage) {
+			irqUnlock(cpsr);
+			return IF_SEND_FULL;
+		}
+	}
+
+	/* Fill descriptors, EMAC does not own them yet */
+	first = txhead;
+	i = first;
+	len = 0;
 	for (buf = packet; buf; buf = buf->next) {
-		/* Check buffer overflow */
-		if ( (size + buf->len) > ETH_TX_BUFSIZE ) return;
+		if (!buf->len) continue;
 
-		/* Copy data */
-		memcpy(data, buf->data, buf->len);
-		
-		data += buf->len;
-		size += buf->len;
+		if ( !(buf->flags & (PKT_FLAG_STATIC | PKT_FLAG_POOL)) ) {
+			/* Append segment to copied run */
+			memcpy(stage, buf->data, buf->len);
+			stage += buf->len;
+			len += buf->len;
+			continue;
+		}
+
+		/* Close copied run */
+		if (len) {
+			txlist[i].addr = (unsigned int)(stage - len);
+			txlist[i].stat = TXS_USED | len;
+			i = txNext(i);
+			len = 0;
+		}
+
+		/* Send segment by reference */
+		txlist[i].addr = (unsigned int)buf->data;
+		txlist[i].stat = TXS_USED | buf->len;
+		if (buf->flags & PKT_FLAG_POOL) {
+			pktRef(buf);
+			txref[i] = buf;
+		}
+		i = txNext(i);
+	}
+	if (len) {
+		txlist[i].addr = (unsigned int)(stage - len);
+		txlist[i].stat = TXS_USED | len;
+		i = txNext(i);
 	}
 
-	size |= TXS_LAST_BUFF;
-	if (txindex == (ETH_TX_BUFCOUNT-1)) size |= TXS_WRAP;
+	txcount[first] = n;
+	txsize[first] = size;
+	txstageend[first] = txstagehead;
+	next = i;
+
+	/* Pass descriptors to EMAC from the last one, so it never sees partial frame */
+	do {
+		i = (i == 0) ? (ETH_TX_BUFCOUNT - 1) : (i - 1);
+		if (i == (ETH_TX_BUFCOUNT-1)) txlist[i].stat |= TXS_WRAP;
+		if (txNext(i) == next) txlist[i].stat |= TXS_LAST_BUFF;
+		txlist[i].stat &= ~TXS_USED;
+	} while (i != first);
+
+	/* Publish frame to the completion handler */
+	txhead = next;
 
 	/* Start TX */
-	txlist[txindex].stat = size;
-	txindex++;
-	if (txindex >= ETH_TX_BUFCOUNT) txindex = 0;
 	AT91C_BASE_EMAC->EMAC_NCR |= AT91C_EMAC_TSTART;
+	irqUnlock(cpsr);
+
+	/* Stamp segments with hand-off time. Pool buffers keep their receive
+	 * time, the same frame may be queued to the local stack as well.
+	 */
+	stamp = tsGetTicks();
+	for (buf = packet; buf; buf = buf->next) {
+		if (!(buf->flags & PKT_FLAG_POOL)) buf->tstamp = stamp;
+	}
+
+	return IF_SEND_OK;
 }
 
 /* ===== Interface functions ===== */
@@ -213,6 +834,13 @@ void EthInit()
 	int i;
 	unsigned char *v;
 
+	/* Finish queued PHY operations of the previous start, so their handlers
+	 * are called before the queue is restarted */
+	if ( mdiobusy && (AT91C_BASE_EMAC->EMAC_NCR & AT91C_EMAC_MPE) ) {
+		while (mdiobusy);
+	}
+	ethMdioComplete();
+
 	// Configure interrupt pin
 	AT91C_BASE_PIOA->PIO_PER = ETH_PIN_IRQ;
 	AT91C_BASE_PIOA->PIO_ODR = ETH_PIN_IRQ;
@@ -236,21 +864,30 @@ void EthInit()
 	AT91C_BASE_PIOA->PIO_SODR = ETH_PIN_RESET;
 
 	// Configure ethernet controller
-	AT91C_BASE_PMC->PMC_PCER = (1 << AT91C_ID_EMAC) | (1 << AT91C_ID_PIOB);
-	AT91C_BASE_EMAC->EMAC_NCFGR = AT91C_EMAC_SPD | AT91C_EMAC_FD | AT91C_EMAC_CLK_HCLK_16 | AT91C_EMAC_CAF;
+	AT91C_BASE_PMC->PMC_PCER = (1 << AT91C_ID_EMAC) | (1 << AT91C_ID_PIOA) | (1 << AT91C_ID_PIOB);
+	AT91C_BASE_EMAC->EMAC_IDR = 0xFFFFFFFF;
+
+	/* Restart PHY operations queue, bus is idle after the reset pulse */
+	mdiohead = mdiotail = mdiocur = 0;
+	mdiobusy = 0;
+	AT91C_BASE_EMAC->EMAC_NCFGR = AT91C_EMAC_SPD | AT91C_EMAC_FD | AT91C_EMAC_CLK_HCLK_16;
 	AT91C_BASE_EMAC->EMAC_NCR = AT91C_EMAC_MPE;
 
-	/* Configure MAC address */
+	/* Configure address filter, bridge switches to promiscuous mode when needed */
+	AT91C_BASE_EMAC->EMAC_SA1L = 0;
+	AT91C_BASE_EMAC->EMAC_SA2L = 0;
+	AT91C_BASE_EMAC->EMAC_SA3L = 0;
+	AT91C_BASE_EMAC->EMAC_SA4L = 0;
+	AT91C_BASE_EMAC->EMAC_HRB = 0;
+	AT91C_BASE_EMAC->EMAC_HRT = 0;
+	memset(mcref, 0, sizeof(mcref));
+
+	/* Local stack MAC address */
+	ethSetAddress(1, ifGetAddress());
+
+	/* System MAC address */
 	v = regGetValue(SYS_REG_MAC_ADDRESS, NULL);
-	if (v) {
-		/* System MAC address */
-		AT91C_BASE_EMAC->EMAC_SA1L = (v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3];
-		AT91C_BASE_EMAC->EMAC_SA1H = (v[4] << 8) | v[5];
-		/* ADM8511 MAC address */
-		v[5] |= 1;
-		AT91C_BASE_EMAC->EMAC_SA2L = (v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3];
-		AT91C_BASE_EMAC->EMAC_SA2H = (v[4] << 8) | v[5];
-	}
+	if (v) ethSetAddress(2, v);
 
 	/* Wait for hardware reset complete and configure PHY */
 	sleep(100);
@@ -262,18 +899,33 @@ void EthInit()
 	sleep(5);
 	EthPHYWrite(22, 0x0EB5);				/* LED0: Link, LED1: Act, LED2: Interrupt */
 	EthPHYWrite(25, 0x0000);
+	EthPHYWrite(18, ETH_PHY_INTMASK);
+
+	/* PHY interrupt, current state is read on the first poll */
+	link.flags = 0;
+	phyirq = 1;
+	AT91C_BASE_PIOA->PIO_IFER = ETH_PIN_IRQ;
+	AT91C_BASE_PIOA->PIO_ISR;
+	AT91C_BASE_PIOA->PIO_IER = ETH_PIN_IRQ;
+	AIC_ConfigureIT(AT91C_ID_PIOA, 0, ISR_Phy);
+	AIC_EnableIT(AT91C_ID_PIOA);
 
 	/* Initialize buffer descriptors */
-	for (i = 0; i < ETH_RX_BUFCOUNT; i++) {
+	rxpoll = 0;
+	rxstamped = 0;
+	v = regGetValue(SYS_REG_ETH_RX_BUFFERS, NULL);
+	rxcount = ETH_RX_BUFCOUNT;
+	if ( v && (*v >= ETH_RX_MINCOUNT) && (*v < ETH_RX_BUFCOUNT) ) rxcount = *v;
+	for (i = 0; i < rxcount; i++) {
 		rxlist[i].addr = (unsigned int) &rxbuf[ETH_RX_BUFSIZE * i];
-		if (i == (ETH_RX_BUFCOUNT-1)) rxlist[i].addr |= 2;
+		if (i == (rxcount-1)) rxlist[i].addr |= 2;
+		rxchunk[i].len = 0;
 	}
+	rxindex = 0;
+	rxspill = 0;
 	AT91C_BASE_EMAC->EMAC_RBQP = (unsigned int) rxlist;
 
-	txlist[0].addr = (unsigned int)&txbuf[0];
-	txlist[0].stat = TXS_USED;
-	txlist[1].addr = (unsigned int)&txbuf[ETH_TX_BUFSIZE];
-	txlist[1].stat = TXS_USED | TXS_WRAP;
+	ethTxClear();
 	AT91C_BASE_EMAC->EMAC_TBQP = (unsigned int) txlist;
 
 	/* Start controller */
@@ -281,19 +933,156 @@ void EthInit()
 	AT91C_BASE_EMAC->EMAC_USRIO = AT91C_EMAC_CLKEN;
 	AT91C_BASE_EMAC->EMAC_NCR = AT91C_EMAC_MPE | AT91C_EMAC_RE | AT91C_EMAC_TE | AT91C_EMAC_WESTAT;
 
-	/* Configure interrupts */
-	AT91C_BASE_EMAC->EMAC_IER = AT91C_EMAC_RCOMP | AT91C_EMAC_RXUBR;
+	/* Configure interrupts, MFD status is left by blocking PHY access */
+	AT91C_BASE_EMAC->EMAC_ISR;
+	AT91C_BASE_EMAC->EMAC_IER = AT91C_EMAC_RCOMP | AT91C_EMAC_RXUBR | AT91C_EMAC_TCOMP |
+		AT91C_EMAC_TUNDR | AT91C_EMAC_RLEX | AT91C_EMAC_TXERR | AT91C_EMAC_MFD;
 	AIC_ConfigureIT(AT91C_ID_EMAC, 0, ISR_Ethernet);
 	AIC_EnableIT(AT91C_ID_EMAC);
 
 	/* Register bridge interface */
-	briIfRegister(BRI_IF_ETHERNET, "Ethernet interface", ethSendFrame, NULL);
+	briIfRegister(BRI_IF_ETHERNET, "Ethernet interface", ethSendFrame, ethReleaseFrame, NULL);
+}
+
+/* EthPoll()
+ *   Processes received frames, called from the main loop. Receive interrupt
+ * is enabled again when all frames are processed.
+ */
+void EthPoll()
+{
+	unsigned int cpsr;
+	int i;
+
+	ethMdioComplete();
+	ethLinkUpdate();
+	ethStatHarvest();
+
+	/* Restart transmitter after error, unless a send already did */
+	if (txerror) {
+		cpsr = irqLock();
+		if (txerror) ethTxReset();
+		irqUnlock(cpsr);
+	}
+
+	if (!rxpoll) return;
+
+	for (i = 0; i < ETH_POLL_BUDGET; i++) {
+		if (ethGetRecvFrame()) continue;
+
+		/* Receive ring is empty */
+		AT91C_BASE_EMAC->EMAC_RSR = AT91C_EMAC_REC | AT91C_EMAC_BNA;
+		rxpoll = 0;
+		AT91C_BASE_EMAC->EMAC_IER = AT91C_EMAC_RCOMP | AT91C_EMAC_RXUBR;
+
+		/* Frame received after the last check may have its RCOMP status read
+		 * by the transmit interrupt, look at the ring once more */
+		if (!ethGetRecvFrame()) return;
+
+		AT91C_BASE_EMAC->EMAC_IDR = AT91C_EMAC_RCOMP | AT91C_EMAC_RXUBR;
+		rxpoll = 1;
+	}
+
+	/* Budget exhausted -- continue on the next call */
+}
+
+/* EthGetLink()
+ *   Copies cached link state, PHY is not accessed
+ */
+void EthGetLink(eth_link *l)
+{
+	memcpy(l, &link, sizeof(eth_link));
+}
+
+/* EthRegisterLinkHandler()
+ *   Adds handler called from EthPoll() on every link state change
+ */
+int EthRegisterLinkHandler(ethLinkHandler handler)
+{
+	int i;
+
+	for (i = 0; i < ETH_LINK_HANDLERS; i++) {
+		if (!linkhandlers[i]) {
+			linkhandlers[i] = handler;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void EthUnregisterLinkHandler(ethLinkHandler handler)
+{
+	int i;
+
+	for (i = 0; i < ETH_LINK_HANDLERS; i++) {
+		if (linkhandlers[i] == handler) linkhandlers[i] = NULL;
+	}
+}
+
+/* EthSendFrame()
+ *   Queues frame to EMAC bypassing the bridge, for generated traffic.
+ * Returns IF_SEND_* code.
+ */
+int EthSendFrame(pktbuf *packet)
+{
+	return ethSendFrame(packet);
+}
+
+/* EthGetStats()
+ *   Copies statistics collected by EthPoll(), main loop only as 64-bit
+ * totals are not updated atomically
+ */
+void EthGetStats(eth_stats *s)
+{
+	memcpy(s, &stats, sizeof(eth_stats));
+}
+
+const char *EthStatName(int index)
+{
+	if ( (index < 0) || (index >= ETH_STAT_COUNT) ) return "";
+	return statnames[index];
+}
+
+/* EthSetPromiscuous()
+ *   Enables or disables reception of all frames regardless of address
+ */
+void EthSetPromiscuous(int enable)
+{
+	if (enable) {
+		AT91C_BASE_EMAC->EMAC_NCFGR |= AT91C_EMAC_CAF;
+	} else {
+		AT91C_BASE_EMAC->EMAC_NCFGR &= ~AT91C_EMAC_CAF;
+	}
+}
+
+/* EthAddMulticast()
+ *   Adds multicast address to the receive filter. Hash is shared, so other
+ * groups may pass too, protocol handlers still check the address.
+ */
+void EthAddMulticast(unsigned char *mac)
+{
+	unsigned char index = ethHashIndex(mac);
+
+	if (mcref[index] < 255) mcref[index]++;
+	ethUpdateHash();
+}
+
+/* EthDelMulticast()
+ *   Removes multicast address added by EthAddMulticast()
+ */
+void EthDelMulticast(unsigned char *mac)
+{
+	unsigned char index = ethHashIndex(mac);
+
+	if (mcref[index]) mcref[index]--;
+	ethUpdateHash();
 }
 
 void EthShutdown()
 {
 	/* Disable EMAC */
 	AT91C_BASE_EMAC->EMAC_NCR = 0;
+	AT91C_BASE_PIOA->PIO_IDR = ETH_PIN_IRQ;
 
 	/* Set all control lines low */
 	AT91C_BASE_PIOA->PIO_CODR = ETH_PIN_RESET;
@@ -305,6 +1094,9 @@ void EthShutdown()
 	AT91C_BASE_PIOA->PIO_CODR = 1;
 }
 
+/* EthPHYRead()
+ *   Blocking PHY register read, used during initialization only
+ */
 unsigned short EthPHYRead(unsigned char reg)
 {
 	/* Read command */
@@ -317,6 +1109,9 @@ unsigned short EthPHYRead(unsigned char reg)
 	return AT91C_BASE_EMAC->EMAC_MAN;
 }
 
+/* EthPHYWrite()
+ *   Blocking PHY register write, used during initialization only
+ */
 void EthPHYWrite(unsigned char reg, unsigned short val)
 {
 	/* Write command */
@@ -326,3 +1121,21 @@ void EthPHYWrite(unsigned char reg, unsigned short val)
 	/* Wait for complete */
 	while ((AT91C_BASE_EMAC->EMAC_NSR & AT91C_EMAC_IDLE) == 0);
 }
+
+/* EthPHYReadAsync()
+ *   Queues PHY register read, handler is called from EthPoll() with the
+ * value. Returns 0 if queue is full.
+ */
+int EthPHYReadAsync(unsigned char reg, ethMdioHandler handler, void *arg)
+{
+	return ethMdioQueue(reg, 0, MDIO_OP_READ, handler, arg);
+}
+
+/* EthPHYWriteAsync()
+ *   Queues PHY register write, handler may be NULL. Operations are done
+ * in the queue order, so sequences need no handlers between steps.
+ */
+int EthPHYWriteAsync(unsigned char reg, unsigned short val, ethMdioHandler handler, void *arg)
+{
+	return ethMdioQueue(reg, val, 0, handler, arg);
+}
@@ -2,6 +2,8 @@
 #ifndef _ETHERNET_H
 #define _ETHERNET_H
 
+#include <net/bridge.h>
+
 #define ETH_MTU					1514
 
 #define PHY_REG17_MDIX			(1 << 6)
@@ -10,10 +12,74 @@
 #define PHY_REG17_FD			(1 << 13)
 #define PHY_REG17_100			(1 << 14)
 
+/* Statistics counters */
+#define ETH_STAT_RX_FRAMES		0		/* Frames received OK */
+#define ETH_STAT_RX_BYTES		1		/* Bytes of frames passed to the CPU */
+#define ETH_STAT_TX_FRAMES		2		/* Frames transmitted OK */
+#define ETH_STAT_TX_BYTES		3		/* Bytes of transmitted frames */
+#define ETH_STAT_RX_PAUSE		4
+#define ETH_STAT_TX_PAUSE		5
+#define ETH_STAT_FCS			6		/* Frame check sequence errors */
+#define ETH_STAT_ALIGN			7
+#define ETH_STAT_SYMBOL			8
+#define ETH_STAT_UNDERSIZE		9
+#define ETH_STAT_OVERSIZE		10		/* Excessive length frames */
+#define ETH_STAT_JABBER			11
+#define ETH_STAT_LENGTH			12		/* Length field mismatch */
+#define ETH_STAT_RX_RESOURCE	13		/* No receive buffers */
+#define ETH_STAT_RX_OVERRUN		14
+#define ETH_STAT_SINGLE_COL		15
+#define ETH_STAT_MULTI_COL		16
+#define ETH_STAT_LATE_COL		17
+#define ETH_STAT_EXCESS_COL		18
+#define ETH_STAT_DEFERRED		19
+#define ETH_STAT_TX_UNDERRUN	20
+#define ETH_STAT_CARRIER		21		/* Carrier sense errors */
+#define ETH_STAT_SQE			22
+#define ETH_STAT_PHY_RXERR		23		/* PHY receive errors */
+#define ETH_STAT_COUNT			24
+
+/* Link state flags */
+#define ETH_LINK_UP				0x01
+#define ETH_LINK_100			0x02
+#define ETH_LINK_FD				0x04
+#define ETH_LINK_MDIX			0x08
+
+typedef struct {
+	unsigned char		flags;
+	unsigned int		flaps;					/* Link up and down transitions */
+	unsigned long long	stamp;					/* Time of the last change, timebase ticks */
+} eth_link;
+
+typedef void (*ethLinkHandler)(eth_link *link);
+
+/* PHY register access completion, val is the register value for reads */
+typedef void (*ethMdioHandler)(unsigned char reg, unsigned short val, void *arg);
+
+typedef struct {
+	unsigned long long	count[ETH_STAT_COUNT];	/* Totals since power on */
+	unsigned int		rate[ETH_STAT_COUNT];	/* Per second, over the last second */
+} eth_stats;
+
 void EthInit(void);
+void EthPoll(void);
 void EthShutdown(void);
 
+void EthGetLink(eth_link *link);
+int EthRegisterLinkHandler(ethLinkHandler handler);
+void EthUnregisterLinkHandler(ethLinkHandler handler);
+
+int EthSendFrame(pktbuf *packet);
+void EthGetStats(eth_stats *stats);
+const char *EthStatName(int index);
+
+void EthSetPromiscuous(int enable);
+void EthAddMulticast(unsigned char *mac);
+void EthDelMulticast(unsigned char *mac);
+
 unsigned short EthPHYRead(unsigned char reg);
 void EthPHYWrite(unsigned char reg, unsigned short val);
+int EthPHYReadAsync(unsigned char reg, ethMdioHandler handler, void *arg);
+int EthPHYWriteAsync(unsigned char reg, unsigned short val, ethMdioHandler handler, void *arg);
 
 #endif
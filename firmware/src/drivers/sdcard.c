@@ -43,9 +43,15 @@
 #define SD_CMD_SEND_CID			10		/* Read Card Identification Data */
 #define SD_CMD_READ_BLOCK		17
 #define SD_CMD_WRITE_BLOCK		24
+#define SD_CMD_WRITE_MULTIPLE	25
 #define SD_CMD_SEND_OP_COND		41		/* Activate card */
 #define SD_CMD_APP				55		/* Application specific prefix */
 
+/* Data tokens */
+#define SD_TOKEN_START			0xFE	/* Single block read or write */
+#define SD_TOKEN_START_MULTI	0xFC	/* Multiple block write */
+#define SD_TOKEN_STOP_MULTI		0xFD
+
 /* SD card R1 bit maps */
 #define SD_R1_IDLE				0x01
 #define SD_R1_ERASE_RESET		0x02
@@ -367,34 +373,50 @@ int FASTCODE sdcBlockRead(unsigned char *buf, unsigned int block, unsigned int c
 	return 1;
 }
 
+/* sdcWaitReady()
+ *   Waits for the end of card programming, returns 0 on timeout
+ */
+static int sdcWaitReady()
+{
+	unsigned int i;
+
+	for (i = 0; i < SD_TIMEOUT_WRITE; i++) {
+		if (sdcRecvByte() == 0xFF) return 1;
+	}
+
+	return 0;
+}
+
+/* sdcBlockWrite()
+ *   Writes blocks to the card. Several blocks are written with one
+ * WRITE_MULTIPLE_BLOCK command, card programs them without per-block
+ * command overhead.
+ */
 int sdcBlockWrite(unsigned char *buf, unsigned int block, unsigned int count)
 {
 	unsigned int i, b;
-	unsigned int blk, blkinc;
+	unsigned char cmd, token;
 
 	/* Check for card is ready */
 	if (card.state != CARD_STATE_READY) return 0;
+	if (!count) return 1;
 
 	/* Check for high capacity card */
-	if (card.hc) {
-		blk = block;
-		blkinc = 1;
-	} else {
-		blk = block * CARD_BLOCK_SIZE;
-		blkinc = CARD_BLOCK_SIZE;
+	if (!card.hc) block *= CARD_BLOCK_SIZE;
+
+	/* Send command */
+	cmd = (count > 1) ? SD_CMD_WRITE_MULTIPLE : SD_CMD_WRITE_BLOCK;
+	token = (count > 1) ? SD_TOKEN_START_MULTI : SD_TOKEN_START;
+	if (sdcCommand(cmd, block) != 0) {
+		sdcReleaseCS();
+		return 0;
 	}
 
 	/* Write blocks */
 	for (i = 0; i < count; i++) {
-		/* Send command */
-		if (sdcCommand(SD_CMD_WRITE_BLOCK, blk) != 0) {
-			sdcReleaseCS();
-			return 0;
-		}
-
 		/* Write block data */
 		sdcSendByte(0xFF);
-		sdcSendByte(0xFE);
+		sdcSendByte(token);
 		for (b = 0; b < CARD_BLOCK_SIZE; b++) {
 			sdcSendByte(*buf++);
 		}
@@ -406,16 +428,20 @@ int sdcBlockWrite(unsigned char *buf, unsigned int block, unsigned int count)
 		}
 
 		/* Wait for card ready */
-		for (b = 0; b < SD_TIMEOUT_WRITE; b++) {
-			if (sdcRecvByte() == 0xFF) break;
-		}
-		if (b == SD_TIMEOUT_WRITE) {
+		if (!sdcWaitReady()) {
 			sdcReleaseCS();
 			return 0;
 		}
+	}
 
-		/* Increment pointers */
-		blk += blkinc;
+	/* Stop multiple block write */
+	if (count > 1) {
+		sdcSendByte(SD_TOKEN_STOP_MULTI);
+		sdcSendByte(0xFF);
+		if (!sdcWaitReady()) {
+			sdcReleaseCS();
+			return 0;
+		}
 	}
 
 	/* OK */
@@ -0,0 +1,80 @@
+
+#include <config.h>
+#include <board.h>
+#include <aic/aic.h>
+
+#include "tstamp.h"
+
+
+/* ===== Free-running timebase on Timer2 ===== */
+
+/* Count of 16-bit counter overflows */
+static volatile unsigned int ts_high;
+
+static void ISR_Timer2()
+{
+	unsigned int status = AT91C_BASE_TC2->TC_SR;
+
+	if (status & AT91C_TC_COVFS) ts_high++;
+}
+
+/* tsRead()
+ *   Reads counter and overflow count consistently. Overflow which is not
+ * yet counted by the ISR is detected by pending interrupt.
+ */
+static unsigned int tsRead(unsigned int *low)
+{
+	unsigned int high, cv, pending;
+
+	do {
+		high = ts_high;
+		cv = AT91C_BASE_TC2->TC_CV & 0xFFFF;
+		pending = AT91C_BASE_AIC->AIC_IPR & (1 << AT91C_ID_TC2);
+	} while (high != ts_high);
+
+	/* Counter wrapped, but ISR has not run yet */
+	if (pending && (cv < 0x8000)) high++;
+
+	*low = cv;
+	return high;
+}
+
+/* ===== Exported functions ===== */
+
+void tsInit()
+{
+	ts_high = 0;
+
+	AT91C_BASE_PMC->PMC_PCER = (1 << AT91C_ID_TC2);
+	AT91C_BASE_TC2->TC_CCR = AT91C_TC_CLKDIS;
+	AT91C_BASE_TC2->TC_IDR = 0xFFFFFFFF;
+	AT91C_BASE_TC2->TC_CMR = AT91C_TC_CLKS_TIMER_DIV2_CLOCK
+                             | AT91C_TC_WAVESEL_UP
+                             | AT91C_TC_WAVE;
+	AT91C_BASE_TC2->TC_IER = AT91C_TC_COVFS;
+	AIC_ConfigureIT(AT91C_ID_TC2, 7, ISR_Timer2);
+	AIC_EnableIT(AT91C_ID_TC2);
+	AT91C_BASE_TC2->TC_CCR = AT91C_TC_CLKEN | AT91C_TC_SWTRG;
+}
+
+/* tsGetTicks()
+ *   Returns low 32 bits of the timebase, wraps in about 12 minutes
+ */
+unsigned int tsGetTicks()
+{
+	unsigned int high, low;
+
+	high = tsRead(&low);
+	return (high << 16) | low;
+}
+
+/* tsGetTicks64()
+ *   Returns full timebase value
+ */
+unsigned long long tsGetTicks64()
+{
+	unsigned int high, low;
+
+	high = tsRead(&low);
+	return ((unsigned long long)high << 16) | low;
+}
@@ -0,0 +1,14 @@
+
+#ifndef _TSTAMP_H
+#define _TSTAMP_H
+
+/* Timebase runs at MCK/8, 48 MHz / 8 */
+#define TS_TICKS_PER_SEC	6000000
+#define TS_TICKS_PER_US		(TS_TICKS_PER_SEC / 1000000)
+
+void tsInit(void);
+
+unsigned int tsGetTicks(void);
+unsigned long long tsGetTicks64(void);
+
+#endif
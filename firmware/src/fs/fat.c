@@ -49,6 +49,8 @@ struct fatfile {
 
 static unsigned int fatNextSector(Volume *vol, unsigned int sector)
 {
+	unsigned int cluster, offset;
+
 	/* If we are in root directory, stop in the last sector */
 	if ( sector == (vol->fat.datastart-1) ) return 0;
 	if ( sector < vol->fat.datastart) return sector + 1;
@@ -58,9 +60,50 @@ static unsigned int fatNextSector(Volume *vol, unsigned int sector)
 		return sector + 1;
 
 	/* Else we must read the fat table and lookup the next cluster */
-	/* But this is not implemented yet */
+	cluster = (sector - vol->fat.datastart) / vol->fat.clustersize + 2;
+	if (!volReadSector(vol, vol->fat.fatstart + (cluster * 2) / SECTOR_SIZE)) return 0;
+	offset = (cluster * 2) % SECTOR_SIZE;
+	cluster = vol->sector[offset] | (vol->sector[offset + 1] << 8);
+
+	/* End of chain, free or bad cluster */
+	if ( (cluster < 2) || (cluster >= 0xFFF7) ) return 0;
+
+	return vol->fat.datastart + (cluster - 2) * vol->fat.clustersize;
+}
+
+/* fatGetExtents()
+ *   Stores sectors of the cluster chain as <start sector>-<sector count>
+ * pairs, at most limit sectors. Returns number of pairs stored.
+ */
+static int fatGetExtents(Volume *vol, unsigned int sn, unsigned int *sectors, unsigned int maxsectors,
+						 unsigned int limit)
+{
+	unsigned int sc, count, n;
+
+	sc = 0;
+	count = 0;
+	while (sn && (count < limit)) {
+		/* Whole clusters are taken at once */
+		n = 1;
+		if ( (sn >= vol->fat.datastart) && !((sn - vol->fat.datastart) % vol->fat.clustersize) &&
+			 ((limit - count) >= vol->fat.clustersize) ) n = vol->fat.clustersize;
+
+		if ( sc && ((sectors[sc*2 - 2] + sectors[sc*2 - 1]) == (sn + vol->sectoroffset)) ) {
+			/* Contiguous sectors */
+			sectors[sc*2 - 1] += n;
+		} else {
+			/* File is fragmented, start new pair */
+			if (sc >= maxsectors) break;
+			sectors[sc*2] = sn + vol->sectoroffset;
+			sectors[sc*2 + 1] = n;
+			sc++;
+		}
 
-	return sector + 1;
+		count += n;
+		sn = fatNextSector(vol, sn + n - 1);
+	}
+
+	return sc;
 }
 
 static struct fatfile *fatFindRecord(Volume *vol, unsigned int sector, char *file)
@@ -148,7 +191,7 @@ int fatGetFileSectors(Volume *vol, char *file, unsigned int *sectors, unsigned i
 					  unsigned int *filesize)
 {
 	struct fatfile *ff;
-	unsigned int fs, sn, sc;
+	unsigned int fs, sn;
 
 	/* Check arguments */
 	if (!vol) return 0;
@@ -166,19 +209,41 @@ int fatGetFileSectors(Volume *vol, char *file, unsigned int *sectors, unsigned i
 	fs = ff->size;
 
 	/* Store sector-count pairs */
-	sc = 0;
-	if (sectors && maxsectors) {
-		*sectors = sn + vol->sectoroffset;
-		*(sectors+1) = 1;
-		sc = 1;
+	if (!sectors || !maxsectors) return 0;
+	return fatGetExtents(vol, sn, sectors, maxsectors, fs / SECTOR_SIZE + 1);
+}
 
-		while ( (sn = fatNextSector(vol, sn)) ) {
-			if (fs < SECTOR_SIZE) break;
-			fs -= SECTOR_SIZE;
+/* fatGetFileSpace()
+ *   Returns the whole cluster chain of the file as sector-count pairs
+ */
+int fatGetFileSpace(Volume *vol, char *file, unsigned int *sectors, unsigned int maxsectors)
+{
+	struct fatfile *ff;
+	unsigned int sn;
 
-			*(sectors+1) += 1;
-		}
-	}
+	if (!vol || !sectors || !maxsectors) return 0;
 
-	return sc;
+	ff = fatFindFile(vol, file);
+	if (!ff) return 0;
+
+	if (!ff->cluster) return 0;
+	sn = vol->fat.datastart + (ff->cluster - 2) * vol->fat.clustersize;
+
+	return fatGetExtents(vol, sn, sectors, maxsectors, 0xFFFFFFFF);
+}
+
+/* fatSetFileSize()
+ *   Writes new file size to the directory record
+ */
+int fatSetFileSize(Volume *vol, char *file, unsigned int filesize)
+{
+	struct fatfile *ff;
+
+	if (!vol) return 0;
+
+	ff = fatFindFile(vol, file);
+	if (!ff) return 0;
+
+	ff->size = filesize;
+	return volWriteSector(vol);
 }
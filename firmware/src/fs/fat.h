@@ -4,5 +4,7 @@
 
 int fatMount(Volume *vol);
 int fatGetFileSectors(Volume *vol, char *file, unsigned int *sectors, unsigned int maxsectors, unsigned int *filesize);
+int fatGetFileSpace(Volume *vol, char *file, unsigned int *sectors, unsigned int maxsectors);
+int fatSetFileSize(Volume *vol, char *file, unsigned int filesize);
 
 #endif
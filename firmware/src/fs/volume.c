@@ -61,7 +61,7 @@ int volMount(Volume *vol, Media *media)
 		if (ptable[0].ptype == 0) break;
 
 		/* Check size bounds of this partition */
-		scount = vol->media->size < 1;
+		scount = vol->media->size / SECTOR_SIZE;
 		if (!ptable[0].start || !ptable[0].size) break;
 		if (ptable[0].start > scount) break;
 		if ( (ptable[0].start + ptable[0].size) > scount) break;
@@ -97,6 +97,10 @@ void volUnmount(Volume *vol)
 {
 }
 
+/* volReadSector()
+ *   Reads volume sector to the cache, sector number is relative to the
+ * partition start
+ */
 int volReadSector(Volume *vol, unsigned int num)
 {
 	if (!vol) return 0;
@@ -107,7 +111,7 @@ int volReadSector(Volume *vol, unsigned int num)
 
 	/* Read one sector */
 	vol->sectornum = 0xFFFFFFFF;
-	if (vol->media->read(vol->media, num, vol->sector + vol->sectoroffset, 1, NULL, NULL))
+	if (vol->media->read(vol->media, num + vol->sectoroffset, vol->sector, 1, NULL, NULL))
 		return 0;
 
 	/* Save cached sector number */
@@ -116,6 +120,21 @@ int volReadSector(Volume *vol, unsigned int num)
 	return 1;
 }
 
+/* volWriteSector()
+ *   Writes cached sector back to the media
+ */
+int volWriteSector(Volume *vol)
+{
+	if (!vol) return 0;
+	if (!vol->media) return 0;
+	if (vol->sectornum == 0xFFFFFFFF) return 0;
+
+	if (vol->media->write(vol->media, vol->sectornum + vol->sectoroffset, vol->sector, 1, NULL, NULL))
+		return 0;
+
+	return 1;
+}
+
 /* volGetFileSectors()
  *   Return physical file location as <start sector>-<sector count> pairs.
  *
@@ -126,3 +145,20 @@ int volGetFileSectors(Volume *vol, char *file, unsigned int *sectors, unsigned i
 {
 	return fatGetFileSectors(vol, file, sectors, maxsectors, filesize);
 }
+
+/* volGetFileSpace()
+ *   Same as volGetFileSectors(), but returns all space allocated to the
+ * file regardless of its size. Used to overwrite preallocated files.
+ */
+int volGetFileSpace(Volume *vol, char *file, unsigned int *sectors, unsigned int maxsectors)
+{
+	return fatGetFileSpace(vol, file, sectors, maxsectors);
+}
+
+/* volSetFileSize()
+ *   Changes file size in the directory record, file space is not changed
+ */
+int volSetFileSize(Volume *vol, char *file, unsigned int filesize)
+{
+	return fatSetFileSize(vol, file, filesize);
+}
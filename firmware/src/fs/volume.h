@@ -36,7 +36,10 @@ Volume *volGetVolume(unsigned int index);
 int volMount(Volume *vol, Media *media);
 void volUnmount(Volume *vol);
 int volReadSector(Volume *vol, unsigned int num);
+int volWriteSector(Volume *vol);
 
 int volGetFileSectors(Volume *vol, char *file, unsigned int *sectors, unsigned int maxsectors, unsigned int *filesize);
+int volGetFileSpace(Volume *vol, char *file, unsigned int *sectors, unsigned int maxsectors);
+int volSetFileSize(Volume *vol, char *file, unsigned int filesize);
 
 #endif
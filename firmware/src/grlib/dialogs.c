@@ -2,6 +2,7 @@
 #include <config.h>
 #include <string.h>
 
+#include <drivers/tstamp.h>
 #include <grlib/grlib.h>
 #include <os/messages.h>
 
@@ -10,12 +11,24 @@
 
 /* ===== String Editor ===== */
 
+/* Letters mode is switched by long '#' press. Repeated presses of a key
+ * within DLG_MULTITAP_TIME cycle through its characters.
+ */
+#define DLG_MULTITAP_TIME	(TS_TICKS_PER_SEC)
+
+static const char * const dlg_keychars[10] = {
+	"0", "-1", "abc2", "def3", "ghi4", "jkl5", "mno6", "pqrs7", "tuv8", "wxyz9"
+};
+
 typedef struct {
 	char *			title;
 	char *			buffer;
 	unsigned int	maxlen;
 	DialogCallback	callback;
 	void *			p;
+	unsigned char	letters;		/* Letters mode */
+	unsigned char	lastkey;
+	unsigned int	lasttime;		/* Last key press, timebase ticks */
 } StringDialog;
 
 static StringDialog dlg_getstring;
@@ -40,6 +53,38 @@ static void dlgStringRedraw(StringDialog *dlg, rect_t *rect)
 	/* String */
 	font = grLoadFont(GR_FONT_BIG);
 	grTextOut(rect, font, 10, 41, GR_COLOR_BLACK, dlg->buffer);
+
+	/* Mode */
+	if (dlg->letters) {
+		font = grLoadFont(GR_FONT_SMALL);
+		grTextOut(rect, font, rect->w - 24, 28, GR_COLOR_BLUE, "abc");
+	}
+}
+
+/* dlgStringLetter()
+ *   Adds character of the key in letters mode, or changes the last one
+ */
+static void dlgStringLetter(StringDialog *dlg, unsigned short key)
+{
+	const char *chars, *c;
+	unsigned int now;
+	int l;
+
+	chars = dlg_keychars[key - '0'];
+	now = tsGetTicks();
+	l = strlen(dlg->buffer);
+
+	if ( l && (key == dlg->lastkey) && (now - dlg->lasttime < DLG_MULTITAP_TIME) ) {
+		c = strchr(chars, dlg->buffer[l-1]);
+		dlg->buffer[l-1] = (c && c[1]) ? c[1] : chars[0];
+	} else {
+		if (l >= (dlg->maxlen-1)) return;
+		dlg->buffer[l] = chars[0];
+		dlg->buffer[l+1] = 0;
+	}
+
+	dlg->lastkey = key;
+	dlg->lasttime = now;
 }
 
 static void dlgStringHandler(void *window, unsigned short msgCode, unsigned short msgParam, void *msgPtr, void *p)
@@ -66,6 +111,12 @@ static void dlgStringHandler(void *window, unsigned short msgCode, unsigned shor
 				msgUnregisterWindow(window);
 				if (dlg->callback) dlg->callback(DLG_OK, dlg->buffer, dlg->p);
 			}
+			if ( (msgParam >= '0') && (msgParam <= '9') && dlg->letters ) {
+				dlgStringLetter(dlg, msgParam);
+				msgInvalidateWindow(window);
+				break;
+			}
+			dlg->lastkey = 0;
 			if ( (msgParam >= '0') && (msgParam <= '9') ) {
 				l = strlen(dlg->buffer);
 				if (l >= (dlg->maxlen-1)) break;
@@ -94,6 +145,13 @@ static void dlgStringHandler(void *window, unsigned short msgCode, unsigned shor
 				dlg->buffer[0] = 0;
 				msgInvalidateWindow(window);
 			}
+			/* Press has added a dot already */
+			if (msgParam == '#') {
+				l = strlen(dlg->buffer);
+				if (l && (dlg->buffer[l-1] == '.')) dlg->buffer[l-1] = 0;
+				dlg->letters = !dlg->letters;
+				msgInvalidateWindow(window);
+			}
 			break;
 	}
 }
@@ -110,6 +168,8 @@ int dlgGetString(char *title, char *buffer, unsigned int maxlen, DialogCallback
 	sdlg->maxlen = maxlen;
 	sdlg->callback = cb;
 	sdlg->p = p;
+	sdlg->letters = 0;
+	sdlg->lastkey = 0;
 
 	/* Create dialog window */
 	wnd = msgRegisterWindow(title, 0, dlgStringHandler, sdlg);
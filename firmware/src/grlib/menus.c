@@ -140,7 +140,11 @@ static void menuMessageHandler(void *window, unsigned short msgCode, unsigned sh
 				mi = &menu->items[menu->selected];
 				/* Call menu handler, if exist */
 				if (menu->handler) {
-					if (menu->handler(MENU_ITEM_CLICK, mi)) return;
+					/* Handled, value may be changed in place */
+					if (menu->handler(MENU_ITEM_CLICK, mi)) {
+						msgInvalidateWindow(window);
+						return;
+					}
 				}
 				if (mi->submenu) {
 					menuShow(mi->submenu, window);
@@ -4,10 +4,12 @@
 #include <string.h>
 
 #include <drivers/ethernet.h>
+#include <drivers/tstamp.h>
 #include <fs/romfs.h>
 #include <grlib/grlib.h>
 #include <grlib/menus.h>
 #include <grlib/dialogs.h>
+#include <net/bridge.h>
 #include <net/ip.h>
 #include <net/dhcp.h>
 
@@ -24,8 +26,10 @@ static unsigned char circpos = 0;
 static char buf[50];
 static char menubuf[50];
 
-static unsigned int cntr_rx;
-static unsigned int cntr_tx;
+/* Bridge counters at the last refresh and rates since the previous one */
+static bri_counters cntr_last;
+static bri_counters cntr_rate;
+static unsigned int cntr_stamp;
 
 /* ===== Embedded applications ===== */
 
@@ -33,16 +37,31 @@ void shutdown(void);
 
 void app_vct(void);
 void app_ping(void);
+void app_trace(void);
 void app_update(void);
+void app_capture(void);
+void app_trafgen(void);
+void app_rfc2544(void);
+void app_y1564(void);
 
 /* ===== MENUS ===== */
 
 #define ID_VCT			101
 #define ID_PING			102
+#define ID_CAPTURE		103
+#define ID_TRAFGEN		104
+#define ID_RFC2544		105
+#define ID_Y1564		106
+#define ID_TRACE		107
 
 static const MenuItem itemsTests[] = {
 	{ID_VCT, "", NULL},
-	{ID_PING, "Ping", "ping.raw"}
+	{ID_PING, "Ping", "ping.raw"},
+	{ID_TRACE, "", NULL},
+	{ID_CAPTURE, "", NULL},
+	{ID_TRAFGEN, "", NULL},
+	{ID_RFC2544, "RFC 2544", NULL},
+	{ID_Y1564, "Y.1564", NULL}
 };
 static Menu menuTests = { itemsTests, sizeof(itemsTests) / sizeof(MenuItem), MENU_TYPE_ICONS };
 
@@ -312,6 +331,31 @@ static void guiMainScreen()
 	grTextOut(NULL, font, 176-fw, 132-fh, GR_COLOR_BLACK, "Ping");
 }
 
+/* guiUpdateRates()
+ *   Takes bridge counters snapshot and calculates per second rates
+ */
+static void guiUpdateRates()
+{
+	bri_counters now;
+	unsigned int stamp, elapsed;
+	int i, j;
+
+	briGetCounters(&now);
+	stamp = tsGetTicks();
+	elapsed = stamp - cntr_stamp;
+	if (!elapsed) return;
+
+	for (i = 0; i < BRI_IF_COUNT; i++) {
+		for (j = 0; j < BRI_CNT_COUNT; j++) {
+			cntr_rate.count[i][j] = (unsigned long long)(now.count[i][j] - cntr_last.count[i][j]) *
+				TS_TICKS_PER_SEC / elapsed;
+		}
+	}
+
+	cntr_last = now;
+	cntr_stamp = stamp;
+}
+
 static void guiMessageHandler(void *window, unsigned short msgCode, unsigned short msgParam, void *msgPtr, void *p)
 {
 	switch (msgCode) {
@@ -331,16 +375,28 @@ static void guiMessageHandler(void *window, unsigned short msgCode, unsigned sho
 		case MSG_MENUCLICK:
 			if (msgParam == ID_VCT) app_vct();
 			if (msgParam == ID_PING) app_ping();
+			if (msgParam == ID_TRACE) app_trace();
+			if (msgParam == ID_CAPTURE) app_capture();
+			if (msgParam == ID_TRAFGEN) app_trafgen();
+			if (msgParam == ID_RFC2544) app_rfc2544();
+			if (msgParam == ID_Y1564) app_y1564();
 			if (msgParam == ID_UTILS_UPDATE) app_update();
 			break;
 
 		case MSG_TIMER:
 			ipTimers();
+			briTimers();
+			guiUpdateRates();
 			guiStatusLine();
 			break;
 	}
 }
 
+static void guiLinkHandler(eth_link *link)
+{
+	guiStatusLine();
+}
+
 /* ===== Exported functions ===== */
 
 void guiStatusLine()
@@ -349,7 +405,7 @@ void guiStatusLine()
 	int x;
 	unsigned int ipad;
 	struct romfs_file *file;
-	unsigned short phy_status;
+	eth_link link;
 	unsigned char phy_speed;
 
 	grFillRect(0, 0, 176, 19, GR_COLOR_WHITE);
@@ -362,13 +418,13 @@ void guiStatusLine()
 	grTextOut(NULL, font, 150, 2, GR_COLOR_BLUE, buf);
 
 	/* Ethernet interface speed */
-	phy_status = EthPHYRead(17);
+	EthGetLink(&link);
 	phy_speed = 0;
-	if (phy_status & PHY_REG17_LINK) {
-		if (phy_status & PHY_REG17_100) {
-			if (phy_status & PHY_REG17_FD) phy_speed = 4; else phy_speed = 3;
+	if (link.flags & ETH_LINK_UP) {
+		if (link.flags & ETH_LINK_100) {
+			if (link.flags & ETH_LINK_FD) phy_speed = 4; else phy_speed = 3;
 		} else {
-			if (phy_status & PHY_REG17_FD) phy_speed = 2; else phy_speed = 1;
+			if (link.flags & ETH_LINK_FD) phy_speed = 2; else phy_speed = 1;
 		}
 	}
 	font = grLoadFont(GR_FONT_SMALL);
@@ -382,7 +438,7 @@ void guiStatusLine()
 	x += guiSpeedItem(font, x, 2, "100FD", 1, phy_speed == 4);
 	x += 3;
 
-	if ( (phy_status & PHY_REG17_LINK) && (phy_status & PHY_REG17_MDIX) ) {
+	if (link.flags & ETH_LINK_MDIX) {
 		grTextOut(NULL, font, x, 2, GR_COLOR_RED, "X");
 	}
 
@@ -391,10 +447,10 @@ void guiStatusLine()
 	sprintf(buf,  "%u.%u.%u.%u", (ipad >> 24) & 0xFF, (ipad >> 16) & 0xFF, (ipad >> 8) & 0xFF, ipad & 0xFF);
 	grTextOut(NULL, font, 2, 10, GR_COLOR_BLACK, buf);
 
-	/* RX and TX counters */
-	sprintf(buf, "RX %u", cntr_rx);
+	/* Local stack RX and TX frame rates */
+	sprintf(buf, "RX %u/s", cntr_rate.count[BRI_IF_LOCAL][BRI_CNT_TX_FRAMES]);
 	grTextOut(NULL, font, 100, 2, GR_COLOR_BLACK, buf);
-	sprintf(buf, "TX %u", cntr_tx);
+	sprintf(buf, "TX %u/s", cntr_rate.count[BRI_IF_LOCAL][BRI_CNT_RX_FRAMES]);
 	grTextOut(NULL, font, 100, 10, GR_COLOR_BLACK, buf);
 
 	/* Battery status */
@@ -402,17 +458,15 @@ void guiStatusLine()
 	if (file) grImageOut(NULL, 169, 1, file->data);
 }
 
-void guiUpdateCounters(unsigned int rx, unsigned int tx)
-{
-	cntr_rx = rx;
-	cntr_tx = tx;
-}
-
 void guiStart()
 {
 	void *wnd;
 
+	briGetCounters(&cntr_last);
+	cntr_stamp = tsGetTicks();
+
 	guiStatusLine();
+	EthRegisterLinkHandler(guiLinkHandler);
 
 	/* Register main window */
 	wnd = msgRegisterWindow("Main Window", 0, guiMessageHandler, NULL);
@@ -4,7 +4,6 @@
 
 
 void guiStatusLine(void);
-void guiUpdateCounters(unsigned int rx, unsigned int tx);
 void guiStart(void);
 
 #endif
@@ -17,6 +17,7 @@
 #include <drivers/sdcard.h>
 #include <drivers/audio.h>
 #include <drivers/eeprom.h>
+#include <drivers/tstamp.h>
 #include <grlib/grlib.h>
 #include <usb/usbdevices.h>
 #include <net/bridge.h>
@@ -189,6 +190,9 @@ int main()
 	/* Configure real-time clock */
 	AT91C_BASE_RTTC->RTTC_RTMR = AT91C_RTTC_RTTRST | 32;
 
+	/* Start high resolution timebase */
+	tsInit();
+
 	tmrInit();
 
 	// Initialize ethernet controller
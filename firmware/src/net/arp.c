@@ -102,6 +102,7 @@ void arpPacketHandler(unsigned char *packet, unsigned short size)
 			buf.next = NULL;
 			buf.data = (unsigned char *)arp;
 			buf.len = sizeof(arp_frame_hdr);
+			buf.flags = 0;
 			ifSendPacket(arp->ar_tha, ETH_TYPE_ARP, &buf);
 			break;
 
@@ -183,5 +184,6 @@ void arpSendRequest(unsigned int ipad)
 	buf.next = NULL;
 	buf.data = (unsigned char *)&arp;
 	buf.len = sizeof(arp);
+	buf.flags = 0;
 	ifSendPacket((unsigned char *)"\xFF\xFF\xFF\xFF\xFF\xFF", ETH_TYPE_ARP, &buf);
 }
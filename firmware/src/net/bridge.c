@@ -2,36 +2,70 @@
 #include <config.h>
 #include <string.h>
 
-#include <gui.h>
+#include <drivers/ethernet.h>
 #include <net/arp.h>
 #include <net/ip.h>
+#include <net/pktpool.h>
+#include <os/irq.h>
 
 #include "bridge.h"
 
 
 /* ===== Bridge interfaces ===== */
 
-#define MAX_INTERFACES		3
+#define MAX_INTERFACES		BRI_IF_COUNT
 
 struct iface {
 	char *			name;
 	ifSendHandler	ifsend;
+	ifReleaseHandler ifrelease;
 	unsigned char	ifindex;
 	unsigned char	flags;
 	unsigned char	macad[6];
-	unsigned int	rxcnt;
-	unsigned int	txcnt;
 };
 
 static struct iface iflist[MAX_INTERFACES];
 
+/* ===== Bridge counters ===== */
+
+static unsigned int bricnt[MAX_INTERFACES][BRI_CNT_COUNT];
+
+#define briCount(iface, index) ( bricnt[iface][index]++ )
+
+static const char * const cntnames[BRI_CNT_COUNT] = {
+	"RxFrames", "RxBytes", "TxFrames", "TxBytes", "Filtered", "Runt",
+	"QueueFull", "PoolEmpty", "TxFull", "TxSize", "NoARP"
+};
+
+/* ===== MAC address table ===== */
+
+#define BRI_MAC_BUCKETS		32
+#define BRI_MAC_WAYS		4
+#define BRI_MAC_AGE			600		/* Entry lifetime, in briTimers() ticks (5 min) */
+
+struct macentry {
+	unsigned char	macad[6];
+	unsigned char	iface;
+	unsigned short	expire;			/* Zero for free entries */
+};
+
+static struct macentry mactable[BRI_MAC_BUCKETS][BRI_MAC_WAYS];
+
+#define macHash(mac) ( ((mac)[3] ^ (mac)[4] ^ (mac)[5]) & (BRI_MAC_BUCKETS-1) )
+
 /* ===== Local interface data ===== */
 
 #define LOCAL_MTU			1518
-#define LOCAL_QUEUE_SIZE	2
+#define LOCAL_QUEUE_SIZE	8
+
+/* Local receive queue entry */
+struct lqentry {
+	pktbuf *		packet;		/* Queued frame */
+	unsigned char	iface;		/* Source interface */
+	unsigned char	loaned;		/* Frame buffer belongs to the source interface, pool buffer otherwise */
+};
 
-static unsigned char localRecvData[LOCAL_QUEUE_SIZE][LOCAL_MTU];
-static unsigned short localRecvSizes[LOCAL_QUEUE_SIZE];
+static struct lqentry localQueue[LOCAL_QUEUE_SIZE];
 static unsigned char lqFirst;
 static unsigned char lqLast;
 
@@ -39,40 +73,133 @@ static unsigned char lqLast;
 
 static unsigned char if_addr[6];
 
+/* Frame capture tap */
+static briTapHandler britap;
+
+/* Local receive hook */
+static briRecvHook brihook;
+
+/* Receive time of the frame being processed */
+static unsigned int lqStamp;
+
 
 /* ===== Local interface functions ===== */
 
-static void ifRecvPacket(pktbuf *packet)
+/* lqPut()
+ *   Puts frame to the local receive queue, returns 0 if it is full. Frames
+ * come from EthPoll() and from the USB interrupt, which may preempt it, so
+ * the entry is taken and published with IRQ locked.
+ */
+static int lqPut(unsigned char iface, pktbuf *packet, unsigned char loaned, unsigned short size)
+{
+	unsigned int cpsr;
+
+	cpsr = irqLock();
+	if (lqNext(lqLast) == lqFirst) {
+		briCount(BRI_IF_LOCAL, BRI_CNT_DROP_QUEUE);
+		irqUnlock(cpsr);
+		return 0;
+	}
+
+	localQueue[lqLast].packet = packet;
+	localQueue[lqLast].iface = iface;
+	localQueue[lqLast].loaned = loaned;
+	lqLast = lqNext(lqLast);
+
+	briCount(BRI_IF_LOCAL, BRI_CNT_TX_FRAMES);
+	bricnt[BRI_IF_LOCAL][BRI_CNT_TX_BYTES] += size;
+	irqUnlock(cpsr);
+
+	return 1;
+}
+
+/* ifAccept()
+ *   Checks whether the local stack would consume the frame, looking only at
+ * the first chunk: ARP for our IP address and IPv4 to our address. Frames
+ * with headers split across chunks are accepted and left to the stack.
+ */
+static int ifAccept(pktbuf *packet)
 {
-	unsigned char next;
 	unsigned char *data;
-	unsigned short size;
-	pktbuf *buf;
+	unsigned int ipad, dest;
+
+	data = packet->data;
+	ipad = ipGetAddress();
+
+	switch ((data[12] << 8) | data[13]) {
+		case ETH_TYPE_ARP:
+			/* Target IP address is at offset 24 of ARP header */
+			if (packet->len < 14 + 28) return 1;
+			dest = (data[38] << 24) | (data[39] << 16) | (data[40] << 8) | data[41];
+			return dest == ipad;
+
+		case ETH_TYPE_IP:
+			/* Destination address is at offset 16 of IP header */
+			if (packet->len < 14 + 20) return 1;
+			dest = (data[30] << 24) | (data[31] << 16) | (data[32] << 8) | data[33];
+			return dest == ipad;
+	}
 
-	/* Skip packet if queue is full */
-	next = lqNext(lqLast);
-	if (next == lqFirst) return;
+	return 0;
+}
 
-	/* Copy packet to queue */
-	data = localRecvData[lqLast];
-	size = 0;
-	for (buf = packet; buf; buf = buf->next) {
-		/* Skip large packets */
-		size += buf->len;
-		if (size > LOCAL_MTU) return;
+/* ifRecvPacket()
+ *   Queues frame for the local stack. Single-chunk frames from interfaces
+ * with release handler are queued by reference, returns 1 in this case.
+ * Pool buffers are queued by reference too, other frames are copied to
+ * the pool.
+ */
+static int ifRecvPacket(unsigned char iface, pktbuf *packet, unsigned short size)
+{
+	unsigned char *data;
+	pktbuf *buf, *copy;
 
-		/* Copy packet data */
+	/* Skip packet if queue is full, lqPut() checks again under lock */
+	if (lqNext(lqLast) == lqFirst) {
+		briCount(BRI_IF_LOCAL, BRI_CNT_DROP_QUEUE);
+		return 0;
+	}
+
+	/* Loan frame buffer from the source interface */
+	if (!packet->next && iflist[iface].ifrelease) {
+		return lqPut(iface, packet, 1, size);
+	}
+
+	/* Take reference to the pool buffer */
+	if (!packet->next && (packet->flags & PKT_FLAG_POOL)) {
+		pktRef(packet);
+		if (!lqPut(iface, packet, 0, size)) pktFree(packet);
+		return 0;
+	}
+
+	/* Skip large packets */
+	if (size > LOCAL_MTU) {
+		briCount(BRI_IF_LOCAL, BRI_CNT_DROP_TX_SIZE);
+		return 0;
+	}
+
+	/* Copy packet to the pool buffer */
+	copy = pktAlloc(PKT_USER_LOCAL);
+	if (!copy) {
+		briCount(BRI_IF_LOCAL, BRI_CNT_DROP_POOL);
+		return 0;
+	}
+
+	data = copy->data;
+	for (buf = packet; buf; buf = buf->next) {
 		memcpy(data, buf->data, buf->len);
 		data += buf->len;
 	}
-	localRecvSizes[lqLast] = size;
+	copy->len = size;
+	copy->tstamp = packet->tstamp;
 
-	/* Increment queue pointer */
-	lqLast = next;
+	if (!lqPut(iface, copy, 0, size)) pktFree(copy);
+	return 0;
 }
 
 void ifRecvPoll()
 {
+	struct lqentry *entry;
 	unsigned char *data;
 	unsigned short size;
 	unsigned short type;
@@ -80,8 +207,10 @@ void ifRecvPoll()
 	/* Process packets in queue */
 	while (lqFirst != lqLast) {
 		/* Get first packet from queue */
-		data = localRecvData[lqFirst];
-		size = localRecvSizes[lqFirst];
+		entry = &localQueue[lqFirst];
+		data = entry->packet->data;
+		size = entry->packet->len;
+		lqStamp = entry->packet->tstamp;
 
 		do {
 			/* Skip truncated packets */
@@ -101,12 +230,22 @@ void ifRecvPoll()
 			}
 		} while (0);
 
+		/* Return frame buffer to the owner */
+		if (entry->loaned) {
+			iflist[entry->iface].ifrelease(entry->packet);
+		} else {
+			pktFree(entry->packet);
+		}
+
 		/* Move queue pointer */
 		lqFirst = lqNext(lqFirst);
 	}
 }
 
-void ifSendPacket(unsigned char *dest, unsigned short proto, pktbuf *packet)
+/* ifSendPacket()
+ *   Sends packet from the local stack, returns 0 if it was dropped
+ */
+int ifSendPacket(unsigned char *dest, unsigned short proto, pktbuf *packet)
 {
 	unsigned char ethhdr[14];
 	pktbuf buf;
@@ -125,7 +264,10 @@ void ifSendPacket(unsigned char *dest, unsigned short proto, pktbuf *packet)
 	buf.next = packet;
 	buf.data = ethhdr;
 	buf.len = sizeof(ethhdr);
-	briPacketRecv(BRI_IF_LOCAL, &buf);
+	buf.flags = 0;
+	if (briPacketRecv(BRI_IF_LOCAL, &buf) & BRI_RECV_DROPPED) return 0;
+
+	return 1;
 }
 
 unsigned char *ifGetAddress()
@@ -133,12 +275,86 @@ unsigned char *ifGetAddress()
 	return iflist[BRI_IF_LOCAL].macad;
 }
 
+/* ifGetRecvStamp()
+ *   Returns receive time of the frame passed to protocol handlers
+ */
+unsigned int ifGetRecvStamp()
+{
+	return lqStamp;
+}
+
+/* ===== MAC address table functions ===== */
+
+/* briLearn()
+ *   Remembers interface behind the source address
+ */
+static void briLearn(unsigned char iface, unsigned char *mac)
+{
+	struct macentry *bucket, *entry;
+	unsigned int cpsr;
+	int i;
+
+	/* Ethernet frames are learned from the main loop, USB ones from the interrupt */
+	cpsr = irqLock();
+	bucket = mactable[macHash(mac)];
+
+	/* Known address, free or oldest entry is replaced otherwise */
+	entry = &bucket[0];
+	for (i = 0; i < BRI_MAC_WAYS; i++) {
+		if ( bucket[i].expire && !memcmp(bucket[i].macad, mac, 6) ) {
+			entry = &bucket[i];
+			break;
+		}
+		if (bucket[i].expire < entry->expire) entry = &bucket[i];
+	}
+
+	memcpy(entry->macad, mac, 6);
+	entry->iface = iface;
+	entry->expire = BRI_MAC_AGE;
+	irqUnlock(cpsr);
+}
+
+/* briLookup()
+ *   Returns interface behind the address, or MAX_INTERFACES if unknown
+ */
+static unsigned char briLookup(unsigned char *mac)
+{
+	struct macentry *bucket;
+	int i;
+
+	bucket = mactable[macHash(mac)];
+	for (i = 0; i < BRI_MAC_WAYS; i++) {
+		if ( bucket[i].expire && !memcmp(bucket[i].macad, mac, 6) ) return bucket[i].iface;
+	}
+
+	return MAX_INTERFACES;
+}
+
+/* briFlush()
+ *   Forgets all addresses behind the interface
+ */
+static void briFlush(unsigned char iface)
+{
+	int i, j;
+
+	for (i = 0; i < BRI_MAC_BUCKETS; i++) {
+		for (j = 0; j < BRI_MAC_WAYS; j++) {
+			if (mactable[i][j].iface == iface) mactable[i][j].expire = 0;
+		}
+	}
+}
+
 /* ===== Ethernet bridge functions ===== */
 
 void briInit()
 {
 	/* Initialize variables */
 	memset(iflist, 0, sizeof(iflist));
+	memset(mactable, 0, sizeof(mactable));
+	memset(bricnt, 0, sizeof(bricnt));
+	britap = NULL;
+	brihook = NULL;
+	pktInit();
 
 	/* Initialize protocol handlers */
 	ipInit();
@@ -150,37 +366,190 @@ void briInit()
 	if_addr[3] = 0x03;
 	if_addr[4] = 0x00;
 	if_addr[5] = 0x02;
-	briIfRegister(0, "Local Interface", ifRecvPacket, if_addr);
+	briIfRegister(BRI_IF_LOCAL, "Local Interface", NULL, NULL, if_addr);
 }
 
 /* briPacketRecv()
- *   Handles incoming packets from interfaces
+ *   Handles incoming packets from interfaces. Source addresses are learned,
+ * frames to known unicast addresses go to one interface only, others are
+ * flooded. If BRI_RECV_LOANED is returned, packet buffer must stay untouched
+ * until interface release handler is called.
  */
-void briPacketRecv(unsigned char iface, pktbuf *packet)
+int briPacketRecv(unsigned char iface, pktbuf *packet)
 {
-	int i;
+	int i, result;
+	unsigned char *dest, out;
+	unsigned short size;
+	pktbuf *buf;
 
-	if (iface >= MAX_INTERFACES) return;
+	if (iface >= MAX_INTERFACES) return 0;
 
-	iflist[iface].rxcnt++;
+	size = 0;
+	for (buf = packet; buf; buf = buf->next) size += buf->len;
+	briCount(iface, BRI_CNT_RX_FRAMES);
+	bricnt[iface][BRI_CNT_RX_BYTES] += size;
+
+	if (britap) britap(iface, packet, size);
+
+	/* Ethernet header is always in the first chunk */
+	if (packet->len < 14) {
+		briCount(iface, BRI_CNT_DROP_RUNT);
+		return BRI_RECV_DROPPED;
+	}
+	dest = packet->data;
+
+	/* Learn source address, it is never multicast */
+	if ( (iface != BRI_IF_LOCAL) && !(dest[6] & 1) ) briLearn(iface, &dest[6]);
+
+	/* Find destination interface */
+	if (dest[0] & 1) {
+		out = MAX_INTERFACES;
+	} else if (!memcmp(dest, iflist[BRI_IF_LOCAL].macad, 6)) {
+		out = BRI_IF_LOCAL;
+	} else {
+		out = briLookup(dest);
+		/* Destination is on the same segment */
+		if (out == iface) {
+			briCount(iface, BRI_CNT_FILTERED);
+			return 0;
+		}
+	}
+
+	/* Queue packet for the local stack if it will be consumed there */
+	result = 0;
+	if ( (iface != BRI_IF_LOCAL) && ((out == BRI_IF_LOCAL) || (out == MAX_INTERFACES)) ) {
+		if (!ifAccept(packet)) {
+			briCount(BRI_IF_LOCAL, BRI_CNT_FILTERED);
+		} else if (brihook && brihook(packet, size)) {
+			briCount(BRI_IF_LOCAL, BRI_CNT_TX_FRAMES);
+			bricnt[BRI_IF_LOCAL][BRI_CNT_TX_BYTES] += size;
+		} else if (ifRecvPacket(iface, packet, size)) {
+			result |= BRI_RECV_LOANED;
+		}
+	}
 
-	/* Send packet to all other interfaces */
+	/* Send packet to destination interface or flood it */
 	for (i = 0; i < MAX_INTERFACES; i++) if (i != iface) {
-		if (iflist[i].ifsend) {
-			iflist[i].ifsend(packet);
-			iflist[i].txcnt++;
+		if ( (out != MAX_INTERFACES) && (out != i) ) continue;
+		if (!iflist[i].ifsend) continue;
+
+		switch (iflist[i].ifsend(packet)) {
+			case IF_SEND_OK:
+				briCount(i, BRI_CNT_TX_FRAMES);
+				bricnt[i][BRI_CNT_TX_BYTES] += size;
+				break;
+			case IF_SEND_OVERSIZE:
+				briCount(i, BRI_CNT_DROP_TX_SIZE);
+				result |= BRI_RECV_DROPPED;
+				break;
+			default:
+				briCount(i, BRI_CNT_DROP_TX_FULL);
+				result |= BRI_RECV_DROPPED;
+				break;
 		}
 	}
 
-	guiUpdateCounters(iflist[BRI_IF_LOCAL].txcnt, iflist[BRI_IF_LOCAL].rxcnt);
+	return result;
+}
+
+/* briUpdateFilter()
+ *   Ethernet receives all frames only while some other interface consumes
+ * bridged traffic or capture tap is set, otherwise EMAC filters frames for
+ * the local stack
+ */
+static void briUpdateFilter()
+{
+	int i, bridged;
+
+	if (!iflist[BRI_IF_ETHERNET].ifsend) return;
+
+	bridged = (britap != NULL);
+	for (i = 0; i < MAX_INTERFACES; i++) {
+		if ( (i == BRI_IF_LOCAL) || (i == BRI_IF_ETHERNET) ) continue;
+		if (iflist[i].ifsend) bridged = 1;
+	}
+
+	EthSetPromiscuous(bridged);
 }
 
-void briIfRegister(unsigned char ifindex, char *ifname, ifSendHandler ifsend, unsigned char *ifaddr)
+void briIfRegister(unsigned char ifindex, char *ifname, ifSendHandler ifsend,
+				   ifReleaseHandler ifrelease, unsigned char *ifaddr)
 {
 	if (ifindex >= MAX_INTERFACES) return;
 
 	iflist[ifindex].name = ifname;
 	iflist[ifindex].ifindex = ifindex;
 	iflist[ifindex].ifsend = ifsend;
+	iflist[ifindex].ifrelease = ifrelease;
 	if (ifaddr) memcpy(iflist[ifindex].macad, ifaddr, 6);
+
+	briUpdateFilter();
+}
+
+/* briIfUnregister()
+ *   Removes interface from the bridge. Interface must not have frames
+ * loaned to the local stack.
+ */
+void briIfUnregister(unsigned char ifindex)
+{
+	if ( (ifindex >= MAX_INTERFACES) || (ifindex == BRI_IF_LOCAL) ) return;
+
+	memset(&iflist[ifindex], 0, sizeof(struct iface));
+	briFlush(ifindex);
+
+	briUpdateFilter();
+}
+
+/* briTimers()
+ *   Ages MAC address table, called twice a second
+ */
+void briTimers()
+{
+	int i, j;
+
+	for (i = 0; i < BRI_MAC_BUCKETS; i++) {
+		for (j = 0; j < BRI_MAC_WAYS; j++) {
+			if (mactable[i][j].expire) mactable[i][j].expire--;
+		}
+	}
+}
+
+/* briSetTap()
+ *   Sets capture tap handler, NULL removes it
+ */
+void briSetTap(briTapHandler tap)
+{
+	britap = tap;
+	briUpdateFilter();
+}
+
+/* briSetRecvHook()
+ *   Sets local receive hook, NULL removes it
+ */
+void briSetRecvHook(briRecvHook hook)
+{
+	brihook = hook;
+}
+
+/* briCountDrop()
+ *   Counts frame dropped by the interface driver or the local stack
+ */
+void briCountDrop(unsigned char iface, int reason)
+{
+	if ( (iface >= MAX_INTERFACES) || (reason < 0) || (reason >= BRI_CNT_COUNT) ) return;
+	briCount(iface, reason);
+}
+
+/* briGetCounters()
+ *   Copies all bridge counters
+ */
+void briGetCounters(bri_counters *cnt)
+{
+	memcpy(cnt->count, bricnt, sizeof(bricnt));
+}
+
+const char *briCounterName(int index)
+{
+	if ( (index < 0) || (index >= BRI_CNT_COUNT) ) return "";
+	return cntnames[index];
 }
@@ -6,18 +6,25 @@
 #define BRI_IF_LOCAL		0
 #define BRI_IF_ETHERNET		1
 #define BRI_IF_USB			2
+#define BRI_IF_COUNT		3
 
 /* Ethernet protocol types */
 #define ETH_TYPE_IP			0x0800
 #define ETH_TYPE_ARP		0x0806
 
 
+/* Packet buffer flags */
+#define PKT_FLAG_STATIC		0x01	/* Data is in RAM and never changes, may be sent by reference */
+#define PKT_FLAG_POOL		0x02	/* Packet pool buffer, holders take references with pktRef() */
+
 /* Packet buffer descriptor */
 typedef struct packetbuffer pktbuf;
 struct packetbuffer {
 	pktbuf *		next;
 	unsigned char * data;
 	unsigned short	len;
+	unsigned char	flags;
+	unsigned int	tstamp;		/* Receive or transmit time, timebase ticks */
 };
 
 /* Byte swapping functions */
@@ -41,14 +48,70 @@ struct packetbuffer {
 #define htonl(x) __byte_swap_long(x)
 
 
-typedef void (*ifSendHandler)(pktbuf *packet);
+/* briPacketRecv() result flags */
+#define BRI_RECV_LOANED		0x01	/* Frame is kept by the local stack until released */
+#define BRI_RECV_DROPPED	0x02	/* Frame was refused by some interface */
+
+/* Interface send handler results */
+#define IF_SEND_OK			0
+#define IF_SEND_FULL		1	/* Transmit queue is full */
+#define IF_SEND_OVERSIZE	2	/* Frame is too large for the interface */
+
+
+/* Bridge counters, kept for every interface. Frames are received from
+ * the interface by the bridge and transmitted to the interface by the
+ * bridge, so for the local interface TX means delivered to the local stack.
+ */
+#define BRI_CNT_RX_FRAMES		0
+#define BRI_CNT_RX_BYTES		1
+#define BRI_CNT_TX_FRAMES		2		/* Frames accepted by the interface */
+#define BRI_CNT_TX_BYTES		3
+#define BRI_CNT_FILTERED		4		/* Destination is behind the source interface or, for the
+										 * local interface, frame is not for the local stack */
+#define BRI_CNT_DROP_RUNT		5		/* Received frame is shorter than Ethernet header */
+#define BRI_CNT_DROP_QUEUE		6		/* Local receive queue is full */
+#define BRI_CNT_DROP_POOL		7		/* No free packet pool buffer */
+#define BRI_CNT_DROP_TX_FULL	8		/* Interface transmit queue is full */
+#define BRI_CNT_DROP_TX_SIZE	9		/* Frame is too large for the interface */
+#define BRI_CNT_DROP_NO_ARP		10		/* Local stack has no ARP entry for the next hop */
+#define BRI_CNT_COUNT			11
+
+/* Counters snapshot. Counters are 32-bit and wrap, they are incremented
+ * without locking so the snapshot is not atomic across counters.
+ */
+typedef struct {
+	unsigned int	count[BRI_IF_COUNT][BRI_CNT_COUNT];
+} bri_counters;
+
+typedef int (*ifSendHandler)(pktbuf *packet);
+typedef void (*ifReleaseHandler)(pktbuf *packet);
+
+/* Tap handler sees every frame entering the bridge, may be called from
+ * interrupt handlers. Frame must not be modified or kept.
+ */
+typedef void (*briTapHandler)(unsigned char iface, pktbuf *packet, unsigned short size);
+
+/* Receive hook sees frames for the local stack before they are queued, may
+ * be called from interrupt handlers. Returns nonzero if frame is consumed
+ * and must not be queued.
+ */
+typedef int (*briRecvHook)(pktbuf *packet, unsigned short size);
 
 void ifRecvPoll(void);
-void ifSendPacket(unsigned char *dest, unsigned short proto, pktbuf *packet);
+int ifSendPacket(unsigned char *dest, unsigned short proto, pktbuf *packet);
 unsigned char *ifGetAddress(void);
+unsigned int ifGetRecvStamp(void);
 
 void briInit(void);
-void briPacketRecv(unsigned char iface, pktbuf *packet);
-void briIfRegister(unsigned char ifindex, char *ifname, ifSendHandler ifsend, unsigned char *ifaddr);
+int briPacketRecv(unsigned char iface, pktbuf *packet);
+void briIfRegister(unsigned char ifindex, char *ifname, ifSendHandler ifsend,
+				   ifReleaseHandler ifrelease, unsigned char *ifaddr);
+void briIfUnregister(unsigned char ifindex);
+void briTimers(void);
+void briSetTap(briTapHandler tap);
+void briSetRecvHook(briRecvHook hook);
+void briCountDrop(unsigned char iface, int reason);
+void briGetCounters(bri_counters *cnt);
+const char *briCounterName(int index);
 
 #endif
@@ -0,0 +1,366 @@
+
+#include <config.h>
+#include <string.h>
+
+#include <drivers/sdcard.h>
+#include <drivers/tstamp.h>
+#include <fs/volume.h>
+#include <os/irq.h>
+#include <net/bridge.h>
+#include <net/filter.h>
+
+#include "capture.h"
+
+
+#if (CAP_RING_SIZE & (CAP_RING_SIZE - 1)) || (CAP_RING_SIZE < CAP_WRITE_SECTORS * SECTOR_SIZE)
+#error CAP_RING_SIZE must be a power of two and hold CAP_WRITE_SECTORS
+#endif
+
+/* pcap file format, nanosecond timestamps */
+#define PCAP_MAGIC_NSEC			0xA1B23C4D
+#define PCAP_LINKTYPE_ETHERNET	1
+
+struct pcap_hdr {
+	unsigned int	magic;
+	unsigned short	major;
+	unsigned short	minor;
+	int				thiszone;
+	unsigned int	sigfigs;
+	unsigned int	snaplen;
+	unsigned int	network;
+} PACKED;
+
+struct pcap_rec {
+	unsigned int	sec;
+	unsigned int	nsec;
+	unsigned int	incl_len;		/* Bytes saved */
+	unsigned int	orig_len;		/* Frame length */
+} PACKED;
+
+/* Drop marker frame: Ethernet header and lost frames count */
+#define CAP_MARKER_SIZE		(14 + 4)
+
+/* ===== Capture data ===== */
+
+/* Ring is filled by the bridge tap, possibly from interrupt handlers, and
+ * written to the card from the main loop. Positions are free running byte
+ * counters.
+ */
+static unsigned char capring[CAP_RING_SIZE] __attribute__ ((aligned(4)));
+static volatile unsigned int caphead;		/* Bytes put to the ring */
+static volatile unsigned int captail;		/* Bytes written to the card */
+static unsigned int capdrops;				/* Drops not reported in the file yet */
+
+/* Capture file location */
+static Volume *capvol;
+static unsigned int capextents[CAP_MAX_EXTENTS * 2];
+static int capcount;
+static int capextent;						/* Extent being written */
+static unsigned int capsector;				/* Sector in the extent */
+
+static unsigned long long capstart;
+static cap_stats capstats;
+static flt_program capfilter;
+
+
+/* ===== Internal functions ===== */
+
+/* capPut()
+ *   Copies data to the ring, space must be checked by caller
+ */
+static void capPut(const void *data, unsigned int size)
+{
+	unsigned int pos, n;
+
+	pos = caphead & (CAP_RING_SIZE - 1);
+	n = CAP_RING_SIZE - pos;
+	if (n > size) n = size;
+
+	memcpy(&capring[pos], data, n);
+	if (size > n) memcpy(capring, (const unsigned char *)data + n, size - n);
+
+	caphead += size;
+}
+
+/* capPutRecord()
+ *   Puts pcap record header, time is in timebase ticks
+ */
+static void capPutRecord(unsigned long long stamp, unsigned int saved, unsigned int size)
+{
+	struct pcap_rec rec;
+	unsigned int rem;
+
+	stamp -= capstart;
+	rec.sec = stamp / TS_TICKS_PER_SEC;
+	rem = stamp - (unsigned long long)rec.sec * TS_TICKS_PER_SEC;
+	rec.nsec = (unsigned long long)rem * 1000000000 / TS_TICKS_PER_SEC;
+	rec.incl_len = saved;
+	rec.orig_len = size;
+
+	capPut(&rec, sizeof(rec));
+}
+
+/* capPutMarker()
+ *   Puts drop marker frame, so the file shows where frames were lost
+ */
+static void capPutMarker(unsigned long long stamp)
+{
+	unsigned char marker[CAP_MARKER_SIZE];
+
+	memset(marker, 0xFF, 6);
+	memcpy(&marker[6], ifGetAddress(), 6);
+	marker[12] = CAP_DROP_ETHERTYPE >> 8;
+	marker[13] = CAP_DROP_ETHERTYPE & 0xFF;
+	marker[14] = capdrops >> 24;
+	marker[15] = capdrops >> 16;
+	marker[16] = capdrops >> 8;
+	marker[17] = capdrops;
+
+	capPutRecord(stamp, CAP_MARKER_SIZE, CAP_MARKER_SIZE);
+	capPut(marker, CAP_MARKER_SIZE);
+	capdrops = 0;
+}
+
+/* capTap()
+ *   Bridge tap, saves frame to the ring or counts it as dropped. Copy is
+ * done with interrupts disabled since the tap is called from interrupt
+ * handlers too.
+ */
+static void capTap(unsigned char iface, pktbuf *packet, unsigned short size)
+{
+	unsigned long long stamp;
+	unsigned int cpsr, saved, need, used, delta, n;
+	pktbuf *buf;
+
+	/* Frames from interfaces carry their receive time */
+	stamp = tsGetTicks64();
+	if (iface != BRI_IF_LOCAL) {
+		delta = (unsigned int)stamp - packet->tstamp;
+		if (delta < TS_TICKS_PER_SEC) stamp -= delta;
+	}
+
+	saved = (size > CAP_SNAPLEN) ? CAP_SNAPLEN : size;
+	need = sizeof(struct pcap_rec) + saved;
+
+	/* Filter runs before the lock */
+	if (!fltMatch(&capfilter, packet)) {
+		cpsr = irqLock();
+		capstats.filtered++;
+		irqUnlock(cpsr);
+		return;
+	}
+
+	cpsr = irqLock();
+
+	if (capstats.state != CAP_STATE_RUNNING) {
+		irqUnlock(cpsr);
+		return;
+	}
+
+	/* Frame and pending drop marker must fit */
+	if (capdrops) need += sizeof(struct pcap_rec) + CAP_MARKER_SIZE;
+	used = caphead - captail;
+	if ( (used + need) > CAP_RING_SIZE ) {
+		capdrops++;
+		capstats.drops++;
+		irqUnlock(cpsr);
+		return;
+	}
+
+	if (capdrops) capPutMarker(stamp);
+
+	/* Save frame */
+	capPutRecord(stamp, saved, size);
+	for (buf = packet; buf && saved; buf = buf->next) {
+		n = (buf->len > saved) ? saved : buf->len;
+		capPut(buf->data, n);
+		saved -= n;
+	}
+
+	capstats.frames++;
+	used += need;
+	if (used > capstats.maxused) capstats.maxused = used;
+
+	irqUnlock(cpsr);
+}
+
+/* capFinish()
+ *   Stops capture and sets file size to the data written
+ */
+static void capFinish(unsigned char state)
+{
+	unsigned int cpsr;
+
+	cpsr = irqLock();
+	capstats.state = state;
+	irqUnlock(cpsr);
+
+	briSetTap(NULL);
+
+	if (state != CAP_STATE_ERROR) volSetFileSize(capvol, CAP_FILE_NAME, capstats.written);
+}
+
+/* capWrite()
+ *   Writes up to count sectors from the ring tail to the capture file,
+ * ring must hold them. Returns 0 if capture is finished.
+ */
+static int capWrite(unsigned int count)
+{
+	unsigned int pos, n;
+
+	/* Capture file is full */
+	if (capextent >= capcount) {
+		capFinish(CAP_STATE_FULL);
+		return 0;
+	}
+
+	/* Stay in the extent and in the ring */
+	n = capextents[capextent*2 + 1] - capsector;
+	if (n > count) n = count;
+	pos = captail & (CAP_RING_SIZE - 1);
+	if (n > (CAP_RING_SIZE - pos) / SECTOR_SIZE) n = (CAP_RING_SIZE - pos) / SECTOR_SIZE;
+
+	if (!sdcBlockWrite(&capring[pos], capextents[capextent*2] + capsector, n)) {
+		capFinish(CAP_STATE_ERROR);
+		return 0;
+	}
+
+	captail += n * SECTOR_SIZE;
+	capstats.written += n * SECTOR_SIZE;
+
+	/* Move to the next extent */
+	capsector += n;
+	if (capsector >= capextents[capextent*2 + 1]) {
+		capextent++;
+		capsector = 0;
+	}
+
+	return 1;
+}
+
+/* capLoadFilter()
+ *   Compiles filter from the filter file, no file means no filter.
+ * Returns 0 if filter has errors.
+ */
+static int capLoadFilter()
+{
+	unsigned int sectors[2];
+	unsigned int size;
+	char *text;
+
+	capfilter.all = 1;
+	capstats.filter = 0;
+
+	if (!volGetFileSectors(capvol, CAP_FILTER_NAME, sectors, 1, &size)) return 1;
+
+	/* Filter text is read over the volume cache */
+	capvol->sectornum = 0xFFFFFFFF;
+	if (!sdcBlockRead(capvol->sector, sectors[0], 1)) return 0;
+	if (size >= SECTOR_SIZE) size = SECTOR_SIZE - 1;
+	text = (char *)capvol->sector;
+	text[size] = 0;
+
+	if (!fltCompile(&capfilter, text)) return 0;
+	capstats.filter = !capfilter.all;
+
+	return 1;
+}
+
+/* ===== Exported functions ===== */
+
+/* capStart()
+ *   Starts capture to the preallocated file, returns 0 on error
+ */
+int capStart()
+{
+	struct pcap_hdr hdr;
+	int i;
+
+	if (capstats.state == CAP_STATE_RUNNING) return 1;
+
+	memset(&capstats, 0, sizeof(capstats));
+	capstats.state = CAP_STATE_NOFILE;
+
+	/* Find capture file space */
+	if (!sdcCardActivate()) return 0;
+	capvol = volGetVolume(VOL_SDCARD);
+	if (!volMount(capvol, sdcGetMedia())) return 0;
+
+	capcount = volGetFileSpace(capvol, CAP_FILE_NAME, capextents, CAP_MAX_EXTENTS);
+	if (!capcount) return 0;
+
+	if (!capLoadFilter()) {
+		capstats.state = CAP_STATE_BADFILTER;
+		return 0;
+	}
+
+	for (i = 0; i < capcount; i++) capstats.space += capextents[i*2 + 1] * SECTOR_SIZE;
+	capextent = 0;
+	capsector = 0;
+
+	/* Ring starts with the file header */
+	caphead = 0;
+	captail = 0;
+	capdrops = 0;
+	capstart = tsGetTicks64();
+
+	hdr.magic = PCAP_MAGIC_NSEC;
+	hdr.major = 2;
+	hdr.minor = 4;
+	hdr.thiszone = 0;
+	hdr.sigfigs = 0;
+	hdr.snaplen = CAP_SNAPLEN;
+	hdr.network = PCAP_LINKTYPE_ETHERNET;
+	capPut(&hdr, sizeof(hdr));
+
+	capstats.state = CAP_STATE_RUNNING;
+	briSetTap(capTap);
+
+	return 1;
+}
+
+/* capStop()
+ *   Stops capture, writes the rest of the ring and sets file size
+ */
+void capStop()
+{
+	unsigned int pos, rest;
+
+	if (capstats.state != CAP_STATE_RUNNING) return;
+
+	/* No more frames, interrupted tap calls are finished here */
+	briSetTap(NULL);
+
+	/* Whole sectors */
+	while ( (rest = (caphead - captail) / SECTOR_SIZE) ) {
+		if (rest > CAP_WRITE_SECTORS) rest = CAP_WRITE_SECTORS;
+		if (!capWrite(rest)) return;
+	}
+
+	/* Last sector is padded, file size excludes padding */
+	rest = caphead - captail;
+	if (rest) {
+		pos = captail & (CAP_RING_SIZE - 1);
+		memset(&capring[pos + rest], 0, SECTOR_SIZE - rest);
+		if (!capWrite(1)) return;
+		capstats.written -= SECTOR_SIZE - rest;
+	}
+
+	capFinish(CAP_STATE_IDLE);
+}
+
+/* capPoll()
+ *   Writes ring data to the card, called from the main loop. One chunk is
+ * written per call, so network processing is not held by long bursts.
+ */
+void capPoll()
+{
+	if (capstats.state != CAP_STATE_RUNNING) return;
+
+	if ( (caphead - captail) >= CAP_WRITE_SECTORS * SECTOR_SIZE ) capWrite(CAP_WRITE_SECTORS);
+}
+
+void capGetStats(cap_stats *stats)
+{
+	*stats = capstats;
+}
@@ -0,0 +1,51 @@
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+/* Capture file, must be preallocated on the SD card. Capture overwrites
+ * its clusters and sets file size when stopped.
+ */
+#define CAP_FILE_NAME		"capture.cap"
+
+/* Optional filter text file, see net/filter.h. Only the first sector is read. */
+#define CAP_FILTER_NAME		"capture.flt"
+
+/* RAM ring size, multiple of the sector size */
+#ifndef CAP_RING_SIZE
+#define CAP_RING_SIZE		8192
+#endif
+
+#define CAP_SNAPLEN			1518	/* Longest frame part saved */
+#define CAP_WRITE_SECTORS	4		/* Sectors written to the card at once */
+#define CAP_MAX_EXTENTS		16		/* Capture file fragments used */
+
+/* Drop marker frames are written to the file before the first frame saved
+ * after a drop. Marker carries number of frames lost, 32-bit big endian.
+ */
+#define CAP_DROP_ETHERTYPE	0x88B5
+
+/* Capture states */
+#define CAP_STATE_IDLE		0
+#define CAP_STATE_RUNNING	1
+#define CAP_STATE_FULL		2		/* Capture file space is exhausted */
+#define CAP_STATE_NOFILE	3		/* No card or capture file */
+#define CAP_STATE_ERROR		4		/* Card write error */
+#define CAP_STATE_BADFILTER	5		/* Filter file has errors */
+
+typedef struct {
+	unsigned char	state;
+	unsigned char	filter;			/* Filter is set */
+	unsigned int	frames;			/* Frames saved */
+	unsigned int	filtered;		/* Frames skipped by the filter */
+	unsigned int	drops;			/* Frames lost because ring was full */
+	unsigned int	written;		/* Bytes written to the file */
+	unsigned int	space;			/* Capture file space, bytes */
+	unsigned int	maxused;		/* Ring high-water mark, bytes */
+} cap_stats;
+
+int capStart(void);
+void capStop(void);
+void capPoll(void);
+void capGetStats(cap_stats *stats);
+
+#endif
@@ -0,0 +1,110 @@
+
+#include <config.h>
+#include <stddef.h>
+
+#include <net/ip.h>
+
+
+/* ===== Internal functions ===== */
+
+/* chkSum()
+ *   Returns one's complement sum of data as big endian 16-bit words, odd
+ * last byte is padded with zero. Words are read 32 bits at a time in the
+ * CPU (little endian) order and carries are kept in the upper half of the
+ * 64-bit sum, so they are folded once at the end.
+ */
+static uint32 FASTCODE chkSum(const uint8 *data, int num)
+{
+	unsigned long long sum;
+	const uint32 *w;
+	uint32 s;
+	int odd;
+
+	sum = 0;
+
+	/* Byte at odd address is the high half of a little endian word */
+	odd = (size_t)data & 1;
+	if (odd && (num > 0)) {
+		sum = *data++ << 8;
+		num--;
+	}
+
+	/* Align to 32 bits */
+	if ( (num >= 2) && ((size_t)data & 2) ) {
+		sum += *(const uint16 *)data;
+		data += 2;
+		num -= 2;
+	}
+
+	/* Main loop, 16 bytes per iteration */
+	w = (const uint32 *)data;
+	for (; num >= 16; num -= 16, w += 4) {
+		sum += (unsigned long long)w[0] + w[1] + w[2] + w[3];
+	}
+	for (; num >= 4; num -= 4) sum += *w++;
+
+	/* Tail */
+	data = (const uint8 *)w;
+	if (num >= 2) {
+		sum += *(const uint16 *)data;
+		data += 2;
+		num -= 2;
+	}
+	if (num > 0) sum += *data;
+
+	/* Fold carries */
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	s = (uint32)sum + (uint32)(sum >> 32);
+	s = (s & 0xFFFF) + (s >> 16);
+	s = (s & 0xFFFF) + (s >> 16);
+
+	/* Little endian sum is the byte swapped big endian one. Odd start has
+	 * shifted word pairs by a byte, which is the same swap.
+	 */
+	if (!odd) s = ((s & 0xFF) << 8) | (s >> 8);
+
+	return s;
+}
+
+/* ===== Exported functions ===== */
+
+/* ip_chksum()
+ *   Returns inverted one's complement sum of data added to csum. Data may
+ * have any alignment.
+ */
+uint16 FASTCODE ip_chksum(uint16 csum, uint8 *data, int num)
+{
+	uint32 s;
+
+	s = csum + chkSum(data, num);
+	s = (s & 0xFFFF) + (s >> 16);
+
+	return (uint16)~s;
+}
+
+/* ip_chksum_partial()
+ *   Returns one's complement sum of data, not inverted. Sum of data that
+ * does not change may be kept and passed to ip_chksum() as csum.
+ */
+uint16 FASTCODE ip_chksum_partial(uint8 *data, int num)
+{
+	return chkSum(data, num);
+}
+
+/* ip_chksum_adjust()
+ *   Updates checksum for a 32-bit field changed from oldv to newv without
+ * summing the data again (RFC 1624, eqn. 3). 16-bit fields are passed with
+ * zero upper half.
+ */
+uint16 FASTCODE ip_chksum_adjust(uint16 csum, uint32 oldv, uint32 newv)
+{
+	uint32 sum;
+
+	sum = (uint16)~csum;
+	sum += (uint16)~(oldv >> 16) + (uint16)~oldv;
+	sum += (newv >> 16) + (newv & 0xFFFF);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return (uint16)~sum;
+}
@@ -54,6 +54,7 @@ static void dhcpSendRequest()
 	pkt.next = NULL;
 	pkt.data = (unsigned char *)&dhcp;
 	pkt.len = sizeof(dhcp_frame) - DHCP_OPTIONS_SIZE + ol;
+	pkt.flags = 0;
 	udpSendPacket(&ip, DHCP_CLIENT_PORT, DHCP_SERVER_PORT, &pkt);
 }
 
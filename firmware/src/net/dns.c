@@ -0,0 +1,384 @@
+
+#include <config.h>
+#include <string.h>
+
+#include <drivers/tstamp.h>
+#include <net/bridge.h>
+#include <net/ip.h>
+#include <registry.h>
+
+#include "dns.h"
+
+
+#define DNS_CLIENT_PORT		49152		/* Client port base, random part is added */
+
+/* Header flags */
+#define DNS_FLAG_QR			0x8000		/* Response */
+#define DNS_FLAG_RD			0x0100		/* Recursion desired */
+#define DNS_RCODE			0x000F
+#define DNS_RCODE_NXDOMAIN	3
+
+#define DNS_TYPE_A			1
+#define DNS_CLASS_IN		1
+
+typedef struct {
+	uint16		id;
+	uint16		flags;
+	uint16		qdcount;
+	uint16		ancount;
+	uint16		nscount;
+	uint16		arcount;
+} PACKED dns_hdr;
+
+struct dnsquery {
+	unsigned char	active;
+	unsigned char	tries;			/* Requests made, dropped ones too */
+	unsigned char	sent;			/* Requests sent */
+	unsigned char	timer;			/* Ticks to the next request */
+	unsigned short	id;
+	unsigned int	server;
+	unsigned int	start;			/* First sent request time, timebase ticks */
+	dnsCallback		cb;
+	void *			p;
+	char			name[DNS_MAX_NAME];
+};
+
+struct dnsentry {
+	unsigned int	expire;			/* dns_clock value, 0 - free entry */
+	unsigned int	ipad;
+	char			name[DNS_MAX_NAME];
+};
+
+/* ===== Variables ===== */
+
+static struct dnsquery dnsqueries[DNS_MAX_QUERIES];
+static struct dnsentry dnscache[DNS_CACHE_SIZE];
+
+static unsigned int dns_clock;			/* dnsTimers() calls */
+static unsigned short dns_port;			/* Client port, 0 - not listening yet */
+static unsigned short dns_id;
+static dns_stats dnscounters;
+
+/* ===== Private functions ===== */
+
+/* dnsEncodeName()
+ *   Converts dotted name to labels, returns encoded length or 0 if name is
+ * not valid
+ */
+static int dnsEncodeName(unsigned char *out, const char *name)
+{
+	unsigned char *start, *len;
+
+	start = out;
+	len = out++;
+	*len = 0;
+
+	for (; *name; name++) {
+		if (*name == '.') {
+			if (!*len) return 0;
+			len = out++;
+			*len = 0;
+			continue;
+		}
+		if (*len >= 63) return 0;
+		*out++ = *name;
+		(*len)++;
+	}
+
+	/* Root label, unless name had trailing dot */
+	if (*len) *out++ = 0;
+	if (out - start < 3) return 0;
+
+	return out - start;
+}
+
+/* dnsSkipName()
+ *   Returns offset after the name at pos, or 0 if it runs out of the message
+ */
+static unsigned short dnsSkipName(unsigned char *data, unsigned short size, unsigned short pos)
+{
+	while (pos < size) {
+		if (data[pos] == 0) return pos + 1;
+		if ((data[pos] & 0xC0) == 0xC0) return (pos + 2 <= size) ? pos + 2 : 0;
+		pos += data[pos] + 1;
+	}
+
+	return 0;
+}
+
+/* dnsSendRequest()
+ *   Sends request of the query. Request dropped while the server address is
+ * resolved is made again on the next tick.
+ */
+static void dnsSendRequest(struct dnsquery *q)
+{
+	unsigned char msg[sizeof(dns_hdr) + DNS_MAX_NAME + 1 + 4];
+	dns_hdr *hdr;
+	ip_frame_hdr ip;
+	pktbuf pkt;
+	int n;
+
+	/* Header, one question */
+	hdr = (dns_hdr *)msg;
+	memset(hdr, 0, sizeof(dns_hdr));
+	hdr->id = htons(q->id);
+	hdr->flags = htons(DNS_FLAG_RD);
+	hdr->qdcount = htons(1);
+
+	/* Question, name is checked by dnsResolve() */
+	n = sizeof(dns_hdr);
+	n += dnsEncodeName(&msg[n], q->name);
+	msg[n++] = 0;
+	msg[n++] = DNS_TYPE_A;
+	msg[n++] = 0;
+	msg[n++] = DNS_CLASS_IN;
+
+	ipFillHeader(&ip, ipGetAddress(), q->server, IP_PROTO_UDP);
+	pkt.next = NULL;
+	pkt.data = msg;
+	pkt.len = n;
+	pkt.flags = 0;
+	pkt.tstamp = tsGetTicks();
+
+	q->tries++;
+	if (!udpSendPacket(&ip, dns_port, DNS_SERVER_PORT, &pkt)) {
+		q->timer = 1;
+		return;
+	}
+
+	/* Latency counts from the first request that left, at its hand-off time */
+	if (!q->sent) q->start = pkt.tstamp;
+	q->sent++;
+	q->timer = DNS_TIMEOUT;
+}
+
+/* dnsFinish()
+ *   Frees query and passes result to its owner
+ */
+static void dnsFinish(struct dnsquery *q, int result, unsigned int ipad, unsigned int latency)
+{
+	dnsCallback cb;
+	void *p;
+
+	cb = q->cb;
+	p = q->p;
+	q->active = 0;
+
+	/* Callback may start a new query */
+	cb(result, ipad, latency, p);
+}
+
+static struct dnsentry *dnsCacheFind(const char *name)
+{
+	int i;
+
+	for (i = 0; i < DNS_CACHE_SIZE; i++) {
+		if ( (dnscache[i].expire > dns_clock) && !strcmp(dnscache[i].name, name) ) return &dnscache[i];
+	}
+
+	return NULL;
+}
+
+/* dnsCacheAdd()
+ *   Saves answer, entry expiring first is replaced
+ */
+static void dnsCacheAdd(const char *name, unsigned int ipad, unsigned int ttl)
+{
+	struct dnsentry *entry;
+	int i;
+
+	if (!ttl) return;
+	if (ttl > DNS_MAX_TTL) ttl = DNS_MAX_TTL;
+
+	entry = dnsCacheFind(name);
+	if (!entry) {
+		entry = &dnscache[0];
+		for (i = 1; i < DNS_CACHE_SIZE; i++) {
+			if (dnscache[i].expire < entry->expire) entry = &dnscache[i];
+		}
+	}
+
+	strcpy(entry->name, name);
+	entry->ipad = ipad;
+	entry->expire = dns_clock + ttl * 2 + 1;
+}
+
+static void dnsPacketHandler(ip_frame_hdr *ip, unsigned short sport, unsigned short dport,
+							 unsigned char *data, unsigned short size)
+{
+	struct dnsquery *q;
+	dns_hdr *hdr;
+	unsigned short flags, count, pos, type, cls, rdlen;
+	unsigned int ttl, ipad, latency;
+	int i;
+
+	if ( (size < sizeof(dns_hdr)) || (sport != DNS_SERVER_PORT) ) return;
+
+	/* Find query */
+	hdr = (dns_hdr *)data;
+	flags = ntohs(hdr->flags);
+	if ( !(flags & DNS_FLAG_QR) ) return;
+
+	for (i = 0; i < DNS_MAX_QUERIES; i++) {
+		q = &dnsqueries[i];
+		if ( q->active && (q->id == ntohs(hdr->id)) && (q->server == ntohl(ip->source_addr)) ) break;
+	}
+	if (i >= DNS_MAX_QUERIES) return;
+
+	latency = (ifGetRecvStamp() - q->start) / TS_TICKS_PER_US;
+	dnscounters.last = latency;
+	if ( !dnscounters.answered || (latency < dnscounters.min) ) dnscounters.min = latency;
+	if (latency > dnscounters.max) dnscounters.max = latency;
+	dnscounters.sum += latency;
+	dnscounters.answered++;
+
+	if (flags & DNS_RCODE) {
+		dnscounters.failed++;
+		dnsFinish(q, ((flags & DNS_RCODE) == DNS_RCODE_NXDOMAIN) ? DNS_NOTFOUND : DNS_FAILED, 0, latency);
+		return;
+	}
+
+	/* Skip questions */
+	pos = sizeof(dns_hdr);
+	for (count = ntohs(hdr->qdcount); count && pos; count--) {
+		pos = dnsSkipName(data, size, pos);
+		if (pos) pos += 4;
+	}
+
+	/* First address record, names in CNAME chain are not checked */
+	for (count = ntohs(hdr->ancount); count && pos; count--) {
+		pos = dnsSkipName(data, size, pos);
+		if ( !pos || (pos + 10 > size) ) break;
+
+		type = (data[pos] << 8) | data[pos+1];
+		cls = (data[pos+2] << 8) | data[pos+3];
+		ttl = (data[pos+4] << 24) | (data[pos+5] << 16) | (data[pos+6] << 8) | data[pos+7];
+		rdlen = (data[pos+8] << 8) | data[pos+9];
+		pos += 10;
+		if (pos + rdlen > size) break;
+
+		if ( (type == DNS_TYPE_A) && (cls == DNS_CLASS_IN) && (rdlen == 4) ) {
+			ipad = (data[pos] << 24) | (data[pos+1] << 16) | (data[pos+2] << 8) | data[pos+3];
+			dnsCacheAdd(q->name, ipad, ttl);
+			dnsFinish(q, DNS_OK, ipad, latency);
+			return;
+		}
+		pos += rdlen;
+	}
+
+	dnscounters.failed++;
+	dnsFinish(q, DNS_NOTFOUND, 0, latency);
+}
+
+/* ===== Exported functions ===== */
+
+/* dnsResolve()
+ *   Starts resolving the name, result is passed to the callback. Returns 0
+ * if the name is not valid, no server is set or query table is full; the
+ * callback is not called then.
+ */
+int dnsResolve(const char *name, dnsCallback cb, void *p)
+{
+	struct dnsquery *q;
+	struct dnsentry *entry;
+	unsigned char enc[DNS_MAX_NAME + 1];
+	unsigned char *v;
+	unsigned int x;
+	int i;
+
+	if ( !cb || (strlen(name) >= DNS_MAX_NAME) ) return 0;
+
+	/* Free query */
+	for (i = 0; i < DNS_MAX_QUERIES; i++) {
+		if (!dnsqueries[i].active) break;
+	}
+	if (i >= DNS_MAX_QUERIES) return 0;
+	q = &dnsqueries[i];
+
+	/* Names are kept in lower case */
+	for (i = 0; name[i]; i++) q->name[i] = ((name[i] >= 'A') && (name[i] <= 'Z')) ? name[i] + 'a' - 'A' : name[i];
+	q->name[i] = 0;
+	if (!dnsEncodeName(enc, q->name)) return 0;
+
+	dnscounters.queries++;
+
+	entry = dnsCacheFind(q->name);
+	if (entry) {
+		dnscounters.hits++;
+		cb(DNS_OK, entry->ipad, 0, p);
+		return 1;
+	}
+
+	v = regGetValue(SYS_REG_IP4_DNS, (unsigned char *)&x);
+	if ( !v || !x ) return 0;
+
+	/* Listen on random port */
+	if (!dns_port) {
+		dns_port = DNS_CLIENT_PORT + (tsGetTicks() & 0x3FFF);
+		if (!udpRegisterHandler(dns_port, dnsPacketHandler)) {
+			dns_port = 0;
+			return 0;
+		}
+	}
+
+	/* Transaction id is not reused by outstanding queries */
+	do {
+		dns_id += 1 + (tsGetTicks() & 0xFF);
+		for (i = 0; i < DNS_MAX_QUERIES; i++) {
+			if ( dnsqueries[i].active && (dnsqueries[i].id == dns_id) ) break;
+		}
+	} while (i < DNS_MAX_QUERIES);
+
+	q->active = 1;
+	q->tries = 0;
+	q->sent = 0;
+	q->id = dns_id;
+	q->server = ntohl(x);
+	q->cb = cb;
+	q->p = p;
+	dnsSendRequest(q);
+
+	return 1;
+}
+
+/* dnsCancel()
+ *   Drops queries of the callback owner, so it is not called any more
+ */
+void dnsCancel(dnsCallback cb)
+{
+	int i;
+
+	for (i = 0; i < DNS_MAX_QUERIES; i++) {
+		if (dnsqueries[i].cb == cb) dnsqueries[i].active = 0;
+	}
+}
+
+/* dnsTimers()
+ *   Resends requests and times out queries, called from ipTimers()
+ */
+void dnsTimers()
+{
+	struct dnsquery *q;
+	int i;
+
+	dns_clock++;
+
+	for (i = 0; i < DNS_MAX_QUERIES; i++) {
+		q = &dnsqueries[i];
+		if (!q->active) continue;
+		if (--q->timer) continue;
+
+		if ( (q->sent >= DNS_RETRIES) || (q->tries >= DNS_MAX_TRIES) ) {
+			dnscounters.timeouts++;
+			dnsFinish(q, DNS_TIMEDOUT, 0, 0);
+		} else {
+			dnscounters.retries++;
+			dnsSendRequest(q);
+		}
+	}
+}
+
+void dnsGetStats(dns_stats *stats)
+{
+	*stats = dnscounters;
+}
@@ -0,0 +1,54 @@
+
+#ifndef _DNS_H
+#define _DNS_H
+
+/* DNS stub resolver
+ *
+ *   Names are resolved to IPv4 addresses by the server set in the registry.
+ * Queries are sent to the server and retried, answers are matched by
+ * transaction id, so several queries may be outstanding. Answers are cached
+ * for their TTL. Results are passed to the callback from the main loop, or
+ * right away for cached names.
+ */
+
+#define DNS_SERVER_PORT		53
+
+#define DNS_MAX_NAME		64			/* Name length with terminating zero */
+#define DNS_MAX_QUERIES		4			/* Outstanding queries */
+#define DNS_CACHE_SIZE		8			/* Cached names */
+#define DNS_MAX_TTL			3600		/* Longest time answer is cached, s */
+
+#define DNS_TIMEOUT			4			/* Reply wait, ipTimers() calls, 0.5 s each */
+#define DNS_RETRIES			3			/* Requests sent before giving up */
+#define DNS_MAX_TRIES		8			/* Requests made, dropped ones too */
+
+/* Results */
+#define DNS_OK				0
+#define DNS_NOTFOUND		1			/* Name does not exist or has no address */
+#define DNS_TIMEDOUT		2			/* Server did not answer */
+#define DNS_FAILED			3			/* Server error or no server set */
+
+/* Latency is time from the first sent request to the answer in us, 0 for cached
+ * names. Address is in host order.
+ */
+typedef void (*dnsCallback)(int result, unsigned int ipad, unsigned int latency, void *p);
+
+typedef struct {
+	unsigned int	queries;		/* Names asked */
+	unsigned int	hits;			/* Answered from the cache */
+	unsigned int	answered;		/* Answered by the server */
+	unsigned int	failed;			/* Not found or server errors */
+	unsigned int	timeouts;
+	unsigned int	retries;		/* Requests sent again */
+	unsigned int	last;			/* Latency of the last answer, us */
+	unsigned int	min;
+	unsigned int	max;
+	unsigned int	sum;			/* For average over answered */
+} dns_stats;
+
+int dnsResolve(const char *name, dnsCallback cb, void *p);
+void dnsCancel(dnsCallback cb);
+void dnsTimers(void);
+void dnsGetStats(dns_stats *stats);
+
+#endif
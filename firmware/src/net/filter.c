@@ -0,0 +1,597 @@
+
+#include <config.h>
+#include <string.h>
+
+#include <net/ip.h>
+
+#include "filter.h"
+
+
+/* Filter code uses only the C library, so it may be built on the host and
+ * checked against recorded frames.
+ */
+
+#define FLT_MAX_TESTS		32		/* Distinct compares, one bit each in a term */
+#define FLT_MAX_NODES		64
+#define FLT_MAX_TERMS		12		/* Conjunctions after expansion */
+#define FLT_MAX_DEPTH		16		/* Nested parentheses and negations */
+#define FLT_DNF_TERMS		48		/* Conjunctions of all subtrees being expanded */
+
+/* Frame header bytes evaluated when first chunk is short */
+#define FLT_HEADER_SIZE		64
+
+/* Expression tree node types */
+#define NODE_TEST			0
+#define NODE_AND			1
+#define NODE_OR				2
+#define NODE_NOT			3
+
+struct fltnode {
+	unsigned char	type;
+	unsigned char	a;			/* Test index for NODE_TEST */
+	unsigned char	b;
+};
+
+/* Conjunction: bit N is test N, bit N+32 is negated test N */
+typedef unsigned long long fltterm;
+
+/* Subtree waiting for expansion of its children */
+struct fltframe {
+	unsigned char	node;
+	unsigned char	neg;
+	unsigned char	state;		/* Children expanded */
+};
+
+/* ===== Compiler data ===== */
+
+static flt_op tests[FLT_MAX_TESTS];
+static int ntests;
+static struct fltnode nodes[FLT_MAX_NODES];
+static int nnodes;
+static int depth;
+static const char *src;
+
+/* DNF expansion, done without recursion as filter text comes from the card */
+static struct fltframe dnfstack[FLT_MAX_NODES];
+static fltterm dnfterms[FLT_DNF_TERMS];
+static unsigned char dnflen[FLT_MAX_NODES + 1];
+
+
+/* ===== Tree construction ===== */
+
+static int fltNode(unsigned char type, int a, int b)
+{
+	if ( (a < 0) || (b < 0) || (nnodes >= FLT_MAX_NODES) ) return -1;
+
+	nodes[nnodes].type = type;
+	nodes[nnodes].a = a;
+	nodes[nnodes].b = b;
+	return nnodes++;
+}
+
+/* fltTest()
+ *   Returns node of the masked compare, identical compares share one test
+ */
+static int fltTest(unsigned char base, signed char offset, unsigned char size, unsigned int mask, unsigned int value)
+{
+	int i;
+
+	for (i = 0; i < ntests; i++) {
+		if ( (tests[i].base == base) && (tests[i].offset == offset) && (tests[i].size == size) &&
+			 (tests[i].mask == mask) && (tests[i].value == value) ) break;
+	}
+
+	if (i >= ntests) {
+		if (ntests >= FLT_MAX_TESTS) return -1;
+		tests[i].base = base;
+		tests[i].offset = offset;
+		tests[i].size = size;
+		tests[i].flags = 0;
+		tests[i].mask = mask;
+		tests[i].value = value;
+		ntests++;
+	}
+
+	return fltNode(NODE_TEST, i, 0);
+}
+
+#define fltAnd(a, b)		fltNode(NODE_AND, a, b)
+#define fltOr(a, b)			fltNode(NODE_OR, a, b)
+
+static int fltEtherType(unsigned int type)
+{
+	return fltTest(FLT_BASE_NET, -2, 2, 0xFFFF, type);
+}
+
+static int fltIPProto(unsigned int proto)
+{
+	return fltAnd(fltEtherType(ETH_TYPE_IP), fltTest(FLT_BASE_NET, 9, 1, 0xFF, proto));
+}
+
+/* ===== Lexer ===== */
+
+static int fltIsWord(char c)
+{
+	return ( (c >= 'a') && (c <= 'z') ) || ( (c >= 'A') && (c <= 'Z') ) ||
+		   ( (c >= '0') && (c <= '9') ) || (c == '_');
+}
+
+static int fltHexDigit(char c)
+{
+	if ( (c >= '0') && (c <= '9') ) return c - '0';
+	if ( (c >= 'a') && (c <= 'f') ) return c - 'a' + 10;
+	if ( (c >= 'A') && (c <= 'F') ) return c - 'A' + 10;
+	return -1;
+}
+
+static void fltSpace()
+{
+	while ( (*src == ' ') || (*src == '\t') || (*src == '\r') || (*src == '\n') ) src++;
+}
+
+/* fltKeyword()
+ *   Skips keyword or operator if it is next in the text
+ */
+static int fltKeyword(const char *kw)
+{
+	int len;
+
+	fltSpace();
+	len = strlen(kw);
+	if (strncmp(src, kw, len)) return 0;
+	if ( fltIsWord(kw[0]) && fltIsWord(src[len]) ) return 0;
+
+	src += len;
+	return 1;
+}
+
+/* fltNumber()
+ *   Parses decimal or 0x-prefixed hex number
+ */
+static int fltNumber(unsigned int *value)
+{
+	int d, n;
+
+	fltSpace();
+	*value = 0;
+	n = 0;
+
+	if ( (src[0] == '0') && ((src[1] == 'x') || (src[1] == 'X')) ) {
+		src += 2;
+		while ( (d = fltHexDigit(*src)) >= 0 ) {
+			*value = (*value << 4) | d;
+			src++;
+			n++;
+		}
+	} else {
+		while ( (*src >= '0') && (*src <= '9') ) {
+			*value = *value * 10 + (*src - '0');
+			src++;
+			n++;
+		}
+	}
+
+	return n && !fltIsWord(*src);
+}
+
+static int fltAddress(unsigned int *ipad)
+{
+	unsigned int v;
+	int i;
+
+	fltSpace();
+	*ipad = 0;
+	for (i = 0; i < 4; i++) {
+		if ( i && (*src++ != '.') ) return 0;
+		if ( (*src < '0') || (*src > '9') ) return 0;
+		v = 0;
+		while ( (*src >= '0') && (*src <= '9') ) v = v * 10 + (*src++ - '0');
+		if (v > 255) return 0;
+		*ipad = (*ipad << 8) | v;
+	}
+
+	return !fltIsWord(*src) && (*src != '.');
+}
+
+static int fltMac(unsigned char *mac)
+{
+	int i, hi, lo;
+
+	fltSpace();
+	for (i = 0; i < 6; i++) {
+		if ( i && (*src++ != ':') ) return 0;
+		hi = fltHexDigit(src[0]);
+		lo = fltHexDigit(src[1]);
+		if ( (hi < 0) || (lo < 0) ) return 0;
+		mac[i] = (hi << 4) | lo;
+		src += 2;
+	}
+
+	return !fltIsWord(*src);
+}
+
+/* ===== Parser ===== */
+
+static int fltExpr(void);
+
+/* fltPort()
+ *   Port compare, proto is 0 for TCP or UDP, dir is 0 for any direction
+ */
+static int fltPort(unsigned int proto, int dir)
+{
+	unsigned int port;
+	int n;
+
+	if (!fltNumber(&port) || (port > 0xFFFF)) return -1;
+
+	/* Protocol and first fragment */
+	if (proto) {
+		n = fltIPProto(proto);
+	} else {
+		n = fltOr(fltIPProto(IP_PROTO_TCP), fltIPProto(IP_PROTO_UDP));
+	}
+	n = fltAnd(n, fltTest(FLT_BASE_NET, 6, 2, 0x1FFF, 0));
+
+	switch (dir) {
+		case 1:
+			return fltAnd(n, fltTest(FLT_BASE_TRANS, 0, 2, 0xFFFF, port));
+		case 2:
+			return fltAnd(n, fltTest(FLT_BASE_TRANS, 2, 2, 0xFFFF, port));
+	}
+	return fltAnd(n, fltOr(fltTest(FLT_BASE_TRANS, 0, 2, 0xFFFF, port), fltTest(FLT_BASE_TRANS, 2, 2, 0xFFFF, port)));
+}
+
+/* fltHost()
+ *   IPv4 address or network compare
+ */
+static int fltHost(unsigned int ipad, unsigned int mask, int dir)
+{
+	int n;
+
+	n = fltEtherType(ETH_TYPE_IP);
+	ipad &= mask;
+
+	switch (dir) {
+		case 1:
+			return fltAnd(n, fltTest(FLT_BASE_NET, 12, 4, mask, ipad));
+		case 2:
+			return fltAnd(n, fltTest(FLT_BASE_NET, 16, 4, mask, ipad));
+	}
+	return fltAnd(n, fltOr(fltTest(FLT_BASE_NET, 12, 4, mask, ipad), fltTest(FLT_BASE_NET, 16, 4, mask, ipad)));
+}
+
+static int fltEther()
+{
+	unsigned char mac[6];
+	unsigned int v, hi, lo;
+	int dir, src_n, dst_n;
+
+	if (fltKeyword("proto")) {
+		if (!fltNumber(&v) || (v > 0xFFFF)) return -1;
+		return fltEtherType(v);
+	}
+
+	if (fltKeyword("src")) dir = 1;
+	else if (fltKeyword("dst")) dir = 2;
+	else if (fltKeyword("host")) dir = 0;
+	else return -1;
+
+	if (!fltMac(mac)) return -1;
+	hi = (mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3];
+	lo = (mac[4] << 8) | mac[5];
+
+	src_n = fltAnd(fltTest(FLT_BASE_LINK, 6, 4, 0xFFFFFFFF, hi), fltTest(FLT_BASE_LINK, 10, 2, 0xFFFF, lo));
+	dst_n = fltAnd(fltTest(FLT_BASE_LINK, 0, 4, 0xFFFFFFFF, hi), fltTest(FLT_BASE_LINK, 4, 2, 0xFFFF, lo));
+
+	switch (dir) {
+		case 1:
+			return src_n;
+		case 2:
+			return dst_n;
+	}
+	return fltOr(src_n, dst_n);
+}
+
+static int fltPrimitive()
+{
+	unsigned int v, ipad, len, proto;
+	int n, dir;
+
+	if (fltKeyword("ether")) return fltEther();
+
+	if (fltKeyword("vlan")) {
+		n = fltTest(FLT_BASE_LINK, 12, 2, 0xFFFF, 0x8100);
+		fltSpace();
+		if ( (*src < '0') || (*src > '9') ) return n;
+		if (!fltNumber(&v) || (v > 0x0FFF)) return -1;
+		return fltAnd(n, fltTest(FLT_BASE_LINK, 14, 2, 0x0FFF, v));
+	}
+
+	if (fltKeyword("arp")) return fltEtherType(ETH_TYPE_ARP);
+
+	if (fltKeyword("ip")) {
+		if (!fltKeyword("proto")) return fltEtherType(ETH_TYPE_IP);
+		if (!fltNumber(&v) || (v > 0xFF)) return -1;
+		return fltIPProto(v);
+	}
+
+	if (fltKeyword("proto")) {
+		if (!fltNumber(&v) || (v > 0xFF)) return -1;
+		return fltIPProto(v);
+	}
+
+	if (fltKeyword("icmp")) return fltIPProto(IP_PROTO_ICMP);
+
+	/* Transport protocol, may qualify port */
+	proto = 0;
+	if (fltKeyword("tcp")) proto = IP_PROTO_TCP;
+	else if (fltKeyword("udp")) proto = IP_PROTO_UDP;
+
+	dir = 0;
+	if (fltKeyword("src")) dir = 1;
+	else if (fltKeyword("dst")) dir = 2;
+
+	if (fltKeyword("port")) return fltPort(proto, dir);
+	if (proto) return dir ? -1 : fltIPProto(proto);
+
+	if (fltKeyword("host")) {
+		if (!fltAddress(&ipad)) return -1;
+		return fltHost(ipad, 0xFFFFFFFF, dir);
+	}
+
+	if (fltKeyword("net")) {
+		if (!fltAddress(&ipad) || !fltKeyword("/") || !fltNumber(&len) || (len > 32)) return -1;
+		return fltHost(ipad, len ? (0xFFFFFFFF << (32 - len)) : 0, dir);
+	}
+
+	return -1;
+}
+
+static int fltFactor()
+{
+	int n;
+
+	if (fltKeyword("not") || fltKeyword("!")) {
+		if (++depth > FLT_MAX_DEPTH) return -1;
+		n = fltNode(NODE_NOT, fltFactor(), 0);
+		depth--;
+		return n;
+	}
+
+	if (fltKeyword("(")) {
+		if (++depth > FLT_MAX_DEPTH) return -1;
+		n = fltExpr();
+		if (!fltKeyword(")")) return -1;
+		depth--;
+		return n;
+	}
+
+	return fltPrimitive();
+}
+
+static int fltConj()
+{
+	int n;
+
+	n = fltFactor();
+	while ( (n >= 0) && (fltKeyword("and") || fltKeyword("&&")) ) n = fltAnd(n, fltFactor());
+
+	return n;
+}
+
+static int fltExpr()
+{
+	int n;
+
+	n = fltConj();
+	while ( (n >= 0) && (fltKeyword("or") || fltKeyword("||")) ) n = fltOr(n, fltConj());
+
+	return n;
+}
+
+/* ===== DNF conversion ===== */
+
+/* fltDnf()
+ *   Expands tree to conjunctions, negations are pushed down to tests.
+ * Children lists are kept next to each other in dnfterms and replaced by
+ * the list of the parent. Returns number of conjunctions, which start at
+ * dnfterms, or -1 if there are too many.
+ */
+static int fltDnf(int root)
+{
+	struct fltframe *f;
+	fltterm *l, t;
+	int sp, nlists, top, nl, nr, n, i, j, type;
+
+	dnfstack[0].node = root;
+	dnfstack[0].neg = 0;
+	dnfstack[0].state = 0;
+	sp = 1;
+	nlists = 0;
+	top = 0;
+
+	while (sp) {
+		f = &dnfstack[sp - 1];
+		type = nodes[f->node].type;
+
+		/* Negation is passed to the subtree */
+		if (type == NODE_NOT) {
+			f->node = nodes[f->node].a;
+			f->neg = !f->neg;
+			continue;
+		}
+
+		if (type == NODE_TEST) {
+			if (top >= FLT_DNF_TERMS) return -1;
+			dnfterms[top++] = 1ULL << (nodes[f->node].a + (f->neg ? 32 : 0));
+			dnflen[nlists++] = 1;
+			sp--;
+			continue;
+		}
+
+		/* Expand children first */
+		if (f->state < 2) {
+			if (sp >= FLT_MAX_NODES) return -1;
+			dnfstack[sp].node = f->state ? nodes[f->node].b : nodes[f->node].a;
+			dnfstack[sp].neg = f->neg;
+			dnfstack[sp].state = 0;
+			f->state++;
+			sp++;
+			continue;
+		}
+
+		/* De Morgan */
+		if (f->neg) type = (type == NODE_AND) ? NODE_OR : NODE_AND;
+		sp--;
+
+		nr = dnflen[--nlists];
+		nl = dnflen[--nlists];
+		l = &dnfterms[top - nr - nl];
+
+		/* Lists are adjacent already */
+		if (type == NODE_OR) {
+			if ( (nl + nr) > FLT_MAX_TERMS ) return -1;
+			dnflen[nlists++] = nl + nr;
+			continue;
+		}
+
+		/* Distribute AND over OR after both lists, contradictions are dropped */
+		n = 0;
+		for (i = 0; i < nl; i++) {
+			for (j = 0; j < nr; j++) {
+				t = l[i] | l[nl + j];
+				if ( (unsigned int)t & (unsigned int)(t >> 32) ) continue;
+				if ( (n >= FLT_MAX_TERMS) || (top + n >= FLT_DNF_TERMS) ) return -1;
+				dnfterms[top + n++] = t;
+			}
+		}
+		memmove(l, &dnfterms[top], n * sizeof(fltterm));
+		top = (l - dnfterms) + n;
+		dnflen[nlists++] = n;
+	}
+
+	return dnflen[0];
+}
+
+/* ===== Exported functions ===== */
+
+/* fltCompile()
+ *   Compiles filter text, returns 0 on syntax error or if filter is too
+ * complex. Empty text matches all frames.
+ */
+int fltCompile(flt_program *prog, const char *text)
+{
+	int root, nterms, i, t;
+	flt_op *op;
+
+	prog->all = 0;
+	prog->count = 0;
+
+	ntests = 0;
+	nnodes = 0;
+	depth = 0;
+	src = text;
+
+	fltSpace();
+	if (!*src) {
+		prog->all = 1;
+		return 1;
+	}
+
+	root = fltExpr();
+	fltSpace();
+	if ( (root < 0) || *src ) return 0;
+
+	nterms = fltDnf(root);
+	if (nterms < 0) return 0;
+
+	/* Compares follow test creation order, so protocol checks come first */
+	op = prog->op;
+	for (t = 0; t < nterms; t++) {
+		for (i = 0; i < 64; i++) {
+			if ( !(dnfterms[t] & (1ULL << i)) ) continue;
+			if (prog->count >= FLT_MAX_OPS) return 0;
+
+			*op = tests[i & 31];
+			if (i >= 32) op->flags |= FLT_OP_NEG;
+			op++;
+			prog->count++;
+		}
+		(op - 1)->flags |= FLT_OP_LAST;
+	}
+
+	return 1;
+}
+
+/* fltMatch()
+ *   Runs filter program on the frame headers
+ */
+int fltMatch(const flt_program *prog, pktbuf *packet)
+{
+	unsigned char header[FLT_HEADER_SIZE];
+	const unsigned char *data, *p;
+	unsigned int len, pos, v;
+	unsigned int base[3];
+	const flt_op *op, *end;
+	pktbuf *buf;
+	int ok;
+
+	if (prog->all) return 1;
+
+	data = packet->data;
+	len = packet->len;
+
+	/* Gather headers split across chunks */
+	if (packet->next && (len < FLT_HEADER_SIZE)) {
+		len = 0;
+		for (buf = packet; buf && (len < FLT_HEADER_SIZE); buf = buf->next) {
+			v = buf->len;
+			if (v > FLT_HEADER_SIZE - len) v = FLT_HEADER_SIZE - len;
+			memcpy(&header[len], buf->data, v);
+			len += v;
+		}
+		data = header;
+	}
+
+	/* Header offsets, invalid bases fail every compare */
+	base[FLT_BASE_LINK] = 0;
+	base[FLT_BASE_NET] = 14;
+	if ( (len >= 18) && (data[12] == 0x81) && (data[13] == 0x00) ) base[FLT_BASE_NET] = 18;
+	base[FLT_BASE_TRANS] = 0xFFFF;
+	pos = base[FLT_BASE_NET];
+	if ( (len >= pos + 20) && ((data[pos] >> 4) == 4) ) base[FLT_BASE_TRANS] = pos + (data[pos] & 0x0F) * 4;
+
+	ok = 1;
+	end = &prog->op[prog->count];
+	for (op = prog->op; op < end; op++) {
+		if (ok) {
+			pos = base[op->base] + op->offset;
+			if ( (pos + op->size) > len ) {
+				ok = 0;
+			} else {
+				p = &data[pos];
+				switch (op->size) {
+					case 1:
+						v = p[0];
+						break;
+					case 2:
+						v = (p[0] << 8) | p[1];
+						break;
+					default:
+						v = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+						break;
+				}
+				ok = ((v & op->mask) == op->value);
+			}
+			if (op->flags & FLT_OP_NEG) ok = !ok;
+		}
+
+		/* End of conjunction */
+		if (op->flags & FLT_OP_LAST) {
+			if (ok) return 1;
+			ok = 1;
+		}
+	}
+
+	return 0;
+}
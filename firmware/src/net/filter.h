@@ -0,0 +1,55 @@
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <net/bridge.h>
+
+/* Frame filter
+ *
+ *   Filter text is compiled to a straight-line program in disjunctive normal
+ * form: a list of conjunctions, every conjunction is a list of masked
+ * compares. Frame matches if all compares of any conjunction are true.
+ *
+ *   Primitives, joined with and/or/not (&&, ||, !) and parentheses:
+ *
+ *     ether src|dst|host XX:XX:XX:XX:XX:XX     ether proto N
+ *     vlan [ID]        arp        ip        ip proto N        proto N
+ *     icmp        tcp        udp
+ *     [src|dst] host A.B.C.D        [src|dst] net A.B.C.D/LEN
+ *     [tcp|udp] [src|dst] port N
+ *
+ *   Network layer tests skip one VLAN tag, so "ip" matches tagged frames too.
+ * Empty filter matches all frames. Parentheses and negations nest up to 16
+ * levels deep.
+ */
+
+#define FLT_MAX_OPS			48
+
+/* Compare base */
+#define FLT_BASE_LINK		0		/* Frame start */
+#define FLT_BASE_NET		1		/* Network header, after VLAN tag if any */
+#define FLT_BASE_TRANS		2		/* Transport header, IPv4 only */
+
+/* Compare flags */
+#define FLT_OP_NEG			0x01	/* Compare result is inverted */
+#define FLT_OP_LAST			0x02	/* Last compare of the conjunction */
+
+typedef struct {
+	unsigned char	base;
+	unsigned char	size;			/* 1, 2 or 4 bytes, big endian */
+	unsigned char	flags;
+	signed char		offset;			/* From the base */
+	unsigned int	mask;
+	unsigned int	value;
+} flt_op;
+
+typedef struct {
+	unsigned char	all;			/* Matches all frames */
+	unsigned char	count;			/* Compares in the program */
+	flt_op			op[FLT_MAX_OPS];
+} flt_program;
+
+int fltCompile(flt_program *prog, const char *text);
+int fltMatch(const flt_program *prog, pktbuf *packet);
+
+#endif
@@ -7,37 +7,75 @@
 #include <net/bridge.h>
 #include <net/arp.h>
 #include <net/dhcp.h>
+#include <net/dns.h>
+#include <net/ipfrag.h>
 #include <registry.h>
 
 #include "ip.h"
 
 
-#define ICMP_ECHO					8
-#define ICMP_ECHO_REPLY				0
+#define ICMP_MAX_HANDLERS			8
 
-#define MAX_UDP_PORTS				16
+typedef struct {
+	unsigned char	protocol;		/* 0 - free entry */
+	unsigned short	id;
+	icmpHandler		handler;
+} icmp_handler;
+
+/* UDP port table, open addressing with linear probing. Table is kept at
+ * most half full, so lookups end after a probe or two.
+ */
+#define UDP_TABLE_BITS				5
+#define UDP_TABLE_SIZE				(1 << UDP_TABLE_BITS)
+#define UDP_HASH(port)				((uint16)((port) * 40503) >> (16 - UDP_TABLE_BITS))
 
 typedef struct {
-	unsigned short	port;
+	unsigned short	port;			/* 0 - free slot */
 	udpHandler		handler;
+	unsigned int	received;
 } udp_handler;
 
+#if UDP_MAX_PORTS > UDP_TABLE_SIZE / 2
+#error UDP_MAX_PORTS must be at most half of UDP_TABLE_SIZE
+#endif
+
 /* ===== Variables ===== */
 
 static int ip_state;
 static unsigned int ip_addr;
 static unsigned int ip_mask;
 static unsigned int ip_gateway;
+static unsigned short ip_ident;
 
-static icmpHandler icmp_handler;
+static icmp_handler icmp_handlers[ICMP_MAX_HANDLERS];
 
-static udp_handler udp_handlers[MAX_UDP_PORTS];
+static udp_handler udp_handlers[UDP_TABLE_SIZE];
+static int udp_count;
+static udpHandler udp_default;
+static udp_stats udp_counters;
 
 /* ===== ICMP protocol functions ===== */
 
+/* icmpDispatch()
+ *   Passes message to the handler registered for the key
+ */
+static void icmpDispatch(unsigned char protocol, unsigned short id, ip_frame_hdr *ip, unsigned char *packet, unsigned short size)
+{
+	int i;
+
+	for (i = 0; i < ICMP_MAX_HANDLERS; i++) {
+		if ( (icmp_handlers[i].protocol == protocol) && (icmp_handlers[i].id == id) ) {
+			icmp_handlers[i].handler(ip, packet, size);
+			return;
+		}
+	}
+}
+
 static void icmpPacketHandler(ip_frame_hdr *ip, unsigned char *packet, unsigned short size)
 {
 	pktbuf buf;
+	ip_frame_hdr *orig;
+	unsigned char *data;
 	unsigned char type, code;
 	unsigned short checksum;
 
@@ -61,50 +99,132 @@ static void icmpPacketHandler(ip_frame_hdr *ip, unsigned char *packet, unsigned
 			buf.next = NULL;
 			buf.data = packet;
 			buf.len = size;
+			buf.flags = 0;
 			ipSendPacket(ip, &buf);
 			break;
 
-		default:
-			if (icmp_handler) icmp_handler(ip, packet, size);
+		/* Replies go to the echo identifier owner */
+		case ICMP_ECHO_REPLY:
+			if (size < 8) break;
+			icmpDispatch(IP_PROTO_ICMP, (packet[4] << 8) | packet[5], ip, packet, size);
+			break;
+
+		/* Errors go to the owner of the datagram in error */
+		case ICMP_DEST_UNREACH:
+		case ICMP_SOURCE_QUENCH:
+		case ICMP_REDIRECT:
+		case ICMP_TIME_EXCEEDED:
+		case ICMP_PARAM_PROBLEM:
+			if (size < 8 + 20) break;
+			orig = (ip_frame_hdr *)&packet[8];
+			if ( ((orig->version_ihl & 0xF0) != 0x40) || (size < 8 + IP_IHL(orig) * 4 + 8) ) break;
+			/* Offset is not zero for fragments without transport header */
+			if (orig->flags_frag_offset & htons(IP_FRAG_OFFSET)) break;
+
+			data = IP_DATA(orig);
+			if (orig->protocol == IP_PROTO_ICMP) {
+				if (data[0] != ICMP_ECHO) break;
+				icmpDispatch(IP_PROTO_ICMP, (data[4] << 8) | data[5], ip, packet, size);
+			} else {
+				/* TCP and UDP source port */
+				icmpDispatch(orig->protocol, (data[0] << 8) | data[1], ip, packet, size);
+			}
 			break;
 	}
 }
 
-void icmpRegisterHandler(icmpHandler newhandler)
+/* icmpRegisterHandler()
+ *   Sets handler of ICMP messages for echo identifier id, or for errors
+ * about datagrams of other protocol from source port id. Returns 0 if the
+ * table is full.
+ */
+int icmpRegisterHandler(unsigned char protocol, unsigned short id, icmpHandler handler)
 {
-	icmp_handler = newhandler;
+	icmp_handler *entry;
+	int i;
+
+	if ( !protocol || !handler ) return 0;
+
+	entry = NULL;
+	for (i = 0; i < ICMP_MAX_HANDLERS; i++) {
+		if ( (icmp_handlers[i].protocol == protocol) && (icmp_handlers[i].id == id) ) {
+			entry = &icmp_handlers[i];
+			break;
+		}
+		if ( !entry && !icmp_handlers[i].protocol ) entry = &icmp_handlers[i];
+	}
+	if (!entry) return 0;
+
+	entry->protocol = protocol;
+	entry->id = id;
+	entry->handler = handler;
+
+	return 1;
+}
+
+void icmpUnregisterHandler(unsigned char protocol, unsigned short id)
+{
+	int i;
+
+	for (i = 0; i < ICMP_MAX_HANDLERS; i++) {
+		if ( (icmp_handlers[i].protocol == protocol) && (icmp_handlers[i].id == id) ) {
+			icmp_handlers[i].protocol = 0;
+			icmp_handlers[i].handler = NULL;
+		}
+	}
 }
 
 /* ===== UDP protocol functions ===== */
 
+/* udpFind()
+ *   Returns table slot of the port or NULL
+ */
+static udp_handler *udpFind(unsigned short port)
+{
+	udp_handler *h;
+	int i;
+
+	for (i = UDP_HASH(port); ; i = (i + 1) & (UDP_TABLE_SIZE - 1)) {
+		h = &udp_handlers[i];
+		if (h->port == port) return h;
+		if (h->port == 0) return NULL;
+	}
+}
+
 static void udpPacketHandler(ip_frame_hdr *ip, unsigned char *packet, unsigned short size)
 {
 	udp_frame_hdr *udp;
-	int i;
+	udp_handler *h;
 	unsigned short sport, dport;
 
-	if (size < sizeof(udp_frame_hdr)) return;
+	if (size < sizeof(udp_frame_hdr)) {
+		udp_counters.errors++;
+		return;
+	}
 
 	udp = (udp_frame_hdr *)packet;
 	sport = ntohs(udp->sport);
 	dport = ntohs(udp->dport);
+	udp_counters.received++;
 
-	for (i = 0; i < MAX_UDP_PORTS; i++) {
-		if (udp_handlers[i].port == 0) break;
-		if ( (udp_handlers[i].port == dport) && (udp_handlers[i].handler) ) {
-			udp_handlers[i].handler(ip, sport, dport, &packet[sizeof(udp_frame_hdr)], size - sizeof(udp_frame_hdr));
-		}
+	h = dport ? udpFind(dport) : NULL;
+	if (h) {
+		h->received++;
+		h->handler(ip, sport, dport, &packet[sizeof(udp_frame_hdr)], size - sizeof(udp_frame_hdr));
+	} else {
+		udp_counters.unclaimed++;
+		if (udp_default) udp_default(ip, sport, dport, &packet[sizeof(udp_frame_hdr)], size - sizeof(udp_frame_hdr));
 	}
 }
 
-void udpSendPacket(ip_frame_hdr *ip, unsigned short pfrom, unsigned short pto, pktbuf *data)
+int udpSendPacket(ip_frame_hdr *ip, unsigned short pfrom, unsigned short pto, pktbuf *data)
 {
 	udp_frame_hdr udp;
 	pktbuf pkt;
 	pktbuf *buf;
 	unsigned short len;
 
-	if (!ip) return;
+	if (!ip) return 0;
 
 	ip->protocol = IP_PROTO_UDP;
 
@@ -124,20 +244,94 @@ void udpSendPacket(ip_frame_hdr *ip, unsigned short pfrom, unsigned short pto, p
 	pkt.next = data;
 	pkt.data = (unsigned char *)&udp;
 	pkt.len = sizeof(udp);
-	ipSendPacket(ip, &pkt);
+	pkt.flags = 0;
+	return ipSendPacket(ip, &pkt);
 }
 
-void udpRegisterHandler(unsigned short port, udpHandler handler)
+/* udpRegisterHandler()
+ *   Sets handler of the port, replacing the old one. Returns 0 if the port
+ * table is full.
+ */
+int udpRegisterHandler(unsigned short port, udpHandler handler)
 {
+	udp_handler *h;
 	int i;
 
-	for (i = 0; i < MAX_UDP_PORTS; i++) {
-		if ( (udp_handlers[i].port == port) || (udp_handlers[i].port == 0) ) {
-			udp_handlers[i].port = port;
-			udp_handlers[i].handler = handler;
-			return;
-		}
+	if ( (port == 0) || (handler == NULL) ) return 0;
+
+	h = udpFind(port);
+	if (h) {
+		h->handler = handler;
+		return 1;
+	}
+
+	if (udp_count >= UDP_MAX_PORTS) return 0;
+
+	for (i = UDP_HASH(port); udp_handlers[i].port; i = (i + 1) & (UDP_TABLE_SIZE - 1));
+	udp_handlers[i].port = port;
+	udp_handlers[i].handler = handler;
+	udp_handlers[i].received = 0;
+	udp_count++;
+
+	return 1;
+}
+
+/* udpUnregisterHandler()
+ *   Frees the port. Following entries of the probe chain are moved back,
+ * so lookups never need deleted slot markers.
+ */
+void udpUnregisterHandler(unsigned short port)
+{
+	udp_handler *h;
+	int i, j, k;
+
+	if (port == 0) return;
+
+	h = udpFind(port);
+	if (!h) return;
+
+	i = h - udp_handlers;
+	j = i;
+	for (;;) {
+		j = (j + 1) & (UDP_TABLE_SIZE - 1);
+		if (udp_handlers[j].port == 0) break;
+
+		/* Entry may move to i if its home slot is not in (i, j] */
+		k = UDP_HASH(udp_handlers[j].port);
+		if ( (i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)) ) continue;
+
+		udp_handlers[i] = udp_handlers[j];
+		i = j;
 	}
+
+	udp_handlers[i].port = 0;
+	udp_handlers[i].handler = NULL;
+	udp_count--;
+}
+
+/* udpSetDefaultHandler()
+ *   Sets handler for datagrams to ports with no handler, NULL drops them
+ */
+void udpSetDefaultHandler(udpHandler handler)
+{
+	udp_default = handler;
+}
+
+/* udpGetPortStats()
+ *   Returns datagrams received by the port handler
+ */
+unsigned int udpGetPortStats(unsigned short port)
+{
+	udp_handler *h;
+
+	h = port ? udpFind(port) : NULL;
+
+	return h ? h->received : 0;
+}
+
+void udpGetStats(udp_stats *stats)
+{
+	*stats = udp_counters;
 }
 
 /* ===== IP protocol functions ===== */
@@ -151,6 +345,8 @@ void ipTimers()
 {
 	dhcpTimers();
 	arpTimers();
+	fragTimers();
+	dnsTimers();
 }
 
 void ipUpdateConfig()
@@ -191,10 +387,9 @@ void ipPacketHandler(unsigned char *packet, unsigned short size)
 	/* Check destination IP */
 	if (ntohl(ip->dest_addr) != ip_addr) return;
 
-	/* Get payload pointer and size */
-	data = IP_DATA(ip);
+	/* Check length */
 	len = ntohs(ip->total_length);
-	if (size < len) return;
+	if ( (size < len) || (len < IP_IHL(ip) * 4) ) return;
 
 	/* Save sender MAC in ARP table */
 	ipad = ntohl(ip->source_addr);
@@ -202,13 +397,24 @@ void ipPacketHandler(unsigned char *packet, unsigned short size)
 		arpTableUpdate(ipad, packet - 8, ARP_EXPIRE_RECEIVED);
 	}
 
+	/* Fragments are passed up as a whole datagram */
+	if (ip->flags_frag_offset & htons(IP_FLAG_MF | IP_FRAG_OFFSET)) {
+		ip = fragReassemble(ip);
+		if (!ip) return;
+		len = ntohs(ip->total_length);
+	}
+
+	/* Get payload pointer and size */
+	data = IP_DATA(ip);
+	len -= IP_IHL(ip) * 4;
+
 	switch (ip->protocol) {
 		case IP_PROTO_ICMP:
-			icmpPacketHandler(ip, data, len - 20);
+			icmpPacketHandler(ip, data, len);
 			break;
 
 		case IP_PROTO_UDP:
-			udpPacketHandler(ip, data, len - 20);
+			udpPacketHandler(ip, data, len);
 			break;
 	}
 }
@@ -218,28 +424,6 @@ unsigned int ipGetAddress()
 	return ip_addr;
 }
 
-uint16 FASTCODE ip_chksum(uint16 csum, uint8 *data, int num)
-{
-	int chksum, ichksum;
-	uint16 temp;
-
-	chksum = csum;
-	for (; num > 0; num-=2, data+=2)
-	{
-		temp = (*data << 8) | *(data+1);
-		if (num == 1) temp &= 0xFF00;	/* Zero last byte if odd */
-		ichksum = chksum + temp;
-		ichksum = ichksum & 0x0000FFFF;
-		if ((ichksum < temp) || (ichksum < chksum))
-		{
-			ichksum += 1;
-			ichksum = ichksum & 0x0000FFFF;
-		}
-		chksum = ichksum;
-	}
-	return (uint16)~chksum;
-}
-
 void ipFillHeader(ip_frame_hdr *ip, unsigned int from, unsigned int to, unsigned char protocol)
 {
 	if (!ip) return;
@@ -247,31 +431,40 @@ void ipFillHeader(ip_frame_hdr *ip, unsigned int from, unsigned int to, unsigned
 	memset(ip, 0, 20);
 
 	ip->version_ihl = 0x45;
+	ip_ident++;
+	ip->identification = htons(ip_ident);
 	ip->ttl = 64;
 	ip->protocol = protocol;
 	ip->source_addr = htonl(from);
 	ip->dest_addr = htonl(to);
 }
 
+/* ipResolve()
+ *   Returns MAC address of the next hop to ipad. NULL means ARP request
+ * is sent and the caller should retry later.
+ */
+unsigned char *ipResolve(unsigned int ipad)
+{
+	if (ipad == 0xFFFFFFFF) return (unsigned char *)"\xFF\xFF\xFF\xFF\xFF\xFF";
+
+	if ( (ipad & ip_mask) != (ip_addr & ip_mask) ) ipad = ip_gateway;
+	return arpTableEntry(ipad);
+}
+
 int ipSendPacket(ip_frame_hdr *ip, pktbuf *data)
 {
 	unsigned char *macad;
-	unsigned int ipad;
 	pktbuf hdr;
 	pktbuf *buf;
 	unsigned short len;
 
 	if (!ip) return 0;
 
-	/* Route packet */
-	ipad = ntohl(ip->dest_addr);
-	if (ipad == 0xFFFFFFFF) {
-		macad = (unsigned char *)"\xFF\xFF\xFF\xFF\xFF\xFF";
-	} else {
-		if ( (ipad & ip_mask) != (ip_addr & ip_mask) ) ipad = ip_gateway;
-		macad = arpTableEntry(ipad);
-		/* No arp entry found -- drop packet */
-		if (!macad) return 0;
+	/* Route packet, no arp entry found -- drop packet */
+	macad = ipResolve(ntohl(ip->dest_addr));
+	if (!macad) {
+		briCountDrop(BRI_IF_LOCAL, BRI_CNT_DROP_NO_ARP);
+		return 0;
 	}
 
 	/* Calculate total packet length */
@@ -279,6 +472,10 @@ int ipSendPacket(ip_frame_hdr *ip, pktbuf *data)
 	for (buf = data; buf; buf = buf->next) {
 		len += buf->len;
 	}
+
+	/* Too large for one frame */
+	if (len > IP_MTU) return fragSend(ip, macad, data, len - 20);
+
 	ip->total_length = htons(len);
 
 	/* Calculate header checksum */
@@ -289,9 +486,8 @@ int ipSendPacket(ip_frame_hdr *ip, pktbuf *data)
 	hdr.next = data;
 	hdr.data = (unsigned char *)ip;
 	hdr.len = 20;
-	ifSendPacket(macad, ETH_TYPE_IP, &hdr);
-
-	return 1;
+	hdr.flags = 0;
+	return ifSendPacket(macad, ETH_TYPE_IP, &hdr);
 }
 
 /* ===== Utilites ===== */
@@ -38,6 +38,11 @@ typedef struct {
 	uint16		checksum;
 } PACKED udp_frame_hdr;
 
+/* Flags and fragment offset field, host order */
+#define IP_FLAG_DF		0x4000	/* Don't fragment */
+#define IP_FLAG_MF		0x2000	/* More fragments */
+#define IP_FRAG_OFFSET	0x1FFF	/* Offset, 8-byte blocks */
+
 /* Macros for accessing an IP datagram.  */
 #define IP_VERSION(a)	((a->version_ihl & 0x00F0) >> 4)
 #define IP_IHL(a)		((a->version_ihl & 0x000F))
@@ -50,22 +55,52 @@ void ipUpdateConfig(void);
 void ipPacketHandler(unsigned char *packet, unsigned short size);
 unsigned int ipGetAddress(void);
 uint16 ip_chksum(uint16 csum, uint8 *data, int num);
+uint16 ip_chksum_partial(uint8 *data, int num);
+uint16 ip_chksum_adjust(uint16 csum, uint32 oldv, uint32 newv);
+unsigned char *ipResolve(unsigned int ipad);
 void ipFillHeader(ip_frame_hdr *ip, unsigned int from, unsigned int to, unsigned char protocol);
 int ipSendPacket(ip_frame_hdr *ip, pktbuf *data);
 
 /* ICMP */
 
+/* ICMP message types */
+#define ICMP_ECHO_REPLY			0
+#define ICMP_DEST_UNREACH		3
+#define ICMP_SOURCE_QUENCH		4
+#define ICMP_REDIRECT			5
+#define ICMP_ECHO				8
+#define ICMP_TIME_EXCEEDED		11
+#define ICMP_PARAM_PROBLEM		12
+
+/* Handlers are keyed by protocol and id. Echo replies are passed by echo
+ * identifier, errors by the datagram in error: echo identifier for ICMP,
+ * source port for other protocols.
+ */
 typedef void (*icmpHandler)(ip_frame_hdr *ip, unsigned char *data, unsigned short size);
 
-void icmpRegisterHandler(icmpHandler newhandler);
+int icmpRegisterHandler(unsigned char protocol, unsigned short id, icmpHandler handler);
+void icmpUnregisterHandler(unsigned char protocol, unsigned short id);
 
 /* UDP */
 
 typedef void (*udpHandler)(ip_frame_hdr *ip, unsigned short sport, unsigned short dport,
 						   unsigned char *data, unsigned short size);
 
-void udpRegisterHandler(unsigned short port, udpHandler handler);
-void udpSendPacket(ip_frame_hdr *ip, unsigned short pfrom, unsigned short pto, pktbuf *data);
+/* Ports with handlers, at most half of the port table */
+#define UDP_MAX_PORTS	16
+
+typedef struct {
+	unsigned int	received;		/* Datagrams received */
+	unsigned int	unclaimed;		/* No handler for the port */
+	unsigned int	errors;			/* Truncated datagrams */
+} udp_stats;
+
+int udpRegisterHandler(unsigned short port, udpHandler handler);
+void udpUnregisterHandler(unsigned short port);
+void udpSetDefaultHandler(udpHandler handler);
+unsigned int udpGetPortStats(unsigned short port);
+void udpGetStats(udp_stats *stats);
+int udpSendPacket(ip_frame_hdr *ip, unsigned short pfrom, unsigned short pto, pktbuf *data);
 
 /* Utilites */
 
@@ -0,0 +1,260 @@
+
+#include <config.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <net/bridge.h>
+
+#include "ipfrag.h"
+
+
+/* Header space before reassembled payload, fits any IPv4 header */
+#define FRAG_HDR_SPACE		60
+#define FRAG_BLOCKS			((IP_FRAG_MAX_SIZE + 7) / 8)
+
+typedef struct {
+	unsigned char	expire;			/* 0 - free slot */
+	unsigned char	protocol;
+	unsigned char	parts;			/* Fragments received */
+	unsigned char	hlen;			/* Header length, 0 - first fragment not received */
+	unsigned short	id;
+	unsigned short	total;			/* Payload length, 0 - last fragment not received */
+	unsigned short	maxend;			/* Payload received end */
+	unsigned short	blocks;			/* Blocks received */
+	unsigned int	source;
+	unsigned int	dest;
+	unsigned char	map[(FRAG_BLOCKS + 7) / 8];
+	unsigned char	data[FRAG_HDR_SPACE + IP_FRAG_MAX_SIZE] __attribute__ ((aligned(4)));
+} frag_slot;
+
+/* ===== Variables ===== */
+
+static frag_slot fragslots[IP_FRAG_SLOTS];
+static frag_stats fragcounters;
+
+/* ===== Reassembly ===== */
+
+/* fragFind()
+ *   Returns slot of the datagram, free or oldest slot is taken for a new one
+ */
+static frag_slot *fragFind(ip_frame_hdr *ip)
+{
+	frag_slot *slot, *entry;
+	int i;
+
+	entry = NULL;
+	for (i = 0; i < IP_FRAG_SLOTS; i++) {
+		slot = &fragslots[i];
+		if ( slot->expire && (slot->id == ip->identification) && (slot->source == ip->source_addr) &&
+			 (slot->dest == ip->dest_addr) && (slot->protocol == ip->protocol) ) return slot;
+		if ( !entry || (slot->expire < entry->expire) ) entry = slot;
+	}
+
+	if (entry->expire) fragcounters.evicted++;
+
+	memset(entry, 0, offsetof(frag_slot, data));
+	entry->expire = IP_FRAG_TIMEOUT;
+	entry->protocol = ip->protocol;
+	entry->id = ip->identification;
+	entry->source = ip->source_addr;
+	entry->dest = ip->dest_addr;
+
+	return entry;
+}
+
+/* fragReassemble()
+ *   Takes fragment with valid length, returns the whole datagram when its
+ * last missing fragment is received, NULL otherwise. Datagram stays valid
+ * until the next fragment is passed.
+ */
+ip_frame_hdr *fragReassemble(ip_frame_hdr *ip)
+{
+	frag_slot *slot;
+	ip_frame_hdr *whole;
+	unsigned char *data;
+	unsigned int offset, end, n;
+	unsigned short flags, size;
+	int i, overlap;
+
+	fragcounters.fragments++;
+
+	flags = ntohs(ip->flags_frag_offset);
+	offset = (flags & IP_FRAG_OFFSET) * 8;
+	size = ntohs(ip->total_length) - IP_IHL(ip) * 4;
+	end = offset + size;
+	data = IP_DATA(ip);
+
+	/* Fragments except the last carry whole blocks */
+	if ( !size || ((flags & IP_FLAG_MF) && (size & 7)) || (end > IP_FRAG_MAX_SIZE) ) {
+		fragcounters.errors++;
+		return NULL;
+	}
+
+	slot = fragFind(ip);
+	if (++slot->parts > IP_FRAG_MAX_PARTS) goto error;
+
+	/* Datagram end must agree between fragments */
+	if (flags & IP_FLAG_MF) {
+		if (slot->total && (end > slot->total)) goto error;
+	} else {
+		if (slot->total && (end != slot->total)) goto error;
+		if (slot->maxend > end) goto error;
+		slot->total = end;
+	}
+	if (end > slot->maxend) slot->maxend = end;
+
+	/* Header of the first fragment is used for the datagram */
+	if (!offset && !slot->hlen) {
+		slot->hlen = IP_IHL(ip) * 4;
+		memcpy(&slot->data[FRAG_HDR_SPACE - slot->hlen], ip, slot->hlen);
+	}
+
+	/* Copy blocks not received yet */
+	overlap = 0;
+	for (i = offset / 8; offset < end; i++, offset += n, data += n) {
+		n = end - offset;
+		if (n > 8) n = 8;
+
+		if (slot->map[i >> 3] & (1 << (i & 7))) {
+			overlap = 1;
+			continue;
+		}
+
+		memcpy(&slot->data[FRAG_HDR_SPACE + offset], data, n);
+		slot->map[i >> 3] |= 1 << (i & 7);
+		slot->blocks++;
+	}
+	if (overlap) fragcounters.overlaps++;
+
+	/* Datagram is complete */
+	if ( !slot->hlen || !slot->total || (slot->blocks < (slot->total + 7) / 8) ) return NULL;
+
+	whole = (ip_frame_hdr *)&slot->data[FRAG_HDR_SPACE - slot->hlen];
+	whole->total_length = htons(slot->hlen + slot->total);
+	whole->flags_frag_offset = 0;
+	slot->expire = 0;
+	fragcounters.reassembled++;
+
+	return whole;
+
+error:
+	slot->expire = 0;
+	fragcounters.errors++;
+	return NULL;
+}
+
+/* fragTimers()
+ *   Drops datagrams not completed in time, called from ipTimers()
+ */
+void fragTimers()
+{
+	int i;
+
+	for (i = 0; i < IP_FRAG_SLOTS; i++) {
+		if (!fragslots[i].expire) continue;
+		if (!--fragslots[i].expire) fragcounters.timeouts++;
+	}
+}
+
+/* ===== Fragmentation ===== */
+
+/* fragSend()
+ *   Sends datagram with len bytes of data as fragments of IP_MTU. Fragments
+ * refer to the caller buffers, static data is still sent without copying.
+ * Buffer time stamps are set to the first fragment transmit time. Returns
+ * 0 if some fragment was dropped.
+ */
+int fragSend(ip_frame_hdr *ip, unsigned char *macad, pktbuf *data, unsigned short len)
+{
+	ip_frame_hdr frag;
+	pktbuf hdr, piece[IP_FRAG_PIECES];
+	pktbuf *src[IP_FRAG_PIECES];
+	unsigned short start[IP_FRAG_PIECES];
+	pktbuf *buf, *b;
+	unsigned short offset, pos, size, chunk, n, excess;
+	int i, ok;
+
+	/* Don't fragment is set */
+	if (ip->flags_frag_offset & htons(IP_FLAG_DF)) {
+		briCountDrop(BRI_IF_LOCAL, BRI_CNT_DROP_TX_SIZE);
+		return 0;
+	}
+
+	ok = 1;
+	buf = data;
+	pos = 0;
+	for (offset = 0; offset < len; offset += size) {
+		size = len - offset;
+		if (size > IP_MTU - 20) size = (IP_MTU - 20) & ~7;
+
+		/* Slice caller buffers */
+		chunk = 0;
+		for (i = 0; chunk < size; ) {
+			if (pos >= buf->len) {
+				buf = buf->next;
+				pos = 0;
+				continue;
+			}
+
+			/* Too scattered, fragment ends at the last whole block */
+			if (i >= IP_FRAG_PIECES) {
+				size = chunk & ~7;
+				if (!size) return 0;
+
+				for (excess = chunk - size; excess; excess -= n) {
+					n = piece[i-1].len;
+					if (n > excess) n = excess;
+					piece[i-1].len -= n;
+					buf = src[i-1];
+					pos = start[i-1] + piece[i-1].len;
+					if (!piece[i-1].len) i--;
+				}
+				break;
+			}
+
+			n = buf->len - pos;
+			if (n > size - chunk) n = size - chunk;
+			src[i] = buf;
+			start[i] = pos;
+			piece[i].data = buf->data + pos;
+			piece[i].len = n;
+			piece[i].flags = buf->flags & PKT_FLAG_STATIC;
+			piece[i].next = &piece[i+1];
+			chunk += n;
+			pos += n;
+			i++;
+		}
+		piece[i-1].next = NULL;
+
+		/* Fragment header */
+		memcpy(&frag, ip, 20);
+		frag.total_length = htons(20 + size);
+		frag.flags_frag_offset = htons((offset / 8) | ((offset + size < len) ? IP_FLAG_MF : 0));
+		frag.checksum = 0;
+		frag.checksum = htons(ip_chksum(0, (unsigned char *)&frag, 20));
+
+		hdr.next = piece;
+		hdr.data = (unsigned char *)&frag;
+		hdr.len = 20;
+		hdr.flags = 0;
+		hdr.tstamp = data->tstamp;
+		if (!ifSendPacket(macad, ETH_TYPE_IP, &hdr)) ok = 0;
+		fragcounters.fragsent++;
+
+		/* Datagram time is the first fragment time */
+		if (!offset) {
+			for (b = data; b; b = b->next) {
+				if (!(b->flags & PKT_FLAG_POOL)) b->tstamp = hdr.tstamp;
+			}
+		}
+	}
+
+	fragcounters.sent++;
+
+	return ok;
+}
+
+void fragGetStats(frag_stats *stats)
+{
+	*stats = fragcounters;
+}
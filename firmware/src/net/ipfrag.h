@@ -0,0 +1,44 @@
+
+#ifndef _IPFRAG_H
+#define _IPFRAG_H
+
+#include <net/ip.h>
+
+/* IPv4 fragmentation and reassembly
+ *
+ *   Reassembly keeps fragments of up to IP_FRAG_SLOTS datagrams in fixed
+ * buffers. Fragment data is tracked in 8-byte blocks, overlapping data is
+ * dropped and the first copy received is kept. New datagram takes the
+ * oldest slot when all are busy.
+ */
+
+#ifndef IP_FRAG_SLOTS
+#define IP_FRAG_SLOTS		2
+#endif
+#ifndef IP_FRAG_MAX_SIZE
+#define IP_FRAG_MAX_SIZE	4096	/* Reassembled payload, bytes */
+#endif
+
+#define IP_FRAG_MAX_PARTS	48		/* Fragments per datagram */
+#define IP_FRAG_TIMEOUT		30		/* ipTimers() calls, 0.5 s each */
+
+#define IP_MTU				1500	/* Largest datagram sent unfragmented */
+#define IP_FRAG_PIECES		8		/* Data buffers per fragment sent */
+
+typedef struct {
+	unsigned int	fragments;		/* Fragments received */
+	unsigned int	reassembled;	/* Datagrams passed up */
+	unsigned int	timeouts;		/* Datagrams expired incomplete */
+	unsigned int	evicted;		/* Datagrams dropped for a new one */
+	unsigned int	overlaps;		/* Fragments with data received before */
+	unsigned int	errors;			/* Bad, oversize or too many fragments */
+	unsigned int	sent;			/* Datagrams sent fragmented */
+	unsigned int	fragsent;		/* Fragments sent */
+} frag_stats;
+
+ip_frame_hdr *fragReassemble(ip_frame_hdr *ip);
+int fragSend(ip_frame_hdr *ip, unsigned char *macad, pktbuf *data, unsigned short len);
+void fragTimers(void);
+void fragGetStats(frag_stats *stats);
+
+#endif
@@ -0,0 +1,106 @@
+
+#include <config.h>
+#include <string.h>
+
+#include <os/irq.h>
+
+#include "pktpool.h"
+
+
+/* ===== Pool data ===== */
+
+/* Buffers are shared by interrupt handlers and the main loop */
+static pktbuf pool[PKT_POOL_COUNT];
+static unsigned char pooldata[PKT_POOL_COUNT][PKT_POOL_BUFSIZE] __attribute__ ((aligned(8)));
+static unsigned char poolrefs[PKT_POOL_COUNT];
+
+static pkt_pool_stats poolstats;
+
+/* ===== Exported functions ===== */
+
+void pktInit()
+{
+	int i;
+
+	for (i = 0; i < PKT_POOL_COUNT; i++) {
+		pool[i].data = pooldata[i];
+		poolrefs[i] = 0;
+	}
+
+	memset(&poolstats, 0, sizeof(poolstats));
+	poolstats.free = PKT_POOL_COUNT;
+	poolstats.minfree = PKT_POOL_COUNT;
+}
+
+/* pktAlloc()
+ *   Returns empty buffer with one reference, or NULL if pool is exhausted
+ */
+pktbuf *pktAlloc(unsigned char user)
+{
+	unsigned int cpsr;
+	pktbuf *packet;
+	int i;
+
+	cpsr = irqLock();
+
+	for (i = 0; i < PKT_POOL_COUNT; i++) {
+		if (!poolrefs[i]) break;
+	}
+
+	if (i >= PKT_POOL_COUNT) {
+		if (user < PKT_USER_COUNT) poolstats.exhausted[user]++;
+		irqUnlock(cpsr);
+		return NULL;
+	}
+
+	poolrefs[i] = 1;
+	poolstats.free--;
+	if (poolstats.free < poolstats.minfree) poolstats.minfree = poolstats.free;
+
+	irqUnlock(cpsr);
+
+	packet = &pool[i];
+	packet->next = NULL;
+	packet->data = pooldata[i];
+	packet->len = 0;
+	packet->flags = PKT_FLAG_POOL;
+	packet->tstamp = 0;
+
+	return packet;
+}
+
+/* pktRef()
+ *   Adds reference to the pool buffer, it stays allocated until every
+ * holder calls pktFree()
+ */
+void pktRef(pktbuf *packet)
+{
+	unsigned int cpsr;
+	unsigned int i = packet - pool;
+
+	if (i >= PKT_POOL_COUNT) return;
+
+	cpsr = irqLock();
+	poolrefs[i]++;
+	irqUnlock(cpsr);
+}
+
+void pktFree(pktbuf *packet)
+{
+	unsigned int cpsr;
+	unsigned int i = packet - pool;
+
+	if (i >= PKT_POOL_COUNT) return;
+
+	cpsr = irqLock();
+	if (poolrefs[i]) {
+		poolrefs[i]--;
+		if (!poolrefs[i]) poolstats.free++;
+	}
+	irqUnlock(cpsr);
+}
+
+void pktGetStats(pkt_pool_stats *stats)
+{
+	memcpy(stats, &poolstats, sizeof(pkt_pool_stats));
+}
@@ -0,0 +1,43 @@
+
+#ifndef _PKTPOOL_H
+#define _PKTPOOL_H
+
+#include <net/bridge.h>
+
+/* Packet pool
+ *
+ *   Buffers for frames which have to be copied or held past the receive
+ * call: the local stack receive queue and USB adapter receive. EMAC sends
+ * pool buffers by reference. EMAC receive does not use the pool, as the
+ * controller fills its ring of 128-byte buffers, which are loaned to the
+ * bridge without a copy. IP stack transmit builds frames from headers on
+ * the stack and static payloads, which EMAC sends by reference or packs
+ * into its staging ring, so a pool buffer would only add a copy.
+ */
+
+/* Packet pool size, every buffer holds full frame */
+#ifndef PKT_POOL_COUNT
+#define PKT_POOL_COUNT		4
+#endif
+#define PKT_POOL_BUFSIZE	1536
+
+/* Pool users, for exhaustion accounting */
+#define PKT_USER_LOCAL		0		/* Local stack receive queue */
+#define PKT_USER_USB		1		/* USB adapter receive */
+#define PKT_USER_COUNT		2
+
+typedef struct {
+	unsigned char	free;							/* Free buffers */
+	unsigned char	minfree;						/* Lowest free count since power on */
+	unsigned int	exhausted[PKT_USER_COUNT];		/* Failed allocations */
+} pkt_pool_stats;
+
+void pktInit(void);
+
+pktbuf *pktAlloc(unsigned char user);
+void pktRef(pktbuf *packet);
+void pktFree(pktbuf *packet);
+
+void pktGetStats(pkt_pool_stats *stats);
+
+#endif
@@ -0,0 +1,395 @@
+
+#include <config.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <drivers/sdcard.h>
+#include <drivers/tstamp.h>
+#include <fs/volume.h>
+#include <net/ip.h>
+#include <net/trafgen.h>
+
+#include "rfc2544.h"
+
+
+/* Trial phases */
+#define RFC_PHASE_SEND		0			/* Generator is sending */
+#define RFC_PHASE_SETTLE	1			/* Waiting for frames still in flight */
+
+const unsigned short rfcSizes[RFC_SIZES] = { 64, 128, 256, 512, 1024, 1280, 1518 };
+
+/* ===== Benchmark data ===== */
+
+static rfc_config rfccfg;
+static rfc_status rfcstat;
+static rfc_result rfcres[RFC_SIZES];
+
+static unsigned char rfcphase;
+static unsigned long long rfcsettle;		/* End of the settle time, ticks */
+
+/* Search state of the test running */
+static unsigned int rfclo;					/* Highest value passed */
+static unsigned int rfchi;					/* Lowest value failed */
+static unsigned int rfcstep;				/* Search resolution, frame loss step */
+static unsigned char rfcclean;				/* Successive trials without loss */
+
+/* Report writing */
+static Volume *rfcvol;
+static unsigned int rfcfile[2];				/* First extent of the result file */
+static unsigned int rfcpos;					/* Bytes written */
+static char rfcline[100];
+
+
+/* ===== Internal functions ===== */
+
+/* rfcNextTest()
+ *   Returns test selected after the given one, 0 if none is left
+ */
+static unsigned char rfcNextTest(unsigned char test)
+{
+	for (test = test ? (test << 1) : 1; test & RFC_TEST_ALL; test <<= 1) {
+		if (rfccfg.tests & test) return test;
+	}
+
+	return 0;
+}
+
+/* rfcFinish()
+ *   Ends the benchmark and stops the generator
+ */
+static void rfcFinish(unsigned char state)
+{
+	tgStop();
+	rfcstat.state = state;
+}
+
+/* rfcTrial()
+ *   Starts generator for a trial at the current frame size. Always returns 1,
+ * benchmark is stopped with error if the generator does not start.
+ */
+static int rfcTrial(unsigned int rate, unsigned int count)
+{
+	tg_config tg;
+
+	tg.dest = rfccfg.dest;
+	tg.port = rfccfg.port;
+	tg.size = rfcSizes[rfcstat.size];
+	tg.rate = rate ? rate : 1;
+	tg.count = count;
+	tg.dscp = 0;
+
+	rfcstat.rate = tg.rate;
+	rfcstat.count = count;
+	rfcstat.trial++;
+	rfcphase = RFC_PHASE_SEND;
+
+	if (!tgStart(&tg, 1)) rfcFinish(RFC_STATE_ERROR);
+	return 1;
+}
+
+/* rfcPuts()
+ *   Appends text to the result file, full sectors are written out
+ */
+static void rfcPuts(const char *text)
+{
+	unsigned int pos;
+
+	while (*text) {
+		/* File space is exhausted */
+		if (rfcpos >= rfcfile[1] * SECTOR_SIZE) return;
+
+		pos = rfcpos % SECTOR_SIZE;
+		rfcvol->sector[pos] = *text++;
+		rfcpos++;
+
+		if (pos == SECTOR_SIZE - 1) sdcBlockWrite(rfcvol->sector, rfcfile[0] + rfcpos / SECTOR_SIZE - 1, 1);
+	}
+}
+
+/* rfcSave()
+ *   Writes report to the result file if it exists, the first file extent
+ * is used only.
+ */
+static void rfcSave()
+{
+	rfc_result *r;
+	unsigned int ip, pos;
+	char ipbuf[16];
+	char *s;
+	int i, j;
+
+	if (!sdcCardActivate()) return;
+	rfcvol = volGetVolume(VOL_SDCARD);
+	if (!volMount(rfcvol, sdcGetMedia())) return;
+	if (!volGetFileSpace(rfcvol, RFC_FILE_NAME, rfcfile, 1)) return;
+
+	/* Report is put together over the volume cache */
+	rfcvol->sectornum = 0xFFFFFFFF;
+	rfcpos = 0;
+
+	ip = htonl(rfccfg.dest);
+	rfcPuts("RFC 2544 benchmark\r\n");
+	sprintf(rfcline, "Reflector %s port %u, maximum rate %u kbit/s, trial %u s\r\n\r\n",
+			inet_ntoa(ipbuf, (unsigned char *)&ip), rfccfg.port, rfccfg.rate, rfccfg.duration);
+	rfcPuts(rfcline);
+
+	rfcPuts("Size  Throughput,kbit/s  RTT min/avg/max,us  Back-to-back,frames\r\n");
+	for (i = 0; i < RFC_SIZES; i++) {
+		r = &rfcres[i];
+
+		s = rfcline + sprintf(rfcline, "%4u  ", rfcSizes[i]);
+		if (r->done & RFC_TEST_THROUGHPUT) {
+			s += sprintf(s, "%17u%c  ", r->throughput, (r->limited & RFC_TEST_THROUGHPUT) ? '*' : ' ');
+		} else {
+			s += sprintf(s, "%17s   ", "-");
+		}
+		if ( (r->done & RFC_TEST_LATENCY) && r->throughput ) {
+			s += sprintf(s, "%7u/%u/%u  ", r->rtt_min, r->rtt_avg, r->rtt_max);
+		} else {
+			s += sprintf(s, "%7s  ", "-");
+		}
+		if (r->done & RFC_TEST_BURST) {
+			sprintf(s, "%u%s\r\n", r->burst, (r->limited & RFC_TEST_BURST) ? "*" : "");
+		} else {
+			sprintf(s, "-\r\n");
+		}
+		rfcPuts(rfcline);
+	}
+
+	rfcPuts("\r\nFrame loss, % at 100%..10% of maximum rate\r\n");
+	for (i = 0; i < RFC_SIZES; i++) {
+		s = rfcline + sprintf(rfcline, "%4u ", rfcSizes[i]);
+		for (j = 0; j < RFC_LOSS_STEPS; j++) {
+			if (rfcres[i].loss[j] == RFC_LOSS_NONE) {
+				s += sprintf(s, "      -");
+			} else {
+				s += sprintf(s, " %3u.%02u", rfcres[i].loss[j] / 100, rfcres[i].loss[j] % 100);
+			}
+		}
+		sprintf(s, "\r\n");
+		rfcPuts(rfcline);
+	}
+
+	rfcPuts("\r\n* generator did not reach the offered rate\r\n");
+
+	/* Last sector is padded, file size excludes padding */
+	pos = rfcpos % SECTOR_SIZE;
+	if (pos && (rfcpos < rfcfile[1] * SECTOR_SIZE)) {
+		memset(&rfcvol->sector[pos], 0, SECTOR_SIZE - pos);
+		sdcBlockWrite(rfcvol->sector, rfcfile[0] + rfcpos / SECTOR_SIZE, 1);
+	}
+
+	rfcvol->sectornum = 0xFFFFFFFF;
+	volSetFileSize(rfcvol, RFC_FILE_NAME, rfcpos);
+}
+
+/* rfcBegin()
+ *   Starts the first trial of the test at the current frame size, moving
+ * on to the next sizes and tests if nothing is to be done. Returns 0 when
+ * benchmark is finished.
+ */
+static int rfcBegin()
+{
+	rfc_result *r;
+	unsigned short size;
+
+	while (rfcstat.test) {
+		if (rfcstat.size >= RFC_SIZES) {
+			rfcstat.size = 0;
+			rfcstat.test = rfcNextTest(rfcstat.test);
+			continue;
+		}
+
+		r = &rfcres[rfcstat.size];
+		size = rfcSizes[rfcstat.size];
+
+		switch (rfcstat.test) {
+			case RFC_TEST_THROUGHPUT:
+				rfclo = 0;
+				rfchi = rfccfg.rate;
+				rfcstep = rfccfg.rate / RFC_RESOLUTION;
+				return rfcTrial(rfccfg.rate, tgFrames(rfccfg.rate, size, rfccfg.duration));
+
+			case RFC_TEST_LATENCY:
+				/* Needs throughput of the size */
+				if (!r->throughput) break;
+				return rfcTrial(r->throughput, tgFrames(r->throughput, size, rfccfg.duration));
+
+			case RFC_TEST_LOSS:
+				rfcstep = 0;
+				rfcclean = 0;
+				return rfcTrial(rfccfg.rate, tgFrames(rfccfg.rate, size, rfccfg.duration));
+
+			case RFC_TEST_BURST:
+				rfclo = 0;
+				rfchi = tgFrames(rfccfg.rate, size, RFC_BURST_TIME);
+				rfcstep = rfchi / RFC_RESOLUTION;
+				return rfcTrial(rfccfg.rate, rfchi);
+		}
+
+		rfcstat.size++;
+	}
+
+	rfcFinish(RFC_STATE_DONE);
+	rfcSave();
+
+	return 0;
+}
+
+/* rfcEvaluate()
+ *   Records trial result and starts the next trial. Returns 0 when the
+ * test at the current size is finished.
+ */
+static int rfcEvaluate(tg_stats *tg)
+{
+	rfc_result *r;
+	unsigned int lost, achieved, rate, mid;
+	unsigned char limited;
+
+	r = &rfcres[rfcstat.size];
+	rate = rfcstat.rate;
+	lost = (tg->frames > tg->received) ? (tg->frames - tg->received) : 0;
+
+	/* Wire rate actually sent, bytes per ms is kbit/s divided by 8 */
+	achieved = rate;
+	if (tg->elapsed) achieved = (tg->bytes + (unsigned long long)tg->frames * TG_WIRE_OVERHEAD) * 8 / tg->elapsed;
+	if (achieved > rate) achieved = rate;
+	limited = (achieved < rate - rate / RFC_RESOLUTION) ? rfcstat.test : 0;
+
+	switch (rfcstat.test) {
+		case RFC_TEST_THROUGHPUT:
+			if (lost) {
+				rfchi = rate;
+			} else {
+				rfclo = rate;
+				if (achieved >= r->throughput) {
+					r->throughput = achieved;
+					r->limited = (r->limited & ~RFC_TEST_THROUGHPUT) | limited;
+				}
+				if (rate == rfccfg.rate) return 0;
+			}
+			if (rfchi - rfclo <= rfcstep) return 0;
+
+			mid = (rfclo + rfchi) / 2;
+			return rfcTrial(mid, tgFrames(mid, rfcSizes[rfcstat.size], rfccfg.duration));
+
+		case RFC_TEST_LATENCY:
+			if (tg->received) {
+				r->rtt_min = tg->rtt_min / TS_TICKS_PER_US;
+				r->rtt_avg = tg->rtt_sum / tg->received / TS_TICKS_PER_US;
+				r->rtt_max = tg->rtt_max / TS_TICKS_PER_US;
+			}
+			r->limited |= limited;
+			return 0;
+
+		case RFC_TEST_LOSS:
+			r->loss[rfcstep] = tg->frames ? (unsigned long long)lost * 10000 / tg->frames : 0;
+			r->limited |= limited;
+			rfcclean = lost ? 0 : rfcclean + 1;
+			rfcstep++;
+
+			/* Two successive trials without loss, lower rates are taken as lossless */
+			if (rfcclean >= 2) {
+				for (; rfcstep < RFC_LOSS_STEPS; rfcstep++) r->loss[rfcstep] = 0;
+				return 0;
+			}
+			if (rfcstep >= RFC_LOSS_STEPS) return 0;
+
+			rate = rfccfg.rate / RFC_LOSS_STEPS * (RFC_LOSS_STEPS - rfcstep);
+			return rfcTrial(rate, tgFrames(rate, rfcSizes[rfcstat.size], rfccfg.duration));
+
+		case RFC_TEST_BURST:
+			if (lost) {
+				rfchi = rfcstat.count;
+			} else {
+				rfclo = rfcstat.count;
+				if (rfclo > r->burst) {
+					r->burst = rfclo;
+					r->limited = (r->limited & ~RFC_TEST_BURST) | limited;
+				}
+				if (rfclo == rfchi) return 0;
+			}
+			if (rfchi - rfclo <= rfcstep + 1) return 0;
+
+			return rfcTrial(rfccfg.rate, (rfclo + rfchi) / 2);
+	}
+
+	return 0;
+}
+
+/* ===== Exported functions ===== */
+
+/* rfcStart()
+ *   Clears results and starts selected tests, returns 0 if configuration
+ * is invalid.
+ */
+int rfcStart(const rfc_config *cfg)
+{
+	int i, j;
+
+	if (rfcstat.state == RFC_STATE_RUNNING) return 0;
+	if ( (!cfg->dest) || (!cfg->duration) || (!(cfg->tests & RFC_TEST_ALL)) ) return 0;
+	if ( (cfg->rate < RFC_RESOLUTION) || (cfg->rate > TG_MAX_RATE) ) return 0;
+	if (!ipGetAddress()) return 0;
+
+	rfccfg = *cfg;
+	memset(rfcres, 0, sizeof(rfcres));
+	for (i = 0; i < RFC_SIZES; i++) {
+		for (j = 0; j < RFC_LOSS_STEPS; j++) rfcres[i].loss[j] = RFC_LOSS_NONE;
+	}
+
+	memset(&rfcstat, 0, sizeof(rfcstat));
+	rfcstat.state = RFC_STATE_RUNNING;
+	rfcstat.test = rfcNextTest(0);
+	rfcBegin();
+
+	return 1;
+}
+
+void rfcStop()
+{
+	if (rfcstat.state != RFC_STATE_RUNNING) return;
+
+	rfcFinish(RFC_STATE_IDLE);
+}
+
+/* rfcPoll()
+ *   Follows trial progress, called from the main loop
+ */
+void rfcPoll()
+{
+	tg_stats tg;
+
+	if (rfcstat.state != RFC_STATE_RUNNING) return;
+
+	tgGetStats(0, &tg);
+
+	if (rfcphase == RFC_PHASE_SEND) {
+		if (tg.state == TG_STATE_NOARP) rfcFinish(RFC_STATE_NOARP);
+		if (tg.state != TG_STATE_DONE) return;
+
+		/* Frames may still be on the way back */
+		rfcphase = RFC_PHASE_SETTLE;
+		rfcsettle = tsGetTicks64() + (unsigned long long)RFC_SETTLE_TIME * TS_TICKS_PER_SEC;
+		return;
+	}
+
+	if (tsGetTicks64() < rfcsettle) return;
+
+	if (rfcEvaluate(&tg)) return;
+
+	/* Test at this size is finished */
+	rfcres[rfcstat.size].done |= rfcstat.test;
+	rfcstat.size++;
+	rfcBegin();
+}
+
+void rfcGetStatus(rfc_status *status)
+{
+	*status = rfcstat;
+}
+
+const rfc_result *rfcGetResults()
+{
+	return rfcres;
+}
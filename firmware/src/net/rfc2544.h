@@ -0,0 +1,83 @@
+
+#ifndef _RFC2544_H
+#define _RFC2544_H
+
+/* RFC 2544 benchmark
+ *
+ *   Trials are run by the traffic generator against a remote reflector,
+ * frames lost are those not returned. Tests run in the RFC order, each over
+ * all standard frame sizes:
+ *
+ *     throughput      binary search for the highest rate without loss
+ *     latency         round trip time at the throughput rate
+ *     frame loss      loss at 100%, 90%... of the maximum rate, until two
+ *                     successive trials without loss
+ *     back-to-back    binary search for the longest burst at the maximum
+ *                     rate without loss
+ *
+ *   Results stay in RAM until the next start. The report is also written to
+ * the result file if it exists on the SD card.
+ */
+
+#define RFC_FILE_NAME		"rfc2544.txt"
+
+#define RFC_SIZES			7			/* 64, 128, 256, 512, 1024, 1280, 1518 */
+#define RFC_LOSS_STEPS		10			/* Frame loss rates, 100% down to 10% */
+
+#define RFC_SETTLE_TIME		2			/* Wait for returned frames after a trial, s */
+#define RFC_BURST_TIME		2			/* Longest back-to-back burst, s */
+#define RFC_RESOLUTION		100			/* Binary search stops at rate / RFC_RESOLUTION */
+
+/* Tests */
+#define RFC_TEST_THROUGHPUT	0x01
+#define RFC_TEST_LATENCY	0x02
+#define RFC_TEST_LOSS		0x04
+#define RFC_TEST_BURST		0x08
+#define RFC_TEST_ALL		0x0F
+
+/* Benchmark states */
+#define RFC_STATE_IDLE		0
+#define RFC_STATE_RUNNING	1
+#define RFC_STATE_DONE		2
+#define RFC_STATE_NOARP		3			/* Reflector does not answer ARP */
+#define RFC_STATE_ERROR		4			/* Generator did not start, local address lost */
+
+#define RFC_LOSS_NONE		0xFFFF		/* Loss step not measured */
+
+typedef struct {
+	unsigned int	dest;				/* Reflector IP, host order */
+	unsigned short	port;				/* Reflector UDP port */
+	unsigned int	rate;				/* Maximum rate, kbit/s */
+	unsigned short	duration;			/* Trial length, s */
+	unsigned char	tests;				/* RFC_TEST_* */
+} rfc_config;
+
+typedef struct {
+	unsigned int	throughput;			/* kbit/s on the wire */
+	unsigned int	rtt_min;			/* us */
+	unsigned int	rtt_avg;
+	unsigned int	rtt_max;
+	unsigned short	loss[RFC_LOSS_STEPS];	/* Frames lost, 0.01% units */
+	unsigned int	burst;				/* Frames */
+	unsigned char	done;				/* Tests finished */
+	unsigned char	limited;			/* Tests where generator was below the offered rate */
+} rfc_result;
+
+typedef struct {
+	unsigned char	state;
+	unsigned char	test;				/* Test running */
+	unsigned char	size;				/* Frame size index */
+	unsigned short	trial;				/* Trials run */
+	unsigned int	rate;				/* Rate of the trial, kbit/s */
+	unsigned int	count;				/* Frames in the trial */
+} rfc_status;
+
+extern const unsigned short rfcSizes[RFC_SIZES];
+
+int rfcStart(const rfc_config *cfg);
+void rfcStop(void);
+void rfcPoll(void);
+void rfcGetStatus(rfc_status *status);
+const rfc_result *rfcGetResults(void);
+
+#endif
@@ -0,0 +1,410 @@
+
+#include <config.h>
+#include <string.h>
+
+#include <drivers/ethernet.h>
+#include <drivers/tstamp.h>
+#include <os/irq.h>
+#include <net/bridge.h>
+#include <net/ip.h>
+
+#include "trafgen.h"
+
+
+/* Frame layout */
+#define TG_ETH_SIZE			14
+#define TG_HDR_SIZE			(TG_ETH_SIZE + 20 + sizeof(udp_frame_hdr) + sizeof(tg_payload))
+
+/* Frames up to this size are copied whole, one descriptor is cheaper than two */
+#define TG_COPY_SIZE		128
+
+/* Pacing is kept in timebase ticks with 16 fraction bits, so the
+ * frame interval does not drift at fractional tick values.
+ */
+#define TG_FRAC_BITS		16
+
+/* Schedule is reset if sending falls this far behind, ticks */
+#define TG_MAX_LAG			(TS_TICKS_PER_SEC / 1000)
+
+#define TG_ARP_TIMEOUT		(3 * TS_TICKS_PER_SEC)
+
+struct tgstream {
+	tg_config			cfg;
+	tg_stats			stats;
+
+	/* Header template, patched fields and checksums in host order */
+	unsigned char		hdr[TG_HDR_SIZE];
+	unsigned short		id;
+	unsigned int		seq;
+	unsigned int		stamp;
+	unsigned short		ipsum;
+	unsigned short		udpsum;
+
+	unsigned char		resolved;		/* Destination MAC is known */
+	unsigned char		done;			/* All frames sent */
+	unsigned long long	next;			/* Next frame time, fixed point */
+	unsigned long long	interval;		/* Frame interval, fixed point */
+	unsigned long long	stop;			/* Time the last frame was sent, ticks */
+};
+
+#define tgIP(s)			( (ip_frame_hdr *)&(s)->hdr[TG_ETH_SIZE] )
+#define tgUDP(s)		( (udp_frame_hdr *)&(s)->hdr[TG_ETH_SIZE + 20] )
+#define tgPayload(s)	( (tg_payload *)&(s)->hdr[TG_ETH_SIZE + 20 + sizeof(udp_frame_hdr)] )
+
+/* ===== Generator data ===== */
+
+/* Payload after the headers, shared by all streams and sent by reference */
+static unsigned char tgdata[TG_MAX_SIZE - 4 - TG_HDR_SIZE] __attribute__ ((aligned(4)));
+
+static struct tgstream tgstreams[TG_MAX_STREAMS];
+static int tgcount;
+static unsigned char tgstate;
+static unsigned short tgrun;
+
+static unsigned long long tgstart;			/* Start of sending or of ARP, ticks */
+static unsigned long long tgstop;
+
+
+/* ===== Internal functions ===== */
+
+/* tgBuild()
+ *   Fills stream header template except destination MAC, checksums are
+ * summed here only.
+ */
+static void tgBuild(struct tgstream *s, int index)
+{
+	struct {
+		uint32	source_addr;
+		uint32	dest_addr;
+		uint8	zero;
+		uint8	protocol;
+		uint16	length;
+	} PACKED pseudo;
+	ip_frame_hdr *ip;
+	udp_frame_hdr *udp;
+	tg_payload *pl;
+	unsigned short len;
+
+	ip = tgIP(s);
+	udp = tgUDP(s);
+	pl = tgPayload(s);
+	len = s->cfg.size - 4;
+
+	/* Ethernet */
+	memcpy(&s->hdr[6], ifGetAddress(), 6);
+	s->hdr[12] = ETH_TYPE_IP >> 8;
+	s->hdr[13] = ETH_TYPE_IP & 0xFF;
+
+	s->id = 0;
+	s->seq = 0;
+	s->stamp = 0;
+	pl->magic = htonl(TG_MAGIC);
+	pl->run = htons(tgrun);
+	pl->stream = htons(index);
+	pl->seq = 0;
+	pl->tstamp = 0;
+
+	/* UDP */
+	udp->sport = htons(TG_SRC_PORT);
+	udp->dport = htons(s->cfg.port);
+	udp->length = htons(len - TG_ETH_SIZE - 20);
+	udp->checksum = 0;
+
+	/* IP */
+	ipFillHeader(ip, ipGetAddress(), s->cfg.dest, IP_PROTO_UDP);
+	ip->service_type = s->cfg.dscp << 2;
+	ip->total_length = htons(len - TG_ETH_SIZE);
+	s->ipsum = ip_chksum(0, (unsigned char *)ip, 20);
+	ip->checksum = htons(s->ipsum);
+
+	pseudo.source_addr = ip->source_addr;
+	pseudo.dest_addr = ip->dest_addr;
+	pseudo.zero = 0;
+	pseudo.protocol = IP_PROTO_UDP;
+	pseudo.length = udp->length;
+	s->udpsum = ip_chksum(0, (unsigned char *)&pseudo, sizeof(pseudo));
+	s->udpsum = ip_chksum(~s->udpsum, (unsigned char *)udp, sizeof(udp_frame_hdr) + sizeof(tg_payload));
+	s->udpsum = ip_chksum(~s->udpsum, tgdata, len - TG_HDR_SIZE);
+	if (!s->udpsum) s->udpsum = 0xFFFF;
+	udp->checksum = htons(s->udpsum);
+}
+
+/* tgSend()
+ *   Patches stream template for the next frame and queues it to EMAC
+ */
+static int tgSend(struct tgstream *s)
+{
+	pktbuf head, body;
+	unsigned int seq, stamp;
+	unsigned short id;
+	tg_payload *pl;
+	int res;
+
+	seq = s->stats.frames;
+	stamp = tsGetTicks();
+	id = seq;
+	pl = tgPayload(s);
+
+	/* IP identification follows the sequence number */
+	s->ipsum = ip_chksum_adjust(s->ipsum, s->id, id);
+	tgIP(s)->identification = htons(id);
+	tgIP(s)->checksum = htons(s->ipsum);
+	s->id = id;
+
+	s->udpsum = ip_chksum_adjust(s->udpsum, s->seq, seq);
+	s->udpsum = ip_chksum_adjust(s->udpsum, s->stamp, stamp);
+	if (!s->udpsum) s->udpsum = 0xFFFF;
+	pl->seq = htonl(seq);
+	pl->tstamp = htonl(stamp);
+	tgUDP(s)->checksum = htons(s->udpsum);
+	s->seq = seq;
+	s->stamp = stamp;
+
+	/* Headers are copied to staging, so is the payload of short frames */
+	head.next = &body;
+	head.data = s->hdr;
+	head.len = TG_HDR_SIZE;
+	head.flags = 0;
+	body.next = NULL;
+	body.data = tgdata;
+	body.len = s->cfg.size - 4 - TG_HDR_SIZE;
+	body.flags = (s->cfg.size > TG_COPY_SIZE) ? PKT_FLAG_STATIC : 0;
+
+	res = EthSendFrame(&head);
+	if (res == IF_SEND_OK) {
+		s->stats.frames++;
+		s->stats.bytes += s->cfg.size;
+	}
+
+	return res;
+}
+
+/* tgRecv()
+ *   Counts generated frames returned by the reflector. Called by the bridge
+ * for frames to the local stack, possibly from interrupt handlers.
+ */
+static int tgRecv(pktbuf *packet, unsigned short size)
+{
+	unsigned char *data;
+	tg_payload *pl;
+	tg_stats *st;
+	unsigned int rtt, index;
+
+	/* UDP to the source port without IP options, headers in the first chunk */
+	data = packet->data;
+	if (packet->len < TG_HDR_SIZE) return 0;
+	if ( (data[12] != (ETH_TYPE_IP >> 8)) || (data[13] != (ETH_TYPE_IP & 0xFF)) ) return 0;
+	if ( (data[TG_ETH_SIZE] != 0x45) || (data[TG_ETH_SIZE + 9] != IP_PROTO_UDP) ) return 0;
+	if ( ((data[TG_ETH_SIZE + 22] << 8) | data[TG_ETH_SIZE + 23]) != TG_SRC_PORT ) return 0;
+
+	pl = (tg_payload *)&data[TG_HDR_SIZE - sizeof(tg_payload)];
+	if (ntohl(pl->magic) != TG_MAGIC) return 0;
+
+	/* Frames of earlier runs are consumed but not counted */
+	index = ntohs(pl->stream);
+	if ( (ntohs(pl->run) != tgrun) || (index >= tgcount) ) return 1;
+
+	st = &tgstreams[index].stats;
+	rtt = packet->tstamp - ntohl(pl->tstamp);
+	if ( (!st->received) || (rtt < st->rtt_min) ) st->rtt_min = rtt;
+	if (rtt > st->rtt_max) st->rtt_max = rtt;
+	st->rtt_sum += rtt;
+	st->received++;
+
+	return 1;
+}
+
+/* tgResolve()
+ *   Waits for destination MAC addresses, then starts sending
+ */
+static void tgResolve()
+{
+	struct tgstream *s;
+	unsigned char *mac;
+	int i, wait;
+
+	wait = 0;
+	for (i = 0; i < tgcount; i++) {
+		s = &tgstreams[i];
+		if (s->resolved) continue;
+
+		mac = ipResolve(s->cfg.dest);
+		if (!mac) {
+			wait = 1;
+			continue;
+		}
+		memcpy(s->hdr, mac, 6);
+		s->resolved = 1;
+	}
+
+	if (wait) {
+		if ( (tsGetTicks64() - tgstart) > TG_ARP_TIMEOUT ) tgstate = TG_STATE_NOARP;
+		return;
+	}
+
+	tgstart = tsGetTicks64();
+	tgstop = tgstart;
+	for (i = 0; i < tgcount; i++) {
+		tgstreams[i].next = tgstart << TG_FRAC_BITS;
+		tgstreams[i].stop = tgstart;
+	}
+	tgstate = TG_STATE_RUNNING;
+}
+
+/* tgPace()
+ *   Sends stream frame if it is due, returns 0 if nothing was sent
+ */
+static int tgPace(struct tgstream *s, unsigned long long now)
+{
+	if (s->done) return 0;
+
+	if ( (s->cfg.count) && (s->stats.frames >= s->cfg.count) ) {
+		s->done = 1;
+		s->stop = tsGetTicks64();
+		return 0;
+	}
+
+	/* Main loop was held too long, do not burst to catch up */
+	if ( now > s->next + ((unsigned long long)TG_MAX_LAG << TG_FRAC_BITS) ) {
+		s->next = now;
+		s->stats.late++;
+	}
+
+	if (now < s->next) return 0;
+
+	if (tgSend(s) != IF_SEND_OK) {
+		s->stats.full++;
+		return 0;
+	}
+	s->next += s->interval;
+
+	return 1;
+}
+
+/* ===== Exported functions ===== */
+
+/* tgStart()
+ *   Starts sending count streams with given parameters, returns 0 if they
+ * are invalid or the local address is not set.
+ */
+int tgStart(const tg_config *cfg, int count)
+{
+	struct tgstream *s;
+	unsigned int cpsr;
+	int i;
+
+	if ( (tgstate == TG_STATE_ARP) || (tgstate == TG_STATE_RUNNING) ) return 0;
+	if ( (count < 1) || (count > TG_MAX_STREAMS) || (!ipGetAddress()) ) return 0;
+
+	for (i = 0; i < count; i++) {
+		if ( (cfg[i].size < TG_MIN_SIZE) || (cfg[i].size > TG_MAX_SIZE) ) return 0;
+		if ( (!cfg[i].rate) || (cfg[i].rate > TG_MAX_RATE) ) return 0;
+		if ( (!cfg[i].dest) || (cfg[i].dscp > 63) ) return 0;
+	}
+
+	/* Payload pattern */
+	for (i = 0; i < sizeof(tgdata); i++) tgdata[i] = i + TG_HDR_SIZE;
+
+	cpsr = irqLock();
+	memset(tgstreams, 0, sizeof(tgstreams));
+	tgcount = 0;
+	tgrun++;
+	irqUnlock(cpsr);
+
+	for (i = 0; i < count; i++) {
+		s = &tgstreams[i];
+		s->cfg = cfg[i];
+		tgBuild(s, i);
+		s->interval = ((unsigned long long)(s->cfg.size + TG_WIRE_OVERHEAD) * 8 * TS_TICKS_PER_SEC << TG_FRAC_BITS) /
+					  ((unsigned long long)s->cfg.rate * 1000);
+	}
+	tgcount = count;
+	briSetRecvHook(tgRecv);
+
+	tgstart = tsGetTicks64();
+	tgstop = tgstart;
+	tgstate = TG_STATE_ARP;
+	tgResolve();
+
+	return 1;
+}
+
+/* tgStop()
+ *   Stops sending and removes the receive hook, so returned frames are not
+ * counted any more. Results of the run are kept.
+ */
+void tgStop()
+{
+	int i;
+
+	if (tgstate == TG_STATE_RUNNING) {
+		tgstop = tsGetTicks64();
+		for (i = 0; i < tgcount; i++) {
+			if (!tgstreams[i].done) tgstreams[i].stop = tgstop;
+		}
+	}
+	if ( (tgstate == TG_STATE_ARP) || (tgstate == TG_STATE_RUNNING) ) tgstate = TG_STATE_IDLE;
+
+	briSetRecvHook(NULL);
+}
+
+/* tgPoll()
+ *   Queues frames that are due, called from the main loop. Streams take
+ * turns frame by frame, sending stops at the full TX ring and goes on at
+ * the next call.
+ */
+void tgPoll()
+{
+	unsigned long long now;
+	int i, sent, done;
+
+	if (tgstate == TG_STATE_ARP) tgResolve();
+	if (tgstate != TG_STATE_RUNNING) return;
+
+	now = tsGetTicks64() << TG_FRAC_BITS;
+
+	do {
+		sent = 0;
+		for (i = 0; i < tgcount; i++) sent += tgPace(&tgstreams[i], now);
+	} while (sent);
+
+	done = 1;
+	for (i = 0; i < tgcount; i++) done &= tgstreams[i].done;
+	if (done) {
+		tgstop = tsGetTicks64();
+		tgstate = TG_STATE_DONE;
+	}
+}
+
+void tgGetStats(int stream, tg_stats *stats)
+{
+	struct tgstream *s;
+	unsigned long long t;
+	unsigned int cpsr;
+
+	if ( (stream < 0) || (stream >= TG_MAX_STREAMS) ) return;
+	s = &tgstreams[stream];
+
+	/* Receive counters are updated from interrupt handlers */
+	cpsr = irqLock();
+	*stats = s->stats;
+	irqUnlock(cpsr);
+
+	stats->state = tgstate;
+
+	if (stream >= tgcount) t = tgstart;
+	else if (s->done) t = s->stop;
+	else t = (tgstate == TG_STATE_RUNNING) ? tsGetTicks64() : tgstop;
+	stats->elapsed = (t - tgstart) / (TS_TICKS_PER_SEC / 1000);
+}
+
+/* tgFrames()
+ *   Returns number of frames sent at rate in the given time
+ */
+unsigned long long tgFrames(unsigned int rate, unsigned short size, unsigned int seconds)
+{
+	unsigned long long n;
+
+	n = (unsigned long long)rate * 1000 / 8 * seconds / (size + TG_WIRE_OVERHEAD);
+	return n ? n : 1;
+}
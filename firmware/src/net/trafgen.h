@@ -0,0 +1,77 @@
+
+#ifndef _TRAFGEN_H
+#define _TRAFGEN_H
+
+/* UDP traffic generator
+ *
+ *   Every stream frame is built once from a template. Per frame only the
+ * sequence number, transmit time and IP identification are patched,
+ * checksums are adjusted incrementally. Frames are queued straight to EMAC,
+ * bypassing the bridge: headers are copied to the TX staging area and the
+ * payload, same for all streams, is sent by reference.
+ *
+ *   Frames sent back by a reflector (addresses and ports swapped) are
+ * counted at the bridge ingress and never reach the local stack.
+ */
+
+#define TG_MAX_STREAMS		4
+
+#define TG_DEST_PORT		9			/* Default destination port, discard */
+#define TG_SRC_PORT			49152
+
+#define TG_MIN_SIZE			64			/* Frame sizes, FCS included */
+#define TG_MAX_SIZE			1518
+#define TG_MAX_RATE			100000		/* kbit/s */
+
+/* Preamble, start delimiter and interframe gap, bytes */
+#define TG_WIRE_OVERHEAD	20
+
+/* Payload header, follows UDP header. Receiver may use it to count lost
+ * frames and transit time, run number tells frames of different starts.
+ */
+#define TG_MAGIC			0x5447454E	/* "TGEN" */
+
+typedef struct {
+	uint32		magic;
+	uint16		run;
+	uint16		stream;
+	uint32		seq;					/* Frame number in the stream from 0 */
+	uint32		tstamp;					/* Transmit time, timebase ticks */
+} PACKED tg_payload;
+
+/* Generator states */
+#define TG_STATE_IDLE		0
+#define TG_STATE_ARP		1			/* Resolving destination addresses */
+#define TG_STATE_RUNNING	2
+#define TG_STATE_DONE		3			/* All frames sent */
+#define TG_STATE_NOARP		4			/* Destination does not answer ARP */
+
+typedef struct {
+	unsigned int	dest;				/* Destination IP, host order */
+	unsigned short	port;				/* Destination UDP port */
+	unsigned short	size;				/* Frame size */
+	unsigned int	rate;				/* Line rate with preamble and gap, kbit/s */
+	unsigned long long count;			/* Frames to send, 0 - until stopped */
+	unsigned char	dscp;				/* DiffServ code point */
+} tg_config;
+
+typedef struct {
+	unsigned char		state;			/* Generator state */
+	unsigned long long	frames;			/* Frames queued to EMAC */
+	unsigned long long	bytes;			/* Bytes queued, FCS included */
+	unsigned int		full;			/* Sends refused by the full TX ring */
+	unsigned int		late;			/* Times pacing fell behind and was reset */
+	unsigned int		elapsed;		/* Sending time, ms */
+	unsigned long long	received;		/* Frames returned by the reflector */
+	unsigned int		rtt_min;		/* Round trip time of returned frames, ticks */
+	unsigned int		rtt_max;
+	unsigned long long	rtt_sum;
+} tg_stats;
+
+int tgStart(const tg_config *cfg, int count);
+void tgStop(void);
+void tgPoll(void);
+void tgGetStats(int stream, tg_stats *stats);
+unsigned long long tgFrames(unsigned int rate, unsigned short size, unsigned int seconds);
+
+#endif
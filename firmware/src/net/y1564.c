@@ -0,0 +1,280 @@
+
+#include <config.h>
+#include <string.h>
+
+#include <drivers/tstamp.h>
+#include <net/ip.h>
+#include <net/trafgen.h>
+
+#include "y1564.h"
+
+
+/* Step phases */
+#define SAT_STEP_SEND		0			/* Generator is sending */
+#define SAT_STEP_SETTLE		1			/* Waiting for frames still in flight */
+
+/* ===== Test data ===== */
+
+static sat_config satcfg;
+static sat_status satstat;
+static sat_result satres[SAT_MAX_SERVICES];
+
+static unsigned char satphase;
+static unsigned long long satsettle;		/* End of the settle time, ticks */
+
+
+/* ===== Internal functions ===== */
+
+/* satStepRate()
+ *   Returns rate of the configuration test step, 0 if step is skipped
+ */
+static unsigned int satStepRate(sat_service *sv, unsigned char step)
+{
+	if (step <= SAT_STEP_CIR) return sv->cir / 4 * (step + 1);
+	if (step == SAT_STEP_EIR) return sv->eir ? (sv->cir + sv->eir) : 0;
+
+	return (sv->cir + sv->eir) / 100 * SAT_POLICING;
+}
+
+/* satConfig()
+ *   Fills generator stream configuration for the service
+ */
+static void satConfig(tg_config *tg, sat_service *sv, unsigned int rate, unsigned int seconds)
+{
+	tg->dest = satcfg.dest;
+	tg->port = satcfg.port;
+	tg->size = sv->size;
+	tg->rate = (rate > TG_MAX_RATE) ? TG_MAX_RATE : rate;
+	tg->count = tgFrames(tg->rate, sv->size, seconds);
+	tg->dscp = sv->dscp;
+}
+
+/* satMeasure()
+ *   Computes stream measurements from the generator statistics
+ */
+static void satMeasure(sat_measure *m, sat_service *sv, tg_stats *tg)
+{
+	unsigned long long lost;
+
+	lost = (tg->frames > tg->received) ? (tg->frames - tg->received) : 0;
+
+	/* Wire rate of the returned frames, bytes per ms is kbit/s divided by 8 */
+	m->ir = 0;
+	if (tg->elapsed) m->ir = tg->received * (sv->size + TG_WIRE_OVERHEAD) * 8 / tg->elapsed;
+	m->flr = tg->frames ? lost * 10000 / tg->frames : 0;
+
+	m->ftd = 0;
+	m->ftd_max = 0;
+	m->fdv = 0;
+	if (tg->received) {
+		m->ftd = tg->rtt_sum / tg->received / TS_TICKS_PER_US;
+		m->ftd_max = tg->rtt_max / TS_TICKS_PER_US;
+		m->fdv = (tg->rtt_max - tg->rtt_min) / TS_TICKS_PER_US;
+	}
+}
+
+/* satCheckSLA()
+ *   Checks measurement at or below CIR against the service thresholds
+ */
+static unsigned char satCheckSLA(sat_measure *m, sat_service *sv, unsigned int rate)
+{
+	if (m->flr > sv->flr) return SAT_RESULT_FAIL;
+	if ( (!m->ir) || (m->ftd > sv->ftd) || (m->fdv > sv->fdv) ) return SAT_RESULT_FAIL;
+	if (m->ir < rate / 100 * (100 - SAT_IR_TOLERANCE)) return SAT_RESULT_FAIL;
+
+	return SAT_RESULT_PASS;
+}
+
+/* satFinish()
+ *   Ends the test and stops the generator
+ */
+static void satFinish(unsigned char state)
+{
+	tgStop();
+	satstat.state = state;
+}
+
+/* satTrial()
+ *   Starts generator for the current configuration test step or for the
+ * performance test. Returns 0 when there is nothing left to run.
+ */
+static int satTrial()
+{
+	tg_config tg[SAT_MAX_SERVICES];
+	sat_service *sv;
+	unsigned int rate;
+	int i, n;
+
+	n = 0;
+	if (satstat.phase == SAT_PHASE_CONFIG) {
+		/* Next enabled service and step that is not skipped */
+		for (; satstat.service < SAT_MAX_SERVICES; satstat.service++, satstat.step = 0) {
+			sv = &satcfg.service[satstat.service];
+			if (!sv->enabled) continue;
+
+			for (; satstat.step < SAT_STEPS; satstat.step++) {
+				rate = satStepRate(sv, satstat.step);
+				if (rate) break;
+			}
+			if (satstat.step < SAT_STEPS) break;
+		}
+
+		if (satstat.service < SAT_MAX_SERVICES) {
+			satstat.rate = rate;
+			satConfig(&tg[0], sv, rate, satcfg.steptime);
+			n = 1;
+		} else {
+			satstat.phase = SAT_PHASE_PERF;
+		}
+	}
+
+	if ( (satstat.phase == SAT_PHASE_PERF) && (!n) ) {
+		if (!satcfg.perftime) return 0;
+
+		/* All services together at CIR, streams follow enabled services */
+		for (i = 0; i < SAT_MAX_SERVICES; i++) {
+			sv = &satcfg.service[i];
+			if (sv->enabled) satConfig(&tg[n++], sv, sv->cir, satcfg.perftime * 60);
+		}
+		satstat.rate = 0;
+	}
+
+	satphase = SAT_STEP_SEND;
+	if (!tgStart(tg, n)) satFinish(SAT_STATE_ERROR);
+
+	return 1;
+}
+
+/* satEvaluate()
+ *   Records results of the finished step and moves to the next one
+ */
+static void satEvaluate()
+{
+	tg_stats tg;
+	sat_service *sv;
+	sat_measure *m;
+	sat_result *r;
+	unsigned int cir, top;
+	int i, n;
+
+	if (satstat.phase == SAT_PHASE_CONFIG) {
+		sv = &satcfg.service[satstat.service];
+		r = &satres[satstat.service];
+		m = &r->step[satstat.step];
+
+		tgGetStats(0, &tg);
+		satMeasure(m, sv, &tg);
+
+		cir = sv->cir / 100 * (100 - SAT_IR_TOLERANCE);
+		top = (sv->cir + sv->eir) / 100 * (100 + SAT_IR_TOLERANCE);
+
+		/* Above CIR frames may be lost, only the committed rate must pass */
+		if (satstat.step <= SAT_STEP_CIR) {
+			m->result = satCheckSLA(m, sv, satstat.rate);
+		} else if (satstat.step == SAT_STEP_EIR) {
+			m->result = (m->ir >= cir) ? SAT_RESULT_PASS : SAT_RESULT_FAIL;
+		} else {
+			m->result = ( (m->ir >= cir) && (m->ir <= top) ) ? SAT_RESULT_PASS : SAT_RESULT_FAIL;
+		}
+
+		if (r->config != SAT_RESULT_FAIL) r->config = m->result;
+		if (m->result == SAT_RESULT_FAIL) satstat.result = SAT_RESULT_FAIL;
+
+		satstat.step++;
+	} else {
+		for (i = 0, n = 0; i < SAT_MAX_SERVICES; i++) {
+			sv = &satcfg.service[i];
+			if (!sv->enabled) continue;
+
+			m = &satres[i].perf;
+			tgGetStats(n++, &tg);
+			satMeasure(m, sv, &tg);
+			m->result = satCheckSLA(m, sv, sv->cir);
+			if (m->result == SAT_RESULT_FAIL) satstat.result = SAT_RESULT_FAIL;
+		}
+
+		satstat.phase = SAT_PHASE_DONE;
+	}
+
+	if ( (satstat.phase == SAT_PHASE_DONE) || (!satTrial()) ) {
+		satFinish(SAT_STATE_DONE);
+		if (satstat.result != SAT_RESULT_FAIL) satstat.result = SAT_RESULT_PASS;
+	}
+}
+
+/* ===== Exported functions ===== */
+
+/* satStart()
+ *   Clears results and starts the test, returns 0 if configuration is
+ * invalid.
+ */
+int satStart(const sat_config *cfg)
+{
+	const sat_service *sv;
+	int i, n;
+
+	if (satstat.state == SAT_STATE_RUNNING) return 0;
+	if ( (!cfg->dest) || (!cfg->steptime) || (!ipGetAddress()) ) return 0;
+
+	n = 0;
+	for (i = 0; i < SAT_MAX_SERVICES; i++) {
+		sv = &cfg->service[i];
+		if (!sv->enabled) continue;
+		if ( (sv->size < TG_MIN_SIZE) || (sv->size > TG_MAX_SIZE) || (sv->dscp > 63) ) return 0;
+		if ( (sv->cir < 4) || (sv->cir + sv->eir > TG_MAX_RATE) ) return 0;
+		n++;
+	}
+	if (!n) return 0;
+
+	satcfg = *cfg;
+	memset(satres, 0, sizeof(satres));
+	memset(&satstat, 0, sizeof(satstat));
+	satstat.state = SAT_STATE_RUNNING;
+	satstat.phase = SAT_PHASE_CONFIG;
+
+	if (!satTrial()) satFinish(SAT_STATE_DONE);
+
+	return 1;
+}
+
+void satStop()
+{
+	if (satstat.state != SAT_STATE_RUNNING) return;
+
+	satFinish(SAT_STATE_IDLE);
+}
+
+/* satPoll()
+ *   Follows step progress, called from the main loop
+ */
+void satPoll()
+{
+	tg_stats tg;
+
+	if (satstat.state != SAT_STATE_RUNNING) return;
+
+	if (satphase == SAT_STEP_SEND) {
+		tgGetStats(0, &tg);
+		if (tg.state == TG_STATE_NOARP) satFinish(SAT_STATE_NOARP);
+		if (tg.state != TG_STATE_DONE) return;
+
+		/* Frames may still be on the way back */
+		satphase = SAT_STEP_SETTLE;
+		satsettle = tsGetTicks64() + (unsigned long long)SAT_SETTLE_TIME * TS_TICKS_PER_SEC;
+		return;
+	}
+
+	if (tsGetTicks64() < satsettle) return;
+
+	satEvaluate();
+}
+
+void satGetStatus(sat_status *status)
+{
+	*status = satstat;
+}
+
+const sat_result *satGetResults()
+{
+	return satres;
+}
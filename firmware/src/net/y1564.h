@@ -0,0 +1,100 @@
+
+#ifndef _Y1564_H
+#define _Y1564_H
+
+#include <net/trafgen.h>
+
+/* ITU-T Y.1564 service activation test
+ *
+ *   Every service is a generator stream with own frame size, DSCP and
+ * bandwidth profile, run against a remote reflector. Rates are line rates
+ * with preamble and gap, as the generator counts them.
+ *
+ *   Service configuration test runs services one by one in steps:
+ * 25%, 50%, 75% and 100% of CIR, CIR + EIR, then policing at 125% of
+ * CIR + EIR. Service performance test runs all services together at CIR.
+ *
+ *   Frame delay is measured as round trip time through the reflector,
+ * delay variation is the spread between the shortest and longest delay.
+ */
+
+#define SAT_MAX_SERVICES	TG_MAX_STREAMS
+
+/* Configuration test steps */
+#define SAT_STEP_CIR		3			/* Steps 0..3 are 25%..100% of CIR */
+#define SAT_STEP_EIR		4			/* CIR + EIR, skipped without EIR */
+#define SAT_STEP_POLICING	5			/* Overshoot of CIR + EIR */
+#define SAT_STEPS			6
+
+#define SAT_POLICING		125			/* Policing step rate, % of CIR + EIR */
+#define SAT_IR_TOLERANCE	1			/* Information rate tolerance, % */
+#define SAT_SETTLE_TIME		2			/* Wait for returned frames after a step, s */
+
+/* Test states */
+#define SAT_STATE_IDLE		0
+#define SAT_STATE_RUNNING	1
+#define SAT_STATE_DONE		2
+#define SAT_STATE_NOARP		3			/* Reflector does not answer ARP */
+#define SAT_STATE_ERROR		4			/* Generator did not start, local address lost */
+
+/* Test phases */
+#define SAT_PHASE_CONFIG	0
+#define SAT_PHASE_PERF		1
+#define SAT_PHASE_DONE		2
+
+/* Results */
+#define SAT_RESULT_NONE		0			/* Not measured */
+#define SAT_RESULT_PASS		1
+#define SAT_RESULT_FAIL		2
+
+typedef struct {
+	unsigned char	enabled;
+	unsigned char	dscp;
+	unsigned short	size;				/* Frame size */
+	unsigned int	cir;				/* Committed rate, kbit/s */
+	unsigned int	eir;				/* Excess rate, kbit/s */
+	/* SLA thresholds */
+	unsigned int	ftd;				/* Frame delay, us */
+	unsigned int	fdv;				/* Frame delay variation, us */
+	unsigned short	flr;				/* Frame loss ratio, 0.01% units */
+} sat_service;
+
+typedef struct {
+	unsigned int	dest;				/* Reflector IP, host order */
+	unsigned short	port;				/* Reflector UDP port */
+	unsigned short	steptime;			/* Configuration test step, s */
+	unsigned short	perftime;			/* Performance test, min, 0 - skipped */
+	sat_service		service[SAT_MAX_SERVICES];
+} sat_config;
+
+typedef struct {
+	unsigned char	result;				/* SAT_RESULT_* */
+	unsigned int	ir;					/* Information rate received, kbit/s */
+	unsigned int	ftd;				/* Average frame delay, us */
+	unsigned int	ftd_max;
+	unsigned int	fdv;				/* us */
+	unsigned short	flr;				/* 0.01% units */
+} sat_measure;
+
+typedef struct {
+	sat_measure		step[SAT_STEPS];
+	sat_measure		perf;
+	unsigned char	config;				/* Configuration test result */
+} sat_result;
+
+typedef struct {
+	unsigned char	state;
+	unsigned char	phase;
+	unsigned char	service;			/* Service under configuration test */
+	unsigned char	step;
+	unsigned char	result;				/* Overall result when done */
+	unsigned int	rate;				/* Rate of the service step, kbit/s */
+} sat_status;
+
+int satStart(const sat_config *cfg);
+void satStop(void);
+void satPoll(void);
+void satGetStatus(sat_status *status);
+const sat_result *satGetResults(void);
+
+#endif
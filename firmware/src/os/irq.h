@@ -0,0 +1,27 @@
+
+#ifndef _IRQ_H
+#define _IRQ_H
+
+/* irqLock()
+ *   Disables IRQ in CPSR, returns previous CPSR for irqUnlock(). Used for
+ * short critical sections shared by interrupt handlers and the main loop.
+ */
+static inline unsigned int irqLock()
+{
+	unsigned int cpsr, tmp;
+
+	asm volatile (
+		"mrs %0, cpsr\n\t"
+		"orr %1, %0, #0x80\n\t"
+		"msr cpsr_c, %1"
+		: "=r" (cpsr), "=r" (tmp) : : "memory");
+
+	return cpsr;
+}
+
+static inline void irqUnlock(unsigned int cpsr)
+{
+	asm volatile ("msr cpsr_c, %0" : : "r" (cpsr) : "memory");
+}
+
+#endif
@@ -2,8 +2,13 @@
 #include <config.h>
 #include <string.h>
 
+#include <drivers/ethernet.h>
 #include <grlib/grlib.h>
 #include <net/bridge.h>
+#include <net/capture.h>
+#include <net/trafgen.h>
+#include <net/rfc2544.h>
+#include <net/y1564.h>
 
 #include "messages.h"
 
@@ -50,8 +55,19 @@ void idle()
 		msgFirst = msgNext(msgFirst);
 	}
 
+	/* Process received frames */
+	EthPoll();
+
 	/* Process received packets */
 	ifRecvPoll();
+
+	/* Queue generated frames */
+	tgPoll();
+	rfcPoll();
+	satPoll();
+
+	/* Write captured frames to the card */
+	capPoll();
 }
 
 void msgPostMessage(void *msgWindow, unsigned short msgCode, unsigned short msgParam, void *msgPtr)
@@ -11,6 +11,7 @@
 #define SYS_REG_IP4_DNS			6
 #define SYS_REG_MODEL_NAME		7
 #define SYS_REG_USB_DEVICE		8
+#define SYS_REG_ETH_RX_BUFFERS	9		/* Receive ring length, buffers of 128 bytes */
 
 void regInit(void);
 void regSave(void);
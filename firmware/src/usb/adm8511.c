@@ -6,7 +6,9 @@
 #include <usb/device/core/USBD.h>
 #include <usb/device/core/USBDDriver.h>
 #include <drivers/ethernet.h>
+#include <drivers/tstamp.h>
 #include <net/bridge.h>
+#include <net/pktpool.h>
 #include "adm8511.h"
 
 
@@ -42,10 +44,10 @@ extern const USBDDriverDescriptors ADM8511Descriptors;
 /* Standard device driver instance */
 static USBDDriver usbdDriver;
 
-/* Receive data buffer */
-static unsigned char ethRecvData[ADM8511_MTU];
+/* Receive pool buffer, frame is read to the drop area if pool is exhausted */
+static pktbuf *ethRecvBuffer;
 static unsigned int ethRecvDataSize;
-static pktbuf ethRecvBuffer;
+static unsigned char ethDropData[ADM8511_DATAOUT_SIZE];
 
 /* Send data buffer + 4byte CRC + 4byte status */
 static unsigned char ethSendData[ADM8511_MTU + 8];
@@ -56,6 +58,15 @@ static unsigned char intData[ADM8511_INT_SIZE];
 
 /* ===== Internal functions ===== */
 
+/* admRecvPointer()
+ *   Returns place for the next received data packet
+ */
+static unsigned char *admRecvPointer()
+{
+	if (!ethRecvBuffer) return ethDropData;
+	return &ethRecvBuffer->data[ethRecvDataSize];
+}
+
 static void admDataHandler(unsigned int unused, unsigned char status,
 						   unsigned int received, unsigned int remaining)
 {
@@ -63,17 +74,26 @@ static void admDataHandler(unsigned int unused, unsigned char status,
 
 	if (received < 64) {
 		do {
+			/* Frame is dropped */
+			if (!ethRecvBuffer) {
+				briCountDrop(BRI_IF_USB, BRI_CNT_DROP_POOL);
+				break;
+			}
+
 			/* Packet size (2) + 2 mac addr (12) */
 			if (ethRecvDataSize < 14) break;
 
-			/* Send received packet to bridge */
-			ethRecvBuffer.next = NULL;
-			ethRecvBuffer.data = &ethRecvData[2];
-			ethRecvBuffer.len = ethRecvDataSize - 2;
-			briPacketRecv(BRI_IF_USB, &ethRecvBuffer);
+			/* Send received packet to bridge, it takes own references */
+			ethRecvBuffer->data += 2;
+			ethRecvBuffer->len = ethRecvDataSize - 2;
+			ethRecvBuffer->tstamp = tsGetTicks();
+			briPacketRecv(BRI_IF_USB, ethRecvBuffer);
+			pktFree(ethRecvBuffer);
+			ethRecvBuffer = NULL;
 		} while(0);
 
 		ethRecvDataSize = 0;
+		if (!ethRecvBuffer) ethRecvBuffer = pktAlloc(PKT_USER_USB);
 	}
 
 	/* Check for input buffer overflow */
@@ -82,7 +102,7 @@ static void admDataHandler(unsigned int unused, unsigned char status,
 	}
 
 	/* Start reading next data packet */
-	USBD_Read(ADM8511_DATAOUT, &ethRecvData[ethRecvDataSize], ADM8511_DATAOUT_SIZE, (TransferCallback) admDataHandler, 0);
+	USBD_Read(ADM8511_DATAOUT, admRecvPointer(), ADM8511_DATAOUT_SIZE, (TransferCallback) admDataHandler, 0);
 }
 
 static void admIntHandler(unsigned int unused, unsigned char status,
@@ -130,7 +150,7 @@ static void admRegWriteHandler(unsigned int wIndex, unsigned char status,
 	USBD_Write(0, 0, 0, 0, 0);
 }
 
-static void admSendPacket(pktbuf *packet)
+static int admSendPacket(pktbuf *packet)
 {
 	unsigned char *data;
 	unsigned short size;
@@ -142,7 +162,7 @@ static void admSendPacket(pktbuf *packet)
 	/* Copy packet to send buffer */
 	for (buf = packet; buf; buf = buf->next) {
 		/* Check buffer overflow */
-		if ( (size + buf->len) > ADM8511_MTU ) return;
+		if ( (size + buf->len) > ADM8511_MTU ) return IF_SEND_OVERSIZE;
 
 		/* Copy data */
 		memcpy(data, buf->data, buf->len);
@@ -166,7 +186,9 @@ static void admSendPacket(pktbuf *packet)
 	size += 4;
 
 	/* Send packet */
-	USBD_Write(ADM8511_DATAIN, ethSendData, size, 0, 0);
+	if (USBD_Write(ADM8511_DATAIN, ethSendData, size, 0, 0) != USBD_STATUS_SUCCESS) return IF_SEND_FULL;
+
+	return IF_SEND_OK;
 }
 
 /* ===== Exported functions ===== */
@@ -190,7 +212,7 @@ void ADM8511_Initialize()
 	regs[ADM_REG_ADDRESS5] = 0x01;
 
 	/* Register interface */
-	briIfRegister(BRI_IF_USB, "USB Interface", admSendPacket, &regs[ADM_REG_ADDRESS0]);
+	briIfRegister(BRI_IF_USB, "USB Interface", admSendPacket, NULL, &regs[ADM_REG_ADDRESS0]);
 
 	/* Init the USB driver */
 	USBDDriver_Initialize(&usbdDriver, &ADM8511Descriptors, 0);
@@ -224,7 +246,8 @@ void ADM8511_Configured()
 {
 	/* Start reading data packets */
 	ethRecvDataSize = 0;
-	USBD_Read(ADM8511_DATAOUT, ethRecvData, ADM8511_DATAOUT_SIZE, (TransferCallback) admDataHandler, 0);
+	if (!ethRecvBuffer) ethRecvBuffer = pktAlloc(PKT_USER_USB);
+	USBD_Read(ADM8511_DATAOUT, admRecvPointer(), ADM8511_DATAOUT_SIZE, (TransferCallback) admDataHandler, 0);
 
 	/* Write status data */
 	USBD_Write(ADM8511_INT, intData, ADM8511_INT_SIZE, (TransferCallback) admIntHandler, 0);
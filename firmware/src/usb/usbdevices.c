@@ -6,6 +6,7 @@
 #include <drivers/sdcard.h>
 #include <drivers/ethernet.h>
 
+#include <net/bridge.h>
 #include <usb/adm8511.h>
 #include "usbdevices.h"
 
@@ -14,6 +15,9 @@
 #define DATABUFFERSIZE \
     BOARD_USB_ENDPOINTS_MAXPACKETSIZE(CDCDSerialDriverDescriptors_DATAIN)
 
+/// Size of the terminal output buffer
+#define TERMBUFFERSIZE	1024
+
 #define USB_PIN_VBUS	(1 << 6)
 #define USB_PIN_PULLUP	(1 << 7)
 
@@ -28,10 +32,135 @@ static unsigned char cardbuffer[CARD_BLOCK_SIZE];
 
 // Debug Port
 static unsigned char usbBuffer[DATABUFFERSIZE];
-static char termBuffer[DATABUFFERSIZE];
+static char termBuffer[TERMBUFFERSIZE];
+static eth_stats ethStats;
+static bri_counters briStats;
+
+// Commands using Ethernet driver state are done from the main loop
+static char phyBuffer[DATABUFFERSIZE];
+static unsigned short phyRegs[4];
+static volatile unsigned char portCommand;
 
 /* ===== Debug port ===== */
 
+/* dport_u64()
+ *   Formats 64-bit unsigned value, sprintf does not support it
+ */
+static char *dport_u64(char *buf, unsigned long long v)
+{
+	char tmp[21];
+	int i;
+
+	i = sizeof(tmp) - 1;
+	tmp[i] = 0;
+	do {
+		tmp[--i] = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+
+	strcpy(buf, &tmp[i]);
+	return buf;
+}
+
+/* dport_stats()
+ *   Prints Ethernet statistics totals and rates
+ */
+static void dport_stats(char *buf, int size)
+{
+	char num[21];
+	char *end = buf + size;
+	int i;
+
+	EthGetStats(&ethStats);
+	for (i = 0; i < ETH_STAT_COUNT; i++) {
+		/* Longest line fits in 64 bytes */
+		if ( (end - buf) < 64 ) break;
+		buf += sprintf(buf, "%s %s %u/s\r\n", EthStatName(i),
+			dport_u64(num, ethStats.count[i]), ethStats.rate[i]);
+	}
+}
+
+/* dport_phyread()
+ *   Collects PHY registers read by dport_command(), prints them after the last one
+ */
+static void dport_phyread(unsigned char reg, unsigned short val, void *arg)
+{
+	phyRegs[(int)arg] = val;
+
+	switch (reg) {
+		case 28:
+			sprintf(phyBuffer, "0 = %X, 16 = %X, 17 = %X, 28 = %X\r\n",
+				phyRegs[0], phyRegs[1], phyRegs[2], phyRegs[3]);
+			break;
+		case 27:
+			sprintf(phyBuffer, "VCT Results: %X %X\r\n", phyRegs[0], phyRegs[1]);
+			break;
+		default:
+			return;
+	}
+
+	CDCDSerialDriver_Write(phyBuffer, strlen(phyBuffer), 0, 0);
+}
+
+/* dport_command()
+ *   Does the command received by dport_recv() which can not run from the
+ * USB interrupt: PHY access and reads of statistics updated by the main loop
+ */
+static void dport_command()
+{
+	switch (portCommand) {
+		case 'e':
+			EthPHYReadAsync(0, dport_phyread, (void *)0);
+			EthPHYReadAsync(16, dport_phyread, (void *)1);
+			EthPHYReadAsync(17, dport_phyread, (void *)2);
+			EthPHYReadAsync(28, dport_phyread, (void *)3);
+			break;
+
+		case 'c':
+			EthPHYWriteAsync(26, 0x8000, NULL, NULL);
+			sprintf(phyBuffer, "VCT Started\r\n");
+			CDCDSerialDriver_Write(phyBuffer, strlen(phyBuffer), 0, 0);
+			break;
+
+		case 'r':
+			EthPHYReadAsync(26, dport_phyread, (void *)0);
+			EthPHYReadAsync(27, dport_phyread, (void *)1);
+			break;
+
+		case 'R':
+			/* Restarts PHY queue, so it is done from the main loop as well */
+			EthInit();
+			break;
+
+		case 's':
+			/* 64-bit totals can not be read atomically from the interrupt */
+			dport_stats(termBuffer, sizeof(termBuffer));
+			CDCDSerialDriver_Write(termBuffer, strlen(termBuffer), 0, 0);
+			break;
+	}
+
+	portCommand = 0;
+}
+
+/* dport_bridge()
+ *   Prints bridge counters, one column per interface
+ */
+static void dport_bridge(char *buf, int size)
+{
+	char *end = buf + size;
+	int i, j;
+
+	briGetCounters(&briStats);
+	buf += sprintf(buf, "Counter Local Ethernet USB\r\n");
+	for (i = 0; i < BRI_CNT_COUNT; i++) {
+		/* Longest line fits in 48 bytes */
+		if ( (end - buf) < 48 ) break;
+		buf += sprintf(buf, "%s", briCounterName(i));
+		for (j = 0; j < BRI_IF_COUNT; j++) buf += sprintf(buf, " %u", briStats.count[j][i]);
+		buf += sprintf(buf, "\r\n");
+	}
+}
+
 static void dport_recv(unsigned int unused,
                             unsigned char status,
                             unsigned int received,
@@ -52,29 +181,15 @@ static void dport_recv(unsigned int unused,
 				break;
 
 			case 'e':
-				sprintf(termBuffer, "0 = %X, 16 = %X, 17 = %X, 28 = %X\r\n",
-					EthPHYRead(0), EthPHYRead(16), EthPHYRead(17), EthPHYRead(28));
-				break;
-
-			case 's':
-				sprintf(termBuffer, "FrOK %i, FCSE %i, ALE %i, RRE %i, ROVR %i, RSE %i\r\n",
-					AT91C_BASE_EMAC->EMAC_FRO,
-					AT91C_BASE_EMAC->EMAC_FCSE,
-					AT91C_BASE_EMAC->EMAC_ALE,
-					AT91C_BASE_EMAC->EMAC_RRE,
-					AT91C_BASE_EMAC->EMAC_ROV,
-					AT91C_BASE_EMAC->EMAC_RSE);
-				break;
-
 			case 'c':
-				EthPHYWrite(26, 0x8000);
-				sprintf(termBuffer, "VCT Started\r\n");
-				break;
 			case 'r':
-				sprintf(termBuffer, "VCT Results: %X %X\r\n", EthPHYRead(26), EthPHYRead(27));
-				break;
 			case 'R':
-				EthInit();
+			case 's':
+				portCommand = usbBuffer[0];
+				break;
+
+			case 'b':
+				dport_bridge(termBuffer, sizeof(termBuffer));
 				break;
 
 			case 'm':
@@ -192,6 +307,9 @@ void usbStart()
 
 void usbStop()
 {
+	/* Stop bridging to USB */
+	if (devtype == USB_DEVICE_ADM8511) briIfUnregister(BRI_IF_USB);
+
 	devtype = 0;
 
 	/* Disable pullup */
@@ -223,6 +341,7 @@ void usbPoll()
 				// Start receiving data on the USB
 				CDCDSerialDriver_Read(usbBuffer, DATABUFFERSIZE, (TransferCallback) dport_recv, 0);
 			}
+			if (portCommand) dport_command();
 			break;
 
 		case USB_DEVICE_ADM8511: